@@ -39,8 +39,18 @@ ADT_RESULT APDCAM_SetAllOffset(ADT_HANDLE handle, unsigned int offset);
 // sampleCount allocated buffer size
 // If bits < 0, uses default (read back from APD). The valid values are 8,12,14
 // If The channelMask_n < 0 uses default. Else they must be in 0 <= channelMask_n <= 255.
+// The buffers of a stream are put in huge pages if available, on the NUMA node of its decoder thread (APDCAM_SetThreadConfig
+// before this call) or else of the stream interface.
 ADT_RESULT APDCAM_Allocate(ADT_HANDLE handle, uint64_t sampleCount, int bits, uint32_t channelMask_1, uint32_t channelMask_2, uint32_t channelMask_3, uint32_t channelMask_4, int primary_buffer_size = 10);
+// The channel buffers of the streams (32 of each): buffers[s * 32 + k] is the buffer of the k-th active channel of
+// stream s, NULL after the last active channel. Only the active channels get a buffer.
 ADT_RESULT APDCAM_GetBuffers(ADT_HANDLE handle, INT16 **buffers);
+// The interleaved user buffers of the streams (MAX_STREAMNUM of each): value k of sample i is buffers[s][i * strides[s] + k],
+// k counting the active channels. NULL and 0 for a stream with per channel buffers, APDCAM_GetBuffers gives NULL for an interleaved one.
+ADT_RESULT APDCAM_GetInterleavedBuffers(ADT_HANDLE handle, INT16 **buffers, unsigned int *strides);
+// The decimated rings of the streams, as APDCAM_GetBuffers gives the channel buffers (NULL without decimation), and as
+// APDCAM_GetSampleInfo the decimated samples so far and the index of the next one in the ring (MAX_STREAMNUM of each).
+ADT_RESULT APDCAM_GetDecimatedBuffers(ADT_HANDLE handle, INT16 **buffers, ULONGLONG *sampleCounts, ULONGLONG *sampleIndices);
 ADT_RESULT APDCAM_GetSampleInfo(ADT_HANDLE handle, ULONGLONG *sampleCounts, ULONGLONG *sampleIndices);
 
 ADT_RESULT APDCAM_SetTiming(ADT_HANDLE handle, int basicPLLmul, int basicPLLdiv_0, int basicPLLdiv_1, int clkSorce, int extDCMmul, int extDCMdiv);
@@ -49,9 +59,12 @@ ADT_RESULT APDCAM_Sampling(ADT_HANDLE handle, int sampleDiv, int sampleSrc);
 // sampleCount: requested data volume.
 // mode = MM_ONE_SHOT, MM_CYCLIC
 // calibrated or non-calibrated mode ?
-ADT_RESULT APDCAM_ARM(ADT_HANDLE handle, ADT_MEASUREMENT_MODE mode, uint64_t sampleCount, ADT_CALIB_MODE calibMode, int signalFrequency = 100);
+// receiveMode = RM_POLL, RM_BUSY_POLL (see APDCAM_SetBusyPoll)
+ADT_RESULT APDCAM_ARM(ADT_HANDLE handle, ADT_MEASUREMENT_MODE mode, uint64_t sampleCount, ADT_CALIB_MODE calibMode, int signalFrequency = 100, ADT_RECEIVE_MODE receiveMode = RM_POLL);
 ADT_RESULT APDCAM_Trigger(ADT_HANDLE handle, ADT_TRIGGER trigger, ADT_TRIGGER_MODE mode, ADT_TRIGGER_EDGE edge, int triggerDelay, ADT_TRIGGERINFO* triggerInfo);
 
+// Raw packets of the stream are written to dumpFileName by a writer thread, NULL or empty: no dump.
+// Packets are left out if the disk falls behind (ADT_STREAM_STATS dumpDrops).
 ADT_RESULT APDCAM_StreamDump(ADT_HANDLE handle, uint8_t streamNo, const char *dumpFileName);
 ADT_RESULT APDCAM_Start(ADT_HANDLE handle);
 ADT_RESULT APDCAM_Wait(ADT_HANDLE handle, int timeout);
@@ -60,6 +73,60 @@ ADT_RESULT APDCAM_SWTrigger(ADT_HANDLE handle);
 
 ADT_RESULT APDCAM_SetIP(ADT_HANDLE handle, UINT32 ip_h);
 ADT_RESULT APDCAM_SetStreamInterface(ADT_HANDLE handle, const char *ifname);
+// Number of packets (1..64) the stream servers receive with one recvmmsg() call. Takes effect at the next APDCAM_ARM.
+ADT_RESULT APDCAM_SetReceiveBatch(ADT_HANDLE handle, int batchSize);
+// UDP_GRO on the stream sockets: one receive call takes up to 64 KiB of consecutive packets. Replaces the receive batch
+// when the kernel supports it. Takes effect at the next APDCAM_ARM. The RB_SOCKET backend only.
+ADT_RESULT APDCAM_SetReceiveGro(ADT_HANDLE handle, bool enable);
+// Latency mode (latency > 0, us): the decoder is signaled after latency us at the latest. Until then the packets are
+// collected up to the count arriving in latency at the current rate (at most signalFrequency of APDCAM_ARM), so high
+// rates are still decoded in batches. 0: signal every signalFrequency packets. Takes effect at the next APDCAM_ARM.
+// The RB_SOCKET backend only.
+ADT_RESULT APDCAM_SetSignalLatency(ADT_HANDLE handle, unsigned int latency);
+// Receiver of the devices opened afterwards. RB_PACKET_RING needs CAP_NET_RAW, RB_XDP needs CAP_NET_ADMIN and CAP_BPF.
+ADT_RESULT APDCAM_SetReceiveBackend(ADT_RECEIVE_BACKEND backend);
+// Reactor mode: the socket receivers and decoders of all cameras run on a shared pool of threads (threads = 0: one per CPU)
+// instead of two threads per stream. Takes effect at the next APDCAM_ARM. The RB_SOCKET backend only.
+ADT_RESULT APDCAM_SetReactorMode(bool enable, unsigned int threads);
+// Helper threads (0: none, the default) decoding the packets of all streams in parallel with their decoders, so that the
+// decoding of one fast stream is spread over several CPUs. Not while a software trigger is armed. Takes effect at the next APDCAM_ARM.
+ADT_RESULT APDCAM_SetDecodeThreads(unsigned int threads);
+// NIC receive queue of a stream (1..4) for the RB_XDP backend, default: stream number - 1. Takes effect at the next APDCAM_ARM.
+ADT_RESULT APDCAM_SetStreamQueue(ADT_HANDLE handle, uint8_t streamNo, unsigned int queue);
+// Where the camera sends a stream (1..4), default: STT_MULTICAST to 239.123.13.100. Takes effect at the next APDCAM_ARM.
+// STT_MULTICAST: ip_h is the group (0: the default), mac is not used.
+// STT_UNICAST: ip_h is the receiving host (0: the address of the interface), mac its MAC (NULL: the MAC of the interface,
+// or from the ARP cache for another host). ifname: the interface the stream is received on, NULL or empty: the one of
+// APDCAM_SetStreamInterface.
+ADT_RESULT APDCAM_SetStreamDestination(ADT_HANDLE handle, uint8_t streamNo, ADT_STREAM_TRANSPORT transport, uint32_t ip_h, const uint8_t *mac, const char *ifname);
+// Busy poll settings of a stream (1..4), used when APDCAM_ARM selects RM_BUSY_POLL. cpu < 0: the receiver is not pinned,
+// busyPollTime: SO_BUSY_POLL in us (above net.core.busy_read needs CAP_NET_ADMIN), spinBudget: empty reads before sleeping in poll().
+ADT_RESULT APDCAM_SetBusyPoll(ADT_HANDLE handle, uint8_t streamNo, int cpu, int busyPollTime, unsigned int spinBudget);
+ADT_RESULT APDCAM_GetBusyPollStats(ADT_HANDLE handle, uint8_t streamNo, ADT_BUSY_POLL_STATS *stats);
+// Receiver stall in ms (default 100) the socket buffers are sized for at APDCAM_ARM, from the data rate of the streams.
+ADT_RESULT APDCAM_SetStallTolerance(ADT_HANDLE handle, unsigned int stallTime);
+// Packets (0..1024, default 32) the decoder of a stream (1..4) waits for a packet arriving out of order before filling its place by 0.
+ADT_RESULT APDCAM_SetReorderWindow(ADT_HANDLE handle, uint8_t streamNo, unsigned int window);
+// User buffer of a stream (1..4): BL_CHANNELS (default) a buffer for each of the 32 channels, BL_INTERLEAVED one ring of the
+// active channels, all values of a sample together (see APDCAM_GetInterleavedBuffers). Takes effect at the next APDCAM_Allocate.
+ADT_RESULT APDCAM_SetBufferLayout(ADT_HANDLE handle, uint8_t streamNo, ADT_BUFFER_LAYOUT layout);
+// Decimation of a stream (1..4): the decoder also writes the averages of factor (2..65536) consecutive samples into a second,
+// per channel ring of sampleCount decimated samples (see APDCAM_GetDecimatedBuffers). factor 0 or 1: off (default).
+// Takes effect at the next APDCAM_Allocate.
+ADT_RESULT APDCAM_SetDecimation(ADT_HANDLE handle, uint8_t streamNo, unsigned int factor, uint64_t sampleCount);
+// Calibration of the 32 channels of a stream (1..4), applied by the decoder when APDCAM_ARM selects CM_CALIBRATED:
+// the buffers get (value - offset) * gain. offsets: ADC counts at the resolution of the stream, NULL: 0. gains: -8..8,
+// negative inverts the signal, NULL: 1. Takes effect at the next APDCAM_ARM.
+ADT_RESULT APDCAM_SetCalibration(ADT_HANDLE handle, uint8_t streamNo, const INT16 *offsets, const double *gains);
+// Socket buffer of a stream (1..4) asked for and granted at the last APDCAM_ARM, and the stall in ms it absorbs.
+ADT_RESULT APDCAM_GetReceiveBuffer(ADT_HANDLE handle, uint8_t streamNo, int *requested, int *achieved, unsigned int *headroom);
+// Receive statistics of a stream (1..4) of the current measurement: losses by place, kernel arrival times.
+ADT_RESULT APDCAM_GetStreamStats(ADT_HANDLE handle, uint8_t streamNo, ADT_STREAM_STATS *stats);
+// Placement of the receiver or decoder thread of a stream (1..4), or of the command client (streamNo is ignored).
+// cpu < 0: any CPU of numaNode (< 0: any), priority 1..99: SCHED_FIFO (needs CAP_SYS_NICE), 0: SCHED_OTHER,
+// name: thread name (max 15 characters), NULL keeps the current one. Running threads are moved at once.
+// The busy poll CPU of APDCAM_SetBusyPoll overrides the receiver CPU.
+ADT_RESULT APDCAM_SetThreadConfig(ADT_HANDLE handle, uint8_t streamNo, ADT_THREAD_ROLE role, int cpu, int numaNode, int priority, const char *name);
 
 ADT_RESULT APDCAM_DataMode(ADT_HANDLE handle, int modeCode);
 ADT_RESULT APDCAM_Filter(ADT_HANDLE handle, FILTER_COEFFICIENTS filterCoefficients);
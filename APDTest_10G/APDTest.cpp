@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 #include <unistd.h>
 
@@ -183,7 +184,7 @@ int Allocate(LONGLONG sampleCount, int bits, uint32_t channelMask_1, uint32_t ch
 	return 0;
 }
 
-int ARM(int measurementMode, int sampleCount, int calibrationMode, int signalFrequency)
+int ARM(int measurementMode, int sampleCount, int calibrationMode, int signalFrequency, int receiveMode)
 {
 	ADT_MEASUREMENT_MODE amm;
 	switch (measurementMode)
@@ -213,9 +214,23 @@ int ARM(int measurementMode, int sampleCount, int calibrationMode, int signalFre
 			break;
 	}
 
+	ADT_RECEIVE_MODE arm;
+	switch (receiveMode)
+	{
+		case 0:
+			arm = RM_POLL;
+			break;
+		case 1:
+			arm = RM_BUSY_POLL;
+			break;
+		default:
+			return -1;
+			break;
+	}
+
 	g_sampleCount = sampleCount;
 
-	if (APDCAM_ARM(g_handle, amm, sampleCount, acm, signalFrequency) == ADT_OK)
+	if (APDCAM_ARM(g_handle, amm, sampleCount, acm, signalFrequency, arm) == ADT_OK)
 		return 0;
 
 	return -1;
@@ -434,6 +449,50 @@ int LoadTriggerInfo(char *fileName, ADT_TRIGGERINFO *trigger, int channelNumber)
 }
 
 
+/*
+ * One line per channel: OFFSET [GAIN], the channels after the last line get offset 0 and gain 1.
+ */
+int LoadCalibration(char *fileName, INT16 *offsets, double *gains, int channelNumber)
+{
+	FILE *calibrationFile;
+	if ((calibrationFile = fopen(fileName, "rt")) == NULL)
+	{
+		fprintf(stderr, "Error, cannot open calibration file %s.\n", fileName);
+		fflush(stderr);
+		return -1;
+	}
+
+	for (int i = 0; i < channelNumber; i++)
+	{
+		offsets[i] = 0;
+		gains[i] = 1.0;
+	}
+
+	int index = 0;
+	while (!feof(calibrationFile) && index < channelNumber)
+	{
+		char buffer[MAX_LINE_LENGTH];
+		ReadLine(calibrationFile, buffer, sizeof(buffer));
+		if (strlen(buffer) == 0) continue;
+
+		int offset = 0;
+		double gain = 1.0;
+		if (sscanf(buffer, "%d %lf", &offset, &gain) < 1 || offset < -32768 || offset > 32767)
+		{
+			fprintf(stderr, "Error, invalid calibration file line %d.\n", index + 1);
+			fflush(stderr);
+			fclose(calibrationFile);
+			return -1;
+		}
+		offsets[index] = offset;
+		gains[index] = gain;
+		index++;
+	}
+	fclose(calibrationFile);
+	return 0;
+}
+
+
 /*
  * READ
  */
@@ -846,6 +905,7 @@ int ProcessLine(char *buffer)
 		int sampleCount;
 		int calibrationMode;
 		int signalFrequency = 100;
+		int receiveMode = 0;
 
 		if (g_handle == 0) 
 		{
@@ -857,9 +917,10 @@ int ProcessLine(char *buffer)
 		buffer = GetInt(buffer, &measurementMode);
 		buffer = GetInt(buffer, &sampleCount);
 		buffer = GetInt(buffer, &calibrationMode);
-		GetInt(buffer, &signalFrequency);
+		buffer = GetInt(buffer, &signalFrequency);
+		GetInt(buffer, &receiveMode);
 
-		int res = ARM(measurementMode, sampleCount, calibrationMode, signalFrequency);
+		int res = ARM(measurementMode, sampleCount, calibrationMode, signalFrequency, receiveMode);
 		if (res == 0)
 		{
 			printf("Arm succes\n");
@@ -1318,6 +1379,558 @@ int ProcessLine(char *buffer)
 			fflush(stderr);
 		}	
 	}
+	else if (strcmp("RECEIVE-BATCH", token) == 0)
+	{
+		// RECEIVE-BATCH PACKETS
+		int batchSize = 1;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &batchSize);
+
+		if (APDCAM_SetReceiveBatch(g_handle, batchSize) == ADT_OK)
+		{
+			printf("Receive batch set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set receive batch!\n");
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("RECEIVE-GRO", token) == 0)
+	{
+		// RECEIVE-GRO ON|OFF
+		char modeName[512];
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetString(buffer, modeName);
+
+		ADT_RESULT result = ADT_PARAMETER_ERROR;
+		if (strcasecmp(modeName, "ON") == 0)
+			result = APDCAM_SetReceiveGro(g_handle, true);
+		else if (strcasecmp(modeName, "OFF") == 0)
+			result = APDCAM_SetReceiveGro(g_handle, false);
+
+		if (result == ADT_OK)
+		{
+			printf("Receive GRO set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set receive GRO %s!\n", modeName);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("SIGNAL-LATENCY", token) == 0)
+	{
+		// SIGNAL-LATENCY MICROSECONDS (0: off)
+		int latency = 0;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &latency);
+
+		if (latency >= 0 && APDCAM_SetSignalLatency(g_handle, latency) == ADT_OK)
+		{
+			printf("Signal latency set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set signal latency!\n");
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("RECEIVE-BACKEND", token) == 0)
+	{
+		// RECEIVE-BACKEND SOCKET|RING|XDP, applies to the cameras opened afterwards
+		char backendName[512];
+		buffer = GetString(buffer, backendName);
+
+		ADT_RESULT result = ADT_PARAMETER_ERROR;
+		if (strcasecmp(backendName, "SOCKET") == 0)
+			result = APDCAM_SetReceiveBackend(RB_SOCKET);
+		else if (strcasecmp(backendName, "RING") == 0)
+			result = APDCAM_SetReceiveBackend(RB_PACKET_RING);
+		else if (strcasecmp(backendName, "XDP") == 0)
+			result = APDCAM_SetReceiveBackend(RB_XDP);
+
+		if (result == ADT_OK)
+		{
+			printf("Receive backend set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set receive backend %s!\n", backendName);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("REACTOR", token) == 0)
+	{
+		// REACTOR ON|OFF [THREADS], THREADS 0: one per CPU
+		char modeName[512];
+		int threads = 0;
+		buffer = GetString(buffer, modeName);
+		buffer = GetInt(buffer, &threads);
+
+		ADT_RESULT result = ADT_PARAMETER_ERROR;
+		if (threads >= 0)
+		{
+			if (strcasecmp(modeName, "ON") == 0)
+				result = APDCAM_SetReactorMode(true, threads);
+			else if (strcasecmp(modeName, "OFF") == 0)
+				result = APDCAM_SetReactorMode(false, threads);
+		}
+
+		if (result == ADT_OK)
+		{
+			printf("Reactor mode set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set reactor mode %s!\n", modeName);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("DECODE-THREADS", token) == 0)
+	{
+		// DECODE-THREADS THREADS, 0: each stream decoded by its own decoder alone
+		int threads = -1;
+		buffer = GetInt(buffer, &threads);
+
+		ADT_RESULT result = ADT_PARAMETER_ERROR;
+		if (threads >= 0)
+			result = APDCAM_SetDecodeThreads(threads);
+
+		if (result == ADT_OK)
+		{
+			printf("Decode threads set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set %d decode threads!\n", threads);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("STREAM-QUEUE", token) == 0)
+	{
+		// STREAM-QUEUE STREAM QUEUE
+		int streamNo = 0;
+		int queue = 0;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+		buffer = GetInt(buffer, &queue);
+
+		if (queue >= 0 && APDCAM_SetStreamQueue(g_handle, streamNo, queue) == ADT_OK)
+		{
+			printf("Stream queue set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set stream queue!\n");
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("BUSY-POLL", token) == 0)
+	{
+		// BUSY-POLL STREAM CPU BUSY_POLL_US SPIN_BUDGET, used by ARM ... 1
+		int streamNo = 0;
+		int cpu = -1;
+		int busyPollTime = 50;
+		int spinBudget = 10000;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+		buffer = GetInt(buffer, &cpu);
+		buffer = GetInt(buffer, &busyPollTime);
+		buffer = GetInt(buffer, &spinBudget);
+
+		if (spinBudget > 0 && APDCAM_SetBusyPoll(g_handle, streamNo, cpu, busyPollTime, spinBudget) == ADT_OK)
+		{
+			printf("Busy poll set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set busy poll!\n");
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("BUSY-POLL-STATS", token) == 0)
+	{
+		// BUSY-POLL-STATS STREAM
+		int streamNo = 0;
+		ADT_BUSY_POLL_STATS stats;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+
+		if (APDCAM_GetBusyPollStats(g_handle, streamNo, &stats) == ADT_OK)
+		{
+			printf("Busy poll stream %d: hits %" PRIu64 " spins %" PRIu64 " sleeps %" PRIu64 "\n", streamNo, stats.hits, stats.spins, stats.sleeps);
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot get busy poll statistics!\n");
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("STREAM-DESTINATION", token) == 0)
+	{
+		// STREAM-DESTINATION STREAM MULTICAST|UNICAST [IP|- [MAC|- [IFNAME]]]
+		int streamNo = 0;
+		char transport[64];
+		char ip[64];
+		char mac[64];
+		char ifname[64];
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+		buffer = GetString(buffer, transport);
+		buffer = GetString(buffer, ip);
+		buffer = GetString(buffer, mac);
+		buffer = GetString(buffer, ifname);
+
+		bool valid = true;
+		ADT_STREAM_TRANSPORT streamTransport = STT_MULTICAST;
+		if (strcmp("UNICAST", transport) == 0)
+			streamTransport = STT_UNICAST;
+		else if (strcmp("MULTICAST", transport) != 0)
+			valid = false;
+
+		uint32_t ip_h = 0;
+		if (ip[0] != '\0' && strcmp("-", ip) != 0)
+		{
+			struct in_addr addr;
+			if (inet_aton(ip, &addr))
+				ip_h = ntohl(addr.s_addr);
+			else
+				valid = false;
+		}
+
+		uint8_t macAddr[6];
+		bool macGiven = false;
+		if (mac[0] != '\0' && strcmp("-", mac) != 0)
+		{
+			unsigned int m[6];
+			macGiven = sscanf(mac, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) == 6;
+			for (int i = 0; macGiven && i < 6; ++i)
+				macAddr[i] = m[i];
+			valid = valid && macGiven;
+		}
+
+		if (valid && APDCAM_SetStreamDestination(g_handle, streamNo, streamTransport, ip_h, macGiven ? macAddr : NULL, ifname) == ADT_OK)
+		{
+			printf("Stream destination set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set the destination of stream %d!\n", streamNo);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("REORDER-WINDOW", token) == 0)
+	{
+		// REORDER-WINDOW STREAM PACKETS
+		int streamNo = 0;
+		int window = -1;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+		buffer = GetInt(buffer, &window);
+
+		if (window >= 0 && APDCAM_SetReorderWindow(g_handle, streamNo, window) == ADT_OK)
+		{
+			printf("Reorder window set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set reorder window %d for stream %d!\n", window, streamNo);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("BUFFER-LAYOUT", token) == 0)
+	{
+		// BUFFER-LAYOUT STREAM CHANNELS|INTERLEAVED, before ALLOCATE
+		int streamNo = 0;
+		char layoutName[512];
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+		buffer = GetString(buffer, layoutName);
+
+		ADT_RESULT result = ADT_PARAMETER_ERROR;
+		if (strcasecmp(layoutName, "CHANNELS") == 0)
+			result = APDCAM_SetBufferLayout(g_handle, streamNo, BL_CHANNELS);
+		else if (strcasecmp(layoutName, "INTERLEAVED") == 0)
+			result = APDCAM_SetBufferLayout(g_handle, streamNo, BL_INTERLEAVED);
+
+		if (result == ADT_OK)
+		{
+			printf("Buffer layout set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set buffer layout %s for stream %d!\n", layoutName, streamNo);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("DECIMATION", token) == 0)
+	{
+		// DECIMATION STREAM FACTOR [SAMPLES], before ALLOCATE. FACTOR 0: off
+		int streamNo = 0;
+		int factor = -1;
+		int sampleCount = 0;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+		buffer = GetInt(buffer, &factor);
+		buffer = GetInt(buffer, &sampleCount);
+
+		if (factor >= 0 && sampleCount >= 0 && APDCAM_SetDecimation(g_handle, streamNo, factor, sampleCount) == ADT_OK)
+		{
+			printf("Decimation set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set decimation %d for stream %d!\n", factor, streamNo);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("STREAM-CALIBRATION", token) == 0)
+	{
+		// STREAM-CALIBRATION STREAM FILE|-
+		int streamNo = 0;
+		char fileName[MAX_LINE_LENGTH];
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+		buffer = GetString(buffer, fileName);
+
+		INT16 offsets[32];
+		double gains[32];
+		bool reset = fileName[0] == '\0' || strcmp("-", fileName) == 0;
+		if (!reset && LoadCalibration(fileName, offsets, gains, 32) != 0)
+			return -1;
+
+		if (APDCAM_SetCalibration(g_handle, streamNo, reset ? NULL : offsets, reset ? NULL : gains) == ADT_OK)
+		{
+			printf("Calibration set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set the calibration of stream %d!\n", streamNo);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("STALL-TOLERANCE", token) == 0)
+	{
+		// STALL-TOLERANCE MS
+		int stallTime = 0;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &stallTime);
+
+		if (stallTime > 0 && APDCAM_SetStallTolerance(g_handle, stallTime) == ADT_OK)
+		{
+			printf("Stall tolerance set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot set stall tolerance %d!\n", stallTime);
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("RECEIVE-BUFFER", token) == 0)
+	{
+		// RECEIVE-BUFFER STREAM
+		int streamNo = 0;
+		int requested = 0;
+		int achieved = 0;
+		unsigned int headroom = 0;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+
+		if (APDCAM_GetReceiveBuffer(g_handle, streamNo, &requested, &achieved, &headroom) == ADT_OK)
+		{
+			printf("Stream %d: receive buffer %d bytes (requested %d), stall headroom %u ms\n", streamNo, achieved, requested, headroom);
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot get receive buffer!\n");
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("STREAM-STATS", token) == 0)
+	{
+		// STREAM-STATS STREAM
+		int streamNo = 0;
+		ADT_STREAM_STATS stats;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetInt(buffer, &streamNo);
+
+		if (APDCAM_GetStreamStats(g_handle, streamNo, &stats) == ADT_OK)
+		{
+			printf("Stream %d: packets %" PRIu64 " lost %" PRIu64 " late %" PRIu64 " socket drops %" PRIu64 " decoder overruns %" PRIu64 " max backlog %" PRIu64 "\n",
+				streamNo, stats.packets, stats.lostPackets, stats.latePackets, stats.socketDrops, stats.decoderOverruns, stats.maxBacklog);
+			printf("Stream %d: inter-arrival min %" PRIu64 " mean %" PRIu64 " max %" PRIu64 " jitter %" PRIu64 " ns\n",
+				streamNo, stats.minGap, stats.meanGap, stats.maxGap, stats.jitter);
+			if (stats.dumpDrops)
+				printf("Stream %d: %" PRIu64 " packets left out of the dump\n", streamNo, stats.dumpDrops);
+			if (stats.continuityError)
+				printf("Stream %d: decoding stopped on a continuity error\n", streamNo);
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot get stream statistics!\n");
+			fflush(stderr);
+		}	
+	}
+	else if (strcmp("THREAD-CONFIG", token) == 0)
+	{
+		// THREAD-CONFIG RECEIVER|DECODER|COMMAND STREAM CPU NODE PRIO [NAME], CPU/NODE -1: any, PRIO 0: not real-time
+		char roleName[512];
+		char threadName[512];
+		int streamNo = 0;
+		int cpu = -1;
+		int numaNode = -1;
+		int priority = 0;
+
+		if (g_handle == 0) 
+		{
+			fprintf(stderr, "Error, camera not open.\n");
+			fflush(stderr);
+			return -1;
+		}	
+
+		buffer = GetString(buffer, roleName);
+		buffer = GetInt(buffer, &streamNo);
+		buffer = GetInt(buffer, &cpu);
+		buffer = GetInt(buffer, &numaNode);
+		buffer = GetInt(buffer, &priority);
+		buffer = GetString(buffer, threadName);
+
+		ADT_RESULT result = ADT_PARAMETER_ERROR;
+		const char *name = threadName[0] ? threadName : NULL;
+		if (strcasecmp(roleName, "RECEIVER") == 0)
+			result = APDCAM_SetThreadConfig(g_handle, streamNo, THR_RECEIVER, cpu, numaNode, priority, name);
+		else if (strcasecmp(roleName, "DECODER") == 0)
+			result = APDCAM_SetThreadConfig(g_handle, streamNo, THR_DECODER, cpu, numaNode, priority, name);
+		else if (strcasecmp(roleName, "COMMAND") == 0)
+			result = APDCAM_SetThreadConfig(g_handle, streamNo, THR_COMMAND, cpu, numaNode, priority, name);
+
+		if (result == ADT_OK)
+		{
+			printf("Thread configuration set.\n");
+			fflush(stdout);
+		}
+		else
+		{
+			fprintf(stderr, "Error, cannot configure %s thread!\n", roleName);
+			fflush(stderr);
+		}	
+	}
 	else
 	{
 		fprintf(stderr, "WARNING: Unknown command:\n|%s|\n", token);
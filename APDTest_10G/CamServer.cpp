@@ -1,72 +1,494 @@
 #include <stdio.h>
+#include <netinet/udp.h>
 #include "CamServer.h"
 
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
 
-void CCamServer::OnRead()
+
+int CCamServer::OnRead()
 {
-	unsigned char *pBuffer = m_pBuffer + ((m_PacketCounter % m_MaxPacketNo) * m_PacketSize);
+	if (IsGroActive())
+		return OnReadGro();
+
+	if (m_BatchSize > 1)
+		return OnReadBatch();
+
+	if (GetFreeSlots() == 0)
+		return DiscardPacket();
 
-	int bytes_received = ReadData(pBuffer, m_PacketSize, NULL, NULL);
+	unsigned char *pBuffer = m_pBuffer + ((m_PacketCounter.Load() % m_MaxPacketNo) * m_PacketSize);
+
+	struct msghdr *message = &m_Messages[0].msg_hdr;
+	m_Vectors[0].iov_base = pBuffer;
+	m_Vectors[0].iov_len = m_PacketSize;
+	memset(message, 0, sizeof(*message));
+	message->msg_iov = &m_Vectors[0];
+	message->msg_iovlen = 1;
+	message->msg_control = &m_Controls[0];
+	message->msg_controllen = sizeof(m_Controls[0]);
+
+	int bytes_received = ReadMessage(message);
 
 	if (bytes_received <= 0)
 	{
-		fprintf(stderr, "ERROR: %s\n", strerror(m_ErrorCode));
-		return;
+		if (m_ErrorCode != EAGAIN && m_ErrorCode != EWOULDBLOCK)
+			fprintf(stderr, "ERROR: %s\n", strerror(m_ErrorCode));
+		return 0;
 	}
 
-	if (m_DumpFile)
-		fwrite(pBuffer, 1, bytes_received, m_DumpFile);
+	unsigned int packetCounter = m_PacketCounter.Load();
+	uint64_t dataReceived = m_DataReceived;
+	uint64_t userData = m_UserData;
+
+	bool signal = CountPacket(pBuffer, bytes_received, packetCounter, dataReceived, userData);
+	if (packetCounter != m_PacketCounter.Load())
+		RecordArrival(message, m_PacketCounter.Load());
+
+	m_DataReceived = dataReceived;
+	m_UserData = userData;
+	m_Overrun = false;
+	m_PacketCounter.Publish(packetCounter);
+
+	SignalData(packetCounter, signal);
+
+	return 1;
+}
+
+
+/*
+ * Drains up to m_BatchSize datagrams with a single recvmmsg() straight into consecutive slots
+ * of the primary buffer. The counters are published once per batch and the data processor is
+ * signaled at most once per batch.
+ */
+int CCamServer::OnReadBatch()
+{
+	unsigned int freeSlots = GetFreeSlots();
+	if (freeSlots == 0)
+		return DiscardPacket();
+
+	unsigned int slot = m_PacketCounter.Load() % m_MaxPacketNo;
+	/*
+	 * Never let a batch wrap around the end of the primary buffer or into unreleased packets
+	 */
+	unsigned int vlen = std::min(std::min(m_BatchSize, m_MaxPacketNo - slot), freeSlots);
 
-	CC_STREAMHEADER *header = reinterpret_cast<CC_STREAMHEADER*>(pBuffer);
-	if (header->serial != m_StreamSerial)
+	for (unsigned int i = 0; i < vlen; ++i)
+	{
+		m_Vectors[i].iov_base = m_pBuffer + (slot + i) * m_PacketSize;
+		m_Vectors[i].iov_len = m_PacketSize;
+
+		memset(&m_Messages[i], 0, sizeof(m_Messages[i]));
+		m_Messages[i].msg_hdr.msg_iov = &m_Vectors[i];
+		m_Messages[i].msg_hdr.msg_iovlen = 1;
+		m_Messages[i].msg_hdr.msg_control = &m_Controls[i];
+		m_Messages[i].msg_hdr.msg_controllen = sizeof(m_Controls[i]);
+	}
+
+	int messages = ReadBatch(m_Messages, vlen);
+	if (messages <= 0)
+	{
+		if (m_ErrorCode != EAGAIN && m_ErrorCode != EWOULDBLOCK)
+			fprintf(stderr, "ERROR: %s\n", strerror(m_ErrorCode));
+		return 0;
+	}
+
+	unsigned int packetCounter = m_PacketCounter.Load();
+	uint64_t dataReceived = m_DataReceived;
+	uint64_t userData = m_UserData;
+	bool signal = false;
+
+	for (int i = 0; i < messages; ++i)
+	{
+		unsigned char *pBuffer = m_pBuffer + ((packetCounter % m_MaxPacketNo) * m_PacketSize);
+		int bytes_received = m_Messages[i].msg_len;
+
+		/*
+		 * A rejected packet earlier in this batch left its slot free, close the gap
+		 */
+		if (m_Vectors[i].iov_base != pBuffer)
+			memmove(pBuffer, m_Vectors[i].iov_base, bytes_received);
+
+		unsigned int packetNo = packetCounter;
+		if (CountPacket(pBuffer, bytes_received, packetCounter, dataReceived, userData))
+			signal = true;
+		if (packetCounter != packetNo)
+			RecordArrival(&m_Messages[i].msg_hdr, packetNo);
+	}
+
+	m_DataReceived = dataReceived;
+	m_UserData = userData;
+	m_Overrun = false;
+	m_PacketCounter.Publish(packetCounter);
+
+	SignalData(packetCounter, signal);
+
+	return messages;
+}
+
+
+/*
+ * Checks and accounts one received stream packet, shared by the stream servers.
+ * type: 0: one-shot, 1: cyclic. signalFrequency: a signal is due every this many packets, 0: never by the count.
+ * Returns true if the data processor must be signaled.
+ */
+bool CountStreamPacket(const unsigned char *pBuffer, int bytes_received, uint32_t streamSerial, int type, uint64_t requestedData,
+	unsigned int signalFrequency, unsigned int &packetCounter, uint64_t &dataReceived, uint64_t &userData)
+{
+	const CC_STREAMHEADER *header = reinterpret_cast<const CC_STREAMHEADER*>(pBuffer);
+	if (header->serial != streamSerial)
 	{
 		fprintf(stderr, "Serial error 0x%X\n", header->serial);
-		return;
+		return false;
 	}
 	if (header->S1.UDP_Test_Mode)
 	{
-		++m_PacketCounter;
-		return;
+		++packetCounter;
+		return false;
 	}
 
-	if (m_type == 0)
+	if (type == 0)
 	{ // one-shot mode
-		m_DataReceived += bytes_received;
-		if (m_UserData < m_RequestedData)
+		dataReceived += bytes_received;
+		if (userData < requestedData)
 		{
-			++m_PacketCounter;
-			m_UserData += bytes_received - sizeof(CC_STREAMHEADER);
-
-			if (m_SignalEvent)
-			{
-				if (m_UserData >= m_RequestedData || (m_PacketCounter % m_SignalFrequency) == 0)
-				{
-					m_SignalEvent->Set();
-				}
-			}
+			++packetCounter;
+			userData += bytes_received - sizeof(CC_STREAMHEADER);
+
+			return userData >= requestedData || (signalFrequency && (packetCounter % signalFrequency) == 0);
 		}
+		return false;
 	}
-	else
-	{ // cyclic mode
-		m_PacketCounter++;
-		m_DataReceived += bytes_received;
-		m_UserData  += bytes_received - sizeof(CC_STREAMHEADER);
 
-		if (/*(m_PacketCounter > 0) && -- never zero here*/((m_PacketCounter % m_SignalFrequency) == 0) && (m_SignalEvent != NULL)) 
-			m_SignalEvent->Set();
+	// cyclic mode
+	packetCounter++;
+	dataReceived += bytes_received;
+	userData += bytes_received - sizeof(CC_STREAMHEADER);
+
+	return signalFrequency && (packetCounter % signalFrequency) == 0;
+}
+
+
+/*
+ * Checks and accounts one received packet, which is already in its slot of the primary buffer.
+ * The counters are passed in so that a batch can be published at once.
+ * Returns true if the data processor must be signaled.
+ */
+bool CCamServer::CountPacket(const unsigned char *pBuffer, int bytes_received, unsigned int &packetCounter, uint64_t &dataReceived, uint64_t &userData)
+{
+	if (m_DumpWriter)
+		m_DumpWriter->Write(pBuffer, bytes_received);
+
+	// In latency mode the signal is timed, see SignalData()
+	return CountStreamPacket(pBuffer, bytes_received, m_StreamSerial, m_type, m_RequestedData, m_SignalLatency ? 0 : m_SignalFrequency,
+		packetCounter, dataReceived, userData);
+}
+
+
+/*
+ * Called after publishing the packets before packetCounter. signal: CountPacket() asked for a signal.
+ */
+void CCamServer::SignalData(unsigned int packetCounter, bool signal)
+{
+	if (signal == false && m_SignalLatency)
+		signal = CheckLatency(packetCounter, MonotonicTime());
+
+	if (signal == false)
+		return;
+
+	m_SignaledPackets = packetCounter;
+	m_PendingSince = 0;
+	if (m_SignalEvent)
+		m_SignalEvent->Set();
+}
+
+
+/*
+ * Latency mode. The count is the packets arriving in one latency period at the smoothed packet interval: a high
+ * rate still hands the packets over in large batches, the timer bounds the delay at a low rate. Arms the timer
+ * for the oldest pending packet if no signal is due yet.
+ */
+bool CCamServer::CheckLatency(unsigned int packetCounter, uint64_t now)
+{
+	unsigned int pending = packetCounter - m_SignaledPackets;
+	if (pending == 0)
+		return false;
+
+	unsigned int published = packetCounter - m_LastPublished;
+	if (published > 0)
+	{
+		if (m_LastPublish)
+		{
+			// Smoothed like the jitter: I += (interval - I) / 8, starting from the first interval
+			int64_t interval = (int64_t)(now - m_LastPublish) / published;
+			m_PacketInterval = m_PacketInterval ? m_PacketInterval + (interval - m_PacketInterval) / 8 : interval;
+		}
+
+		m_LastPublish = now;
+		m_LastPublished = packetCounter;
 	}
+
+	if (m_PendingSince == 0)
+		m_PendingSince = now;
+
+	uint64_t count = m_SignalFrequency;
+	if (m_PacketInterval > 0)
+		count = std::min(count, std::max((uint64_t)1, m_SignalLatency / (uint64_t)m_PacketInterval));
+
+	if (pending >= count || now - m_PendingSince >= m_SignalLatency)
+		return true;
+
+	ArmTimer(m_PendingSince + m_SignalLatency);
+	return false;
+}
+
+
+
+/*
+ * Receives one datagram coalesced by UDP_GRO straight into consecutive slots of the primary buffer (wrapping
+ * around its end) and splits it into stream packets at the segment size reported by the kernel. The segments
+ * are packetsize long, so every segment lands in its own slot. The data processor is signaled at most once.
+ * The segments not fitting in the free slots are dropped.
+ */
+int CCamServer::OnReadGro()
+{
+	unsigned int freeSlots = GetFreeSlots();
+	if (freeSlots == 0)
+		return DiscardPacket();
+
+	unsigned int slot = m_PacketCounter.Load() % m_MaxPacketNo;
+	unsigned int slots = std::min(freeSlots, (unsigned int)((GRO_MAX_SIZE + m_PacketSize - 1) / m_PacketSize));
+	unsigned int tail = std::min(slots, m_MaxPacketNo - slot);
+
+	m_Vectors[0].iov_base = m_pBuffer + slot * m_PacketSize;
+	m_Vectors[0].iov_len = tail * m_PacketSize;
+	m_Vectors[1].iov_base = m_pBuffer;
+	m_Vectors[1].iov_len = (slots - tail) * m_PacketSize;
+
+	struct msghdr *message = &m_Messages[0].msg_hdr;
+	memset(message, 0, sizeof(*message));
+	message->msg_iov = m_Vectors;
+	message->msg_iovlen = (slots > tail) ? 2 : 1;
+	message->msg_control = &m_Controls[0];
+	message->msg_controllen = sizeof(m_Controls[0]);
+
+	// MSG_TRUNC: the length of the whole datagram, even if it did not fit
+	int bytes_received = ReadMessage(message, MSG_TRUNC);
+
+	if (bytes_received <= 0)
+	{
+		if (m_ErrorCode != EAGAIN && m_ErrorCode != EWOULDBLOCK)
+			fprintf(stderr, "ERROR: %s\n", strerror(m_ErrorCode));
+		return 0;
+	}
+
+	int capacity = slots * m_PacketSize;
+	bool truncated = bytes_received > capacity;
+	if (truncated)
+	{
+		NoteOverrun((bytes_received - capacity + m_PacketSize - 1) / m_PacketSize);
+		bytes_received = capacity;
+	}
+
+	// No UDP_GRO control message: a single datagram
+	int segmentSize = bytes_received;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(message); cmsg != NULL; cmsg = CMSG_NXTHDR(message, cmsg))
+	{
+		if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO)
+			memcpy(&segmentSize, CMSG_DATA(cmsg), sizeof(segmentSize));
+	}
+
+	if (segmentSize <= 0 || (segmentSize != m_PacketSize && segmentSize < bytes_received))
+	{
+		fprintf(stderr, "Coalesced datagram dropped, segment size %d instead of %d\n", segmentSize, m_PacketSize);
+		return 1;
+	}
+
+	unsigned int packetCounter = m_PacketCounter.Load();
+	uint64_t dataReceived = m_DataReceived;
+	uint64_t userData = m_UserData;
+	bool signal = false;
+
+	int segments = (bytes_received + segmentSize - 1) / segmentSize;
+	for (int i = 0; i < segments; ++i)
+	{
+		unsigned char *pSegment = m_pBuffer + ((slot + i) % m_MaxPacketNo) * m_PacketSize;
+		unsigned char *pBuffer = m_pBuffer + ((packetCounter % m_MaxPacketNo) * m_PacketSize);
+		int length = std::min(segmentSize, bytes_received - i * segmentSize);
+
+		/*
+		 * A rejected segment earlier in this datagram left its slot free, close the gap
+		 */
+		if (pSegment != pBuffer)
+			memmove(pBuffer, pSegment, length);
+
+		if (CountPacket(pBuffer, length, packetCounter, dataReceived, userData))
+			signal = true;
+	}
+
+	if (packetCounter != m_PacketCounter.Load())
+		RecordArrival(message, m_PacketCounter.Load(), packetCounter - m_PacketCounter.Load());
+
+	m_DataReceived = dataReceived;
+	m_UserData = userData;
+	if (!truncated)
+		m_Overrun = false;
+	m_PacketCounter.Publish(packetCounter);
+
+	SignalData(packetCounter, signal);
+
+	return segments;
+}
+
+
+unsigned int CCamServer::GetFreeSlots() const
+{
+	return m_MaxPacketNo - (m_PacketCounter.Load() - __atomic_load_n(&m_ReleasedPackets, __ATOMIC_ACQUIRE));
+}
+
+
+/*
+ * The primary buffer is full of packets the data processor has not released yet. The next datagram is dropped
+ * instead of overwriting an unread packet, the data processor finds the gap in the packet counters.
+ */
+int CCamServer::DiscardPacket()
+{
+	unsigned char byte;
+	struct iovec vector;
+	vector.iov_base = &byte;
+	vector.iov_len = sizeof(byte);
+
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &vector;
+	message.msg_iovlen = 1;
+
+	int bytes_received = ReadMessage(&message, MSG_TRUNC);
+	if (bytes_received <= 0)
+	{
+		if (m_ErrorCode != EAGAIN && m_ErrorCode != EWOULDBLOCK)
+			fprintf(stderr, "ERROR: %s\n", strerror(m_ErrorCode));
+		return 0;
+	}
+
+	// A coalesced datagram holds several packets
+	NoteOverrun(std::max(1, bytes_received / m_PacketSize));
+
+	return 1;
+}
+
+
+void CCamServer::NoteOverrun(uint64_t packets)
+{
+	m_Overruns += packets;
+
+	if (!m_Overrun)
+	{
+		m_Overrun = true;
+		fprintf(stderr, "Warning, primary buffer full, dropping packets until the data processor catches up (%" PRIu64 " dropped so far)\n", m_Overruns);
+	}
+}
+
+
+/*
+ * Takes the kernel arrival time and the socket drop count from the control messages of accepted packets
+ * received together and updates the inter-arrival statistics.
+ */
+void CCamServer::RecordArrival(const struct msghdr *message, unsigned int packetNo, unsigned int packets)
+{
+	uint64_t arrival = 0;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(message); cmsg != NULL; cmsg = CMSG_NXTHDR(const_cast<struct msghdr*>(message), cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			arrival = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		}
+		else if (cmsg->cmsg_type == SO_RXQ_OVFL)
+		{
+			uint32_t drops;
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+			m_SocketDrops = drops;
+		}
+	}
+
+	if (m_ArrivalTimes)
+	{
+		for (unsigned int i = 0; i < packets; ++i)
+			m_ArrivalTimes[(packetNo + i) % m_MaxPacketNo] = arrival;
+	}
+
+	if (arrival == 0)
+		return;
+
+	if (m_LastArrival && arrival >= m_LastArrival)
+	{
+		uint64_t gap = arrival - m_LastArrival;
+		if (m_GapCount == 0 || gap < m_MinGap)
+			m_MinGap = gap;
+		m_MaxGap = std::max(m_MaxGap, gap);
+		m_GapSum += gap;
+
+		// RFC 3550: J += (|D| - J) / 16, D is the change of the inter-arrival time
+		if (m_GapCount)
+		{
+			int64_t d = (int64_t)gap - (int64_t)m_LastGap;
+			m_Jitter += ((d < 0 ? -d : d) - m_Jitter) / 16;
+		}
+
+		m_LastGap = gap;
+		++m_GapCount;
+	}
+	m_LastArrival = arrival;
+}
+
+
+void CCamServer::UpdateArrivalTimes()
+{
+	if (m_ArrivalSize == m_MaxPacketNo)
+		return;
+
+	delete[] m_ArrivalTimes;
+	m_ArrivalTimes = (m_MaxPacketNo > 0) ? new uint64_t[m_MaxPacketNo]() : NULL;
+	m_ArrivalSize = m_MaxPacketNo;
+}
+
+
+void CCamServer::GetStreamStats(ADT_STREAM_STATS *stats) const
+{
+	stats->packets = GetPacketNo();
+	stats->decoderOverruns = m_Overruns;
+	stats->socketDrops = m_SocketDrops;
+	stats->lastArrival = m_LastArrival;
+	stats->minGap = m_MinGap;
+	stats->maxGap = m_MaxGap;
+	stats->meanGap = m_GapCount ? m_GapSum / m_GapCount : 0;
+	stats->jitter = m_Jitter;
+	stats->dumpDrops = GetDumpDrops();
 }
 
 
 int CCamServer::GetRcvBufferSize() const
 {
-	return 64 * 1024 * 1024;
+	return m_RcvBufferSize;
+}
+
+
+uint64_t CCamServer::GetDataRate() const
+{
+	return m_DataRate;
 }
 
 
 uint32_t CCamServer::GetMulticastAddr() const
 {
-	return inet_addr("239.123.13.100");
+	return m_MulticastAddr;
 }
 
 
@@ -76,13 +498,30 @@ const char* CCamServer::GetInterfacename() const
 }
 
 
+bool CCamServer::NeedsTimer() const
+{
+	return m_SignalLatency > 0;
+}
+
+
+void CCamServer::OnTimer()
+{
+	unsigned int packetCounter = m_PacketCounter.Load();
+	if (packetCounter == m_SignaledPackets)
+		return;
+
+	if (MonotonicTime() - m_PendingSince >= m_SignalLatency)
+		SignalData(packetCounter, true);
+	else
+		ArmTimer(m_PendingSince + m_SignalLatency);
+}
+
+
 void CCamServer::OnStop()
 {
-	if (m_DumpFile)
-	{
-		fclose(m_DumpFile);
-		m_DumpFile = NULL;
-	}
+	// Writes out the rest of the dump, the drop count stays until the next dump
+	if (m_DumpWriter)
+		m_DumpWriter->Close();
 
 	if (m_SignalEvent)
 		m_SignalEvent->Set();
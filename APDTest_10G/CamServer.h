@@ -3,10 +3,30 @@
 
 #define __CAMSERVER_H__
 
+#include <time.h>
 #include <net/if.h>
+#include <sys/socket.h>
 
 #include "InterfaceDefs.h"
 #include "UDPServer.h"
+#include "DumpWriter.h"
+
+#define MAX_RECV_BATCH 64 // Maximum number of datagrams drained by one recvmmsg() call
+#define DEF_RCVBUF_SIZE (64 * 1024 * 1024) // SO_RCVBUF if the data rate is not known
+#define GRO_MAX_SIZE 65536 // Largest datagram UDP_GRO delivers
+
+/*
+ * Control messages of a received datagram: SCM_TIMESTAMPNS, SO_RXQ_OVFL and the segment size of UDP_GRO
+ */
+union RECV_CONTROL
+{
+	struct cmsghdr align;
+	unsigned char  data[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(int))];
+};
+
+// Packet accounting of the stream servers, see CamServer.cpp
+bool CountStreamPacket(const unsigned char *pBuffer, int bytes_received, uint32_t streamSerial, int type, uint64_t requestedData,
+	unsigned int signalFrequency, unsigned int &packetCounter, uint64_t &dataReceived, uint64_t &userData);
 
 class CCamServer : public CUDPServer
 {
@@ -21,19 +41,47 @@ public:
 		m_DataReceived(0),
 		m_UserData(0),
 		m_MaxPacketNo(0),
-		m_PacketCounter(0),
 		m_SignalFrequency(1),
-		m_DumpFile(NULL),
+		m_SignalLatency(0),
+		m_SignaledPackets(0),
+		m_PendingSince(0),
+		m_LastPublish(0),
+		m_LastPublished(0),
+		m_PacketInterval(0),
+		m_BatchSize(1),
+		m_RcvBufferSize(DEF_RCVBUF_SIZE),
+		m_DataRate(0),
+		m_Messages(),
+		m_Vectors(),
+		m_Controls(),
+		m_ArrivalTimes(NULL),
+		m_ArrivalSize(0),
+		m_SocketDrops(0),
+		m_LastArrival(0),
+		m_LastGap(0),
+		m_MinGap(0),
+		m_MaxGap(0),
+		m_GapSum(0),
+		m_GapCount(0),
+		m_Jitter(0),
+		m_Overruns(0),
+		m_Overrun(false),
+		m_DumpWriter(NULL),
 		m_StreamSerial(0),
-		m_MulticastAddr(0),
-		m_Interfacename()
+		m_MulticastAddr(inet_addr(DEF_MULTICAST_GROUP)),
+		m_Interfacename(),
+		m_CursorPad0(),
+		m_PacketCounter(),
+		m_CursorPad1(),
+		m_ReleasedPackets(0),
+		m_CursorPad2()
 	{
 	};
 
 	~CCamServer()
 	{
-		if (m_DumpFile)
-			fclose(m_DumpFile);
+		delete m_DumpWriter;
+		delete[] m_ArrivalTimes;
 	};
 
 	void SetBuffer(uint8_t *buffer, uint64_t length)
@@ -41,12 +89,14 @@ public:
 		m_pBuffer = buffer;
 		m_Length = length;
 		m_MaxPacketNo = (m_PacketSize > 0) ? (unsigned int)(m_Length / m_PacketSize): 0;
+		UpdateArrivalTimes();
 	};
 
 	void SetPacketSize(int packetSize)
 	{
 		m_PacketSize = packetSize;
 		m_MaxPacketNo = (m_PacketSize > 0) ? (unsigned int)(m_Length / m_PacketSize): 0;
+		UpdateArrivalTimes();
 	};
 
 	void SetStreamSerial(uint32_t serial)
@@ -68,11 +118,50 @@ public:
 		}
 	};
 
+	/*
+	 * Latency mode (latency > 0, us): the data processor is signaled when the packets not signaled yet reach the
+	 * number arriving in one latency period at the current rate (at most the signal frequency), or when the
+	 * oldest of them waited latency us, whichever comes first.
+	 */
+	void SetSignalLatency(unsigned int latency)
+	{
+		m_SignalLatency = latency * 1000ULL;
+	};
+
+	// Number of datagrams to receive per wakeup. 1 selects the plain recvfrom() path. Not used with UDP_GRO.
+	void SetBatchSize(unsigned int batchSize)
+	{
+		m_BatchSize = std::max(1U, std::min(batchSize, (unsigned int)MAX_RECV_BATCH));
+	};
+
+	// SO_RCVBUF to ask for and the expected data rate (bytes per second, 0: unknown) it was sized for
+	void SetRcvBuffer(int size, uint64_t dataRate)
+	{
+		m_RcvBufferSize = size > 0 ? size : DEF_RCVBUF_SIZE;
+		m_DataRate = dataRate;
+	};
+
 	void Reset()
 	{
 		m_DataReceived = 0;
 		m_UserData = 0;
-		m_PacketCounter = 0;
+		m_PacketCounter.Publish(0);
+		m_ReleasedPackets = 0;
+		m_SignaledPackets = 0;
+		m_PendingSince = 0;
+		m_LastPublish = 0;
+		m_LastPublished = 0;
+		m_PacketInterval = 0;
+		m_Overruns = 0;
+		m_Overrun = false;
+		m_SocketDrops = 0;
+		m_LastArrival = 0;
+		m_LastGap = 0;
+		m_MinGap = 0;
+		m_MaxGap = 0;
+		m_GapSum = 0;
+		m_GapCount = 0;
+		m_Jitter = 0;
 	};
 
 	void SetType(int type)
@@ -80,29 +169,71 @@ public:
 		m_type = type;
 	};
 
-	void SetDumpFile(FILE *_d)
+	// Takes over the writer, NULL: no dump
+	void SetDumpWriter(CDumpWriter *dumpWriter)
 	{
-		if (m_DumpFile)
-			fclose(m_DumpFile);
-		m_DumpFile = _d;
+		delete m_DumpWriter;
+		m_DumpWriter = dumpWriter;
 	};
 
+	uint64_t GetDumpDrops() const { return m_DumpWriter ? m_DumpWriter->GetDroppedPackets() : 0; };
+
 	void SetInterfacename(const char *ifname)
 	{
 		strncpy(m_Interfacename, ifname, IFNAMSIZ);
 		m_Interfacename[IFNAMSIZ] = '\0';
 	}
 
+	// Only a multicast destination needs anything, the group is joined
+	void SetDestination(uint32_t addr_n, bool multicast)
+	{
+		m_MulticastAddr = multicast ? addr_n : 0;
+	}
+
 	uint64_t GetReceivedData() { return m_DataReceived; };
 	uint64_t GetMaxPacketNo() { return m_MaxPacketNo; };
-	uint64_t GetPacketNo() { return m_PacketCounter; };
+	// The packets before it are in the primary buffer, complete
+	uint64_t GetPacketNo() const { return m_PacketCounter.Acquire(); };
+
+	// The data processor is done with the packets before packetNo, their slots can be received into
+	void ReleasePackets(unsigned int packetNo)
+	{
+		__atomic_store_n(&m_ReleasedPackets, packetNo, __ATOMIC_RELEASE);
+	};
+
+	const unsigned char* GetPacket(unsigned int packetNo) const
+	{
+		return m_pBuffer + (packetNo % m_MaxPacketNo) * m_PacketSize;
+	};
+
+	// Kernel arrival time of a packet still in the primary buffer, ns since the epoch
+	uint64_t GetPacketTime(unsigned int packetNo) const
+	{
+		return m_ArrivalTimes ? m_ArrivalTimes[packetNo % m_MaxPacketNo] : 0;
+	};
+
+	uint64_t GetSocketDrops() const { return m_SocketDrops; };
+	void GetStreamStats(ADT_STREAM_STATS *stats) const;
 
 private:
 	CCamServer(const CCamServer&);
 	CCamServer& operator=(const CCamServer&);
 
-	void OnRead();
+	int OnRead();
+	int OnReadBatch();
+	int OnReadGro();
+	unsigned int GetFreeSlots() const;
+	int DiscardPacket();
+	void NoteOverrun(uint64_t packets);
+	bool CountPacket(const unsigned char *pBuffer, int bytes_received, unsigned int &packetCounter, uint64_t &dataReceived, uint64_t &userData);
+	void RecordArrival(const struct msghdr *message, unsigned int packetNo, unsigned int packets = 1);
+	void SignalData(unsigned int packetCounter, bool signal);
+	bool CheckLatency(unsigned int packetCounter, uint64_t now);
+	bool NeedsTimer() const;
+	void OnTimer();
+	void UpdateArrivalTimes();
 	int GetRcvBufferSize() const;
+	uint64_t GetDataRate() const;
 	uint32_t GetMulticastAddr() const;
 	const char* GetInterfacename() const;
 	void OnStop();
@@ -117,13 +248,52 @@ private:
 	uint64_t m_DataReceived;
 	uint64_t m_UserData;
 	unsigned int m_MaxPacketNo;  // The size of buffer measured in packets.
-	unsigned int m_PacketCounter;
 	unsigned int m_SignalFrequency; // In Cyclic mode the event is signaled when m_PacketCounter % m_SignalFrequency == 0;
 
-	FILE* m_DumpFile;
+	// Latency mode, CLOCK_MONOTONIC ns
+	uint64_t     m_SignalLatency;   // 0: off
+	unsigned int m_SignaledPackets; // m_PacketCounter at the last signal
+	uint64_t     m_PendingSince;    // Publish time of the oldest packet not signaled yet, 0: none
+	uint64_t     m_LastPublish;
+	unsigned int m_LastPublished;   // m_PacketCounter at m_LastPublish
+	int64_t      m_PacketInterval;  // Smoothed time between two packets
+
+	unsigned int   m_BatchSize;
+	int            m_RcvBufferSize;
+	uint64_t       m_DataRate;
+	struct mmsghdr m_Messages[MAX_RECV_BATCH];
+	struct iovec   m_Vectors[MAX_RECV_BATCH];
+	RECV_CONTROL   m_Controls[MAX_RECV_BATCH];
+
+	uint64_t    *m_ArrivalTimes; // Kernel arrival time of the packets in the primary buffer, by slot
+	unsigned int m_ArrivalSize;
+	uint64_t     m_SocketDrops;  // Cumulative SO_RXQ_OVFL count of the socket
+	uint64_t     m_LastArrival;
+	uint64_t     m_LastGap;
+	uint64_t     m_MinGap;
+	uint64_t     m_MaxGap;
+	uint64_t     m_GapSum;
+	uint64_t     m_GapCount;
+	int64_t      m_Jitter;
+	uint64_t     m_Overruns;     // Packets dropped, the primary buffer was full of unreleased packets
+	bool         m_Overrun;      // Dropping packets now
+
+	CDumpWriter *m_DumpWriter;
 	uint32_t m_StreamSerial;
-	uint32_t m_MulticastAddr;
+	uint32_t m_MulticastAddr; // 0: unicast stream
 	char     m_Interfacename[IFNAMSIZ + 1];
+
+	/*
+	 * The primary buffer is a single producer (receiver), single consumer (data processor) ring. The receiver
+	 * publishes the packets received, the data processor the packets it is done with. Each cursor is written
+	 * by one side only and is padded to its own cache line (padding rather than alignment, operator new
+	 * of gnu++0x does not honour extended alignment).
+	 */
+	char         m_CursorPad0[CACHE_LINE_SIZE];
+	PacketCursor m_PacketCounter;
+	char         m_CursorPad1[CACHE_LINE_SIZE - sizeof(unsigned int)];
+	unsigned int m_ReleasedPackets;
+	char         m_CursorPad2[CACHE_LINE_SIZE - sizeof(unsigned int)];
 };
 
 #endif  /* __CAMSERVER_H__ */
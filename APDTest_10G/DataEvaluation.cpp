@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <math.h>
 #include <stdio.h>
 #include <unistd.h>
 
@@ -5,8 +7,7 @@
 #include "DataEvaluation.h"
 #include "InternalFunctions.h"
 #include "Helpers.h"
-
-#define GET_BYTE(p)  (*((uint8_t*)(p)))
+#include "DataUnpack.h"
 
 /* ********** Helpers for data evaluation  ********** */
 static UINT16 GetMask(int bitsPerSample)
@@ -16,50 +17,6 @@ static UINT16 GetMask(int bitsPerSample)
 }
 
 
-inline uint16_t GetData8(const unsigned char *pData, int offset)
-{
-	int byteOffset = offset >> 3; // / 8
-	uint16_t data = GET_BYTE(pData + byteOffset);
-	return data;
-}
-
-
-inline uint16_t GetData12(const unsigned char *pData, int offset)
-{
-	int byteOffset = offset >> 3; // / 8
-	uint16_t data;
-
-	if (offset % 8 == 0)
-		data = (GET_BYTE(pData + byteOffset) << 4) | (GET_BYTE(pData + byteOffset + 1) >> 4);
-	else
-		data = (GET_BYTE(pData + byteOffset) << 8) | GET_BYTE(pData + byteOffset + 1);
-	return data & 0x0FFF;
-}
-
-
-inline uint16_t GetData14(const unsigned char *pData, int offset)
-{
-	int byteOffset = offset >> 3; // / 8
-	int bitOffset = offset & 0x07; // % 8;
-	uint16_t data;
-
-	if (bitOffset == 0)
-		data = (GET_BYTE(pData + byteOffset) <<  6) | (GET_BYTE(pData + byteOffset + 1) >> 2);
-	else if (bitOffset == 6)
-		data = (GET_BYTE(pData + byteOffset) << 12) | (GET_BYTE(pData + byteOffset + 1) << 4) | (GET_BYTE(pData + byteOffset + 2) >> 4);
-	else if (bitOffset == 4)
-		data = (GET_BYTE(pData + byteOffset) << 10) | (GET_BYTE(pData + byteOffset + 1) << 2) | (GET_BYTE(pData + byteOffset + 2) >> 6);
-	else if (bitOffset == 2)
-		data = (GET_BYTE(pData + byteOffset) <<  8) | GET_BYTE(pData + byteOffset + 1);
-	else
-	{
-		data = 0;
-		fprintf(stderr, "\n\n\nWrong bitlength!!!\n\n\n");
-	}
-	return data & 0x3FFF;
-}
-
-
 /* ********** CDataEvaluation class methods  ********** */
 
 CDataEvaluation::CDataEvaluation() :
@@ -72,14 +29,13 @@ CDataEvaluation::CDataEvaluation() :
 	m_ChannelMap(),
 	m_ActiveChannelNo(0),
 	m_Server(NULL),
-	m_SrcBuffer(NULL),
-	m_WritePtr(0),
 	m_DataLength(0),
 	m_Running(false),
 	m_Calibrated(false),
 	m_WorkBuffer(NULL),
 	m_UserBuffer(NULL),
 	m_UserBufferSize(0),
+	m_Interleaved(false),
 	m_Bits(0),
 	m_ChannelMask(0),
 	m_ADCPacketSize(0),
@@ -87,10 +43,48 @@ CDataEvaluation::CDataEvaluation() :
 	m_BlockSize(0),
 	m_PaddedBlockSize(0),
 	m_Mask(0),
+	m_UnpackIsa(GetUnpackIsa()),
+	m_UnpackGroups(NULL),
+	m_UnpackTable(),
+	m_ProcessBlocks(&CDataEvaluation::ProcessBlocks<0>),
+	m_UnpackSamples(&CDataEvaluation::UnpackSamples<0>),
+	m_StoreSamples(NULL),
+	m_StreamStores(false),
+	m_DecodePool(NULL),
+	m_Parallel(false),
+	m_Runs(),
+	m_StitchBuffer(),
+	m_Tasks(),
+	m_QueuedSamples(0),
+	m_DecodeLimit(0),
+	m_StoreFrom(0),
+	m_DecodeDone(NULL),
+	m_EmptyFrame(),
+	m_DecimationFactor(0),
+	m_DecimationBuffer(NULL),
+	m_DecimationBufferSize(0),
+	m_DecimationSizeInSample(0),
+	m_DecimationData(),
+	m_EmitFrom(0),
+	m_SumSamples(NULL),
+	m_DecimationPart(),
+	m_DecimationParts(),
+	m_DecimatedCount(0),
 	m_ChannelOffsets(),
+	m_ChannelGains(),
+	m_CalibOffsets(),
+	m_CalibGains(),
+	m_CalibrateSamples(NULL),
 	m_MaxNoofBlocks(0),
 	m_ExpectedPacketCounter(1),
 	m_ContinuityError(false),
+	m_LostPackets(0),
+	m_LatePackets(0),
+	m_Overruns(0),
+	m_ReorderWindow(DEF_REORDER_WINDOW),
+	m_ReorderSlots(),
+	m_HeldPackets(0),
+	m_HighestHeld(0),
 	m_SampleCount(0),
 	m_SampleIndex(0),
 	m_UserBufferSizeInSample(0),
@@ -111,15 +105,16 @@ CDataEvaluation::CDataEvaluation() :
 	m_ProcessingTime.QuadPart = 0;
 	m_LastCallingTime.QuadPart = 0;
 	m_AvarageCallingTime.QuadPart = 0;
-	memset(m_ChannelOffsets, 0, sizeof(m_ChannelOffsets));
+	SetCalibration(NULL, NULL);
 }
 
 
 CDataEvaluation::~CDataEvaluation()
 {
 	Stop();
-if (dumpFile)
-	fclose(dumpFile);
+	if (dumpFile)
+		fclose(dumpFile);
+	delete m_DecodeDone;
 }
 
 
@@ -129,14 +124,16 @@ void CDataEvaluation::InternalStop()
 }
 
 
-unsigned int CDataEvaluation::Handler()
+/*
+ * Resets the decoder for a new measurement. Handler() calls it, a reactor thread calls it before the stream starts.
+ */
+void CDataEvaluation::BeginProcessing()
 {
 	/*
 	 * FIXME: reset values!!!
 	 *  (ie. just restore what was originally here...)
 	 */
 	m_PacketNo = 0;
-	m_WritePtr = 0;
 	m_DataLength = 0;
 	m_MaxNoofBlocks = 0;
 	m_ExpectedPacketCounter = 1;
@@ -144,6 +141,14 @@ unsigned int CDataEvaluation::Handler()
 	m_SampleCount = 0;
 	m_SampleIndex = 0;
 	m_StreamNo = 0;
+	m_LostPackets = 0;
+	m_LatePackets = 0;
+	m_Overruns = 0;
+
+	REORDER_SLOT empty = { false, 0, 0 };
+	m_ReorderSlots.assign(m_ReorderWindow, empty);
+	m_HeldPackets = 0;
+	m_HighestHeld = 0;
 
 	FillMap();
 	m_BlockSize = GetBlockSize(m_ActiveChannelNo, m_Bits);
@@ -152,16 +157,156 @@ unsigned int CDataEvaluation::Handler()
 	else
 		m_PaddedBlockSize = m_BlockSize;
 	m_Mask = GetMask(m_Bits);
+	m_UnpackGroups = GetGroupUnpacker(m_Bits, m_UnpackIsa);
+	FillUnpackTable(m_ChannelMask, m_Bits, m_UnpackTable);
+	switch (m_UnpackGroups ? GetFullGroups(m_ChannelMask) : 0)
+	{
+		case 1:
+			m_ProcessBlocks = &CDataEvaluation::ProcessBlocks<1>;
+			m_UnpackSamples = &CDataEvaluation::UnpackSamples<1>;
+			break;
+		case 2:
+			m_ProcessBlocks = &CDataEvaluation::ProcessBlocks<2>;
+			m_UnpackSamples = &CDataEvaluation::UnpackSamples<2>;
+			break;
+		case 3:
+			m_ProcessBlocks = &CDataEvaluation::ProcessBlocks<3>;
+			m_UnpackSamples = &CDataEvaluation::UnpackSamples<3>;
+			break;
+		case 4:
+			m_ProcessBlocks = &CDataEvaluation::ProcessBlocks<4>;
+			m_UnpackSamples = &CDataEvaluation::UnpackSamples<4>;
+			break;
+		default:
+			m_ProcessBlocks = &CDataEvaluation::ProcessBlocks<0>;
+			m_UnpackSamples = &CDataEvaluation::UnpackSamples<0>;
+			break;
+	}
 
+	// The user buffer has room for the active channels only
 	for (int channel = 0; channel < CHANNEL_NUM; ++channel)
 	{
-		m_ChannelData[channel] = (INT16*)(m_UserBuffer + m_UserBufferSize * channel);
+		if (m_Interleaved || channel >= m_ActiveChannelNo)
+			m_ChannelData[channel] = NULL;
+		else
+			m_ChannelData[channel] = (INT16*)(m_UserBuffer + m_UserBufferSize * channel);
 	}
 
 	m_UserBufferSizeInSample = m_UserBufferSize / sizeof(UINT16);
+	m_StoreSamples = GetSampleStorer(m_UnpackIsa);
+	for (int i = 0; i < UNPACK_GROUP_CHANNELS * m_ActiveChannelNo; ++i)
+	{
+		m_CalibOffsets[i] = m_ChannelOffsets[m_ChannelMap[i % m_ActiveChannelNo]];
+		m_CalibGains[i] = m_ChannelGains[m_ChannelMap[i % m_ActiveChannelNo]];
+	}
+	m_CalibrateSamples = m_Calibrated ? GetSampleCalibrator(m_UnpackIsa) : NULL;
+	m_EmptyFrame.assign(m_ADCPacketSize, 0);
+	m_Parallel = false;
+
+	// The decimated rings of the active channels
+	m_DecimationSizeInSample = 0;
+	if (m_DecimationFactor >= 2 && m_DecimationFactor <= MAX_DECIMATION && m_DecimationBuffer)
+		m_DecimationSizeInSample = m_DecimationBufferSize / sizeof(UINT16);
+	for (int channel = 0; channel < CHANNEL_NUM; ++channel)
+	{
+		if (m_DecimationSizeInSample && channel < m_ActiveChannelNo)
+			m_DecimationData[channel] = (INT16*)(m_DecimationBuffer + m_DecimationBufferSize * channel);
+		else
+			m_DecimationData[channel] = NULL;
+	}
+	m_DecimationPart.samples = 0;
+	m_DecimatedCount = 0;
+	m_EmitFrom = 0;
+	m_SumSamples = GetSampleSummer(m_UnpackIsa);
 
 	m_LastCallingTime.QuadPart = 0;
 
+	m_Running = true;
+}
+
+
+/*
+ * Processes the packets signaled by the server. Returns false if the decoder must stop.
+ */
+bool CDataEvaluation::ProcessNotification()
+{
+	m_pDataNotificationSignal->Reset();
+	LARGE_INTEGER performanceCount1, performanceCount2;
+	QueryPerformanceCounter(&performanceCount1);
+
+	if (m_LastCallingTime.QuadPart != 0)
+	{
+		m_AvarageCallingTime.QuadPart += performanceCount1.QuadPart - m_LastCallingTime.QuadPart;
+		m_CallingCount++;
+	}
+	m_LastCallingTime.QuadPart = performanceCount1.QuadPart;
+
+	ProcessData();
+
+	QueryPerformanceCounter(&performanceCount2);
+	m_ProcessingTime.QuadPart += performanceCount2.QuadPart - performanceCount1.QuadPart;
+	m_ProcessingCount++;
+
+	return m_ContinuityError == false;
+}
+
+
+/*
+ * ProcessNotification() for a reactor thread, which has no exit signal to wait on: a decoder stopped by
+ * InternalStop() also returns false.
+ */
+bool CDataEvaluation::ReactorStep()
+{
+	bool running = ProcessNotification();
+
+	if (m_ExitSignal->IsSignaled())
+	{
+		m_ExitSignal->Reset();
+		running = false;
+	}
+
+	return running;
+}
+
+
+void CDataEvaluation::EndProcessing()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	double ce = 1000*(double)(m_AvarageCallingTime.QuadPart)/(double)frequency.QuadPart;
+	if (m_CallingCount)
+	{
+		ce = ce / m_CallingCount;
+//		printf("Average calling time: %g ms (%d)\n",ce, m_StreamNo);
+	}
+
+	ce = 1000*(double)(m_ProcessingTime.QuadPart)/(double)frequency.QuadPart;
+	if (m_ProcessingCount)
+	{
+		ce = ce / m_ProcessingCount;
+//		printf("Average data conversion time: %g ms (%d)\n",ce, m_StreamNo);
+	}
+
+	if (!m_ContinuityError)
+	{ 
+	  printf("Packets received: %u (Stream: %u)\n", m_Server->GetPacketNo(), m_StreamNo);
+//	  printf("Max noof blocks: %u, %" PRIu64 " (Stream: %u)\n", m_MaxNoofBlocks, m_SampleCount, m_StreamNo);
+	  fflush(stdout);
+   }
+   else
+   {
+	  /* The decoder stopped, the stream statistics report the error */
+	  fprintf(stderr, "Decoding stopped on a continuity error after %u packets (Stream: %u)\n", m_PacketNo, m_StreamNo);
+	  fflush(stderr);
+   }
+}
+
+
+unsigned int CDataEvaluation::Handler()
+{
+	BeginProcessing();
+
 	CWaitForEvents *waitObject = CAPDFactory::GetAPDFactory()->GetWaitForEvents();
 	if (!waitObject)
 		return 1;
@@ -169,8 +314,6 @@ unsigned int CDataEvaluation::Handler()
 	waitObject->Add(m_pDataNotificationSignal);
 	waitObject->Add(m_ExitSignal);
 
-	m_Running = true;
-
 	InitDone();
 
 	bool bQuit = false;
@@ -184,63 +327,20 @@ unsigned int CDataEvaluation::Handler()
 		switch (index) 
 		{
 			case 0:	// data arrived signal 
-				{
-					m_pDataNotificationSignal->Reset();
-					LARGE_INTEGER performanceCount1, performanceCount2;
-					QueryPerformanceCounter(&performanceCount1);
-
-					if (m_LastCallingTime.QuadPart != 0)
-					{
-						m_AvarageCallingTime.QuadPart += performanceCount1.QuadPart - m_LastCallingTime.QuadPart;
-						m_CallingCount++;
-					}
-					m_LastCallingTime.QuadPart = performanceCount1.QuadPart;
-
-					ProcessData();
-                 if (m_ContinuityError)  bQuit = true;
-                 
-					QueryPerformanceCounter(&performanceCount2);
-					m_ProcessingTime.QuadPart += performanceCount2.QuadPart - performanceCount1.QuadPart;
-					m_ProcessingCount++;
-				}
+				if (ProcessNotification() == false)
+					bQuit = true;
 				break;
 			case 1:	// exit thread signal
-				{ 
-					LARGE_INTEGER frequency;
-					QueryPerformanceFrequency(&frequency);
-
-					double ce = 1000*(double)(m_AvarageCallingTime.QuadPart)/(double)frequency.QuadPart;
-					if (m_CallingCount)
-					{
-						ce = ce / m_CallingCount;
-//						printf("Average calling time: %g ms (%d)\n",ce, m_StreamNo);
-					}
-
-					ce = 1000*(double)(m_ProcessingTime.QuadPart)/(double)frequency.QuadPart;
-					if (m_ProcessingCount)
-					{
-						ce = ce / m_ProcessingCount;
-//						printf("Average data conversion time: %g ms (%d)\n",ce, m_StreamNo);
-					}
-
-					bQuit = true;
-				}
+				bQuit = true;
 				break;
 			default:
 				// other unknown error (timeout, etc.)
 				break;
 		}
 	}
-	if (!m_ContinuityError)
-	{ 
-	  printf("Packets received: %u (Stream: %u)\n", m_Server->GetPacketNo(), m_StreamNo);
-//	  printf("Max noof blocks: %u, %" PRIu64 " (Stream: %u)\n", m_MaxNoofBlocks, m_SampleCount, m_StreamNo);
-	  fflush(stdout);
-   }
-   else
-   {
-      exit(1);
-   }
+
+	EndProcessing();
+
 	delete waitObject;
 
 	return 0;
@@ -252,24 +352,38 @@ void CDataEvaluation::ProcessData()
    /* This routine processes the incoming UDP packets.
    Handling of packet loss, and other problems:
 
-    - We allow for the loss of MAX_PACKET_LOSS number of packets. If the packet counter jumps less than
-      this number we fill in the missing data by 0.
-    - If the packet number jumps backwards we assume that the measurement was restarted and we drop all data before. 
+    - Packets may arrive out of order (e.g. from a NIC spreading the stream over several queues). A packet
+      ahead of the expected one is held in the reorder window until the packets before it arrive.
+    - We allow for the loss of MAX_PACKET_LOSS number of packets. If a packet does not arrive until the window
+      moves over it we fill in the missing data by 0.
+    - A packet arriving after its place was filled is dropped, however far behind the window it is.
       We also assume that the measurements start with packet number 1. If this is not the case the packet loss
       strategy is used.
    */
 	bool errorCondition = false;
 	unsigned int packetNo = m_Server->GetPacketNo(); // Returns the packet counter
-	unsigned int maxPacketNo = m_Server->GetMaxPacketNo();
 
 	m_MaxNoofBlocks = std::max(m_MaxNoofBlocks, (packetNo - m_PacketNo)); // Maximum number of blocks to process
 
+	// The server wrapped around the primary buffer over packets not yet processed
+	if (packetNo - m_PacketNo > m_Server->GetMaxPacketNo())
+		m_Overruns += packetNo - m_PacketNo - m_Server->GetMaxPacketNo();
+
+	/*
+	 * Nothing arrived since the last call: the stream stopped or paused, the held packets
+	 * are not waiting for anything any more.
+	 */
+	bool flushWindow = (packetNo == m_PacketNo);
+
+	m_Parallel = m_DecodePool && !TriggerArmed();
+	m_QueuedSamples = m_SampleCount;
+
    // m_PacketNo is the next packet
 	if (m_PacketNo == 0 && packetNo)
 	{
 	   // If this is the first packet and there is a packet available
-		unsigned char* pSource = m_SrcBuffer;
-		CC_STREAMHEADER *header = reinterpret_cast<CC_STREAMHEADER*>(pSource);
+		const unsigned char* pSource = m_Server->GetPacket(0);
+		const CC_STREAMHEADER *header = reinterpret_cast<const CC_STREAMHEADER*>(pSource);
 
 		if (header->serial != m_StreamSerial)
 		{
@@ -284,8 +398,8 @@ void CDataEvaluation::ProcessData()
 
 	while (m_PacketNo < packetNo)  // Processing packets up to the number in the buffer
 	{
-		unsigned char* pSource = m_SrcBuffer + ((m_PacketNo % maxPacketNo) * m_CCPacketSize);
-		CC_STREAMHEADER *header = reinterpret_cast<CC_STREAMHEADER*>(pSource);
+		const unsigned char* pSource = m_Server->GetPacket(m_PacketNo);
+		const CC_STREAMHEADER *header = reinterpret_cast<const CC_STREAMHEADER*>(pSource);
 
 		if (header->serial != m_StreamSerial)
 		{
@@ -306,152 +420,550 @@ void CDataEvaluation::ProcessData()
 //		  continue;
 //		}
 
-		if (packetCounter < m_ExpectedPacketCounter)
+		if (packetCounter < m_ExpectedPacketCounter || IsHeld(packetCounter))
 		{
-			fprintf(stderr,"Error, unexpected packet received. Packet counter: %" PRIu64 " (expected: %" PRIu64 ". (stream: %d)\n", 
-				          packetCounter, m_ExpectedPacketCounter, m_StreamNo);
-			fflush(stderr);
-				++m_PacketNo;
-				m_ContinuityError = true;
-				errorCondition = true;
-				break;
+			// Too late, its place is already filled, or a duplicate
+			++m_LatePackets;
+			printf("Warning, late packet dropped. Packet counter: %" PRIu64 " (expected: %" PRIu64 ", stream: %d)\n",
+				packetCounter, m_ExpectedPacketCounter, m_StreamNo);
+			++m_PacketNo;
+			continue;
 		}
 
-
-		if (m_ExpectedPacketCounter != packetCounter)
+		// The window moves so that this packet fits in it
+		if (packetCounter - m_ExpectedPacketCounter > m_ReorderSlots.size() &&
+			AdvanceWindow(packetCounter - m_ReorderSlots.size()) == false)
 		{
-        	    if (packetCounter-m_ExpectedPacketCounter-1 > MAX_PACKET_LOSS)
-        	    {
-        	       fprintf(stderr, "Error, too many packet lost: %" PRIu64 " (after packet: %d, stream: %d)\n", 
-                	   packetCounter-m_ExpectedPacketCounter-1, m_PacketNo, m_StreamNo);
-					  fflush(stderr);
-					  ++m_PacketNo;
-					  m_ContinuityError = true;
-					  errorCondition = true;
-					  break;
-        	    }
-          				
-          	 printf("Warning, %" PRIu64 " packet lost. (After packet: %d, stream: %d). Inserting zero data.\n", 
-                 packetCounter-m_ExpectedPacketCounter, m_PacketNo, m_StreamNo);
-			// Inserting empty packets
-			CC_STREAMHEADER empty_header;
-			unsigned char empty_data[m_ADCPacketSize];
-			for (unsigned int i=0; i<m_ADCPacketSize; i++) empty_data[i] = 0;
-			for (unsigned int i=0; i<packetCounter-m_ExpectedPacketCounter; i++)
-			{
-			  for (unsigned int j=0; j<sizeof(ADT_CC_COUNTER); j++) empty_header.packetCounter[j] = 
-			                                            (unsigned char) ((m_ExpectedPacketCounter >> j) & 0xFF);
-			  ProcessFrame(reinterpret_cast<CC_STREAMHEADER*>(&empty_header), empty_data, m_PacketNo);
-        	  ++m_ExpectedPacketCounter;
-        	}  
+			++m_PacketNo;
+			m_ContinuityError = true;
+			errorCondition = true;
+			break;
 		}
 
-		ProcessFrame(header, pSource + sizeof(CC_STREAMHEADER), m_PacketNo);
+		if (packetCounter == m_ExpectedPacketCounter)
+		{
+			ProcessFrame(header, pSource + sizeof(CC_STREAMHEADER), m_PacketNo);
+			++m_ExpectedPacketCounter;
+			ProcessHeld();
+		}
+		else
+		{
+			REORDER_SLOT &slot = m_ReorderSlots[packetCounter % m_ReorderSlots.size()];
+			slot.held = true;
+			slot.packetCounter = packetCounter;
+			slot.packetNo = m_PacketNo;
+			++m_HeldPackets;
+			m_HighestHeld = std::max(m_HighestHeld, packetCounter);
+		}
 
 		++m_PacketNo;
-		++m_ExpectedPacketCounter;
 	}
 
-	if (errorCondition)
+	/*
+	 * In one-shot mode the server takes no packets after the last one of the shot,
+	 * the gaps before it will not be filled.
+	 */
+	if (m_StopAt != 0 && m_HighestHeld * m_ADCPacketSize >= m_StopAt * m_PaddedBlockSize)
+		flushWindow = true;
+
+	if (!errorCondition && flushWindow && m_HeldPackets && AdvanceWindow(m_HighestHeld + 1) == false)
+	{
+		m_ContinuityError = true;
+		errorCondition = true;
+	}
+
+	DecodeQueued();
+
+	// The server may reuse the storage of the processed packets, but not of the held ones
+	unsigned int releasePacketNo = m_PacketNo;
+	for (unsigned int i = 0; m_HeldPackets && i < m_ReorderSlots.size(); ++i)
 	{
-		m_WritePtr = 0;
+		if (m_ReorderSlots[i].held)
+			releasePacketNo = std::min(releasePacketNo, m_ReorderSlots[i].packetNo);
+	}
+	m_Server->ReleasePackets(releasePacketNo);
+
+	if (errorCondition)
 		m_DataLength = 0;
+}
+
+
+bool CDataEvaluation::IsHeld(uint64_t packetCounter) const
+{
+	if (m_HeldPackets == 0)
+		return false;
+
+	const REORDER_SLOT &slot = m_ReorderSlots[packetCounter % m_ReorderSlots.size()];
+	return slot.held && slot.packetCounter == packetCounter;
+}
+
+
+/*
+ * Processes the held packets following the last processed one.
+ */
+void CDataEvaluation::ProcessHeld()
+{
+	while (IsHeld(m_ExpectedPacketCounter))
+	{
+		REORDER_SLOT &slot = m_ReorderSlots[m_ExpectedPacketCounter % m_ReorderSlots.size()];
+		slot.held = false;
+		--m_HeldPackets;
+
+		const unsigned char* pSource = m_Server->GetPacket(slot.packetNo);
+		ProcessFrame(reinterpret_cast<const CC_STREAMHEADER*>(pSource), pSource + sizeof(CC_STREAMHEADER), slot.packetNo);
+		++m_ExpectedPacketCounter;
+	}
+
+	if (m_HeldPackets == 0)
+		m_HighestHeld = 0;
+}
+
+
+/*
+ * Processes the packets up to packetCounter (not included). The held ones are processed, the missing ones are
+ * filled by 0. Returns false if too many packets are missing in a row.
+ */
+bool CDataEvaluation::AdvanceWindow(uint64_t packetCounter)
+{
+	while (m_ExpectedPacketCounter < packetCounter)
+	{
+		uint64_t next = m_ExpectedPacketCounter;
+		while (next < packetCounter && !IsHeld(next))
+			++next;
+
+		uint64_t lost = next - m_ExpectedPacketCounter;
+		m_LostPackets += lost;
+		if (lost > MAX_PACKET_LOSS)
+		{
+			fprintf(stderr, "Error, too many packet lost: %" PRIu64 " (after packet: %d, stream: %d)\n", 
+				lost, m_PacketNo, m_StreamNo);
+			fflush(stderr);
+			return false;
+		}
+
+		printf("Warning, %" PRIu64 " packet lost. (After packet: %d, stream: %d, socket drops: %" PRIu64 "). Inserting zero data.\n", 
+			lost, m_PacketNo, m_StreamNo, m_Server->GetSocketDrops());
+		InsertEmptyPackets(lost);
+		ProcessHeld();
+	}
+
+	return true;
+}
+
+
+void CDataEvaluation::InsertEmptyPackets(uint64_t count)
+{
+	CC_STREAMHEADER empty_header;
+	for (uint64_t i=0; i<count; i++)
+	{
+	  for (unsigned int j=0; j<sizeof(ADT_CC_COUNTER); j++) empty_header.packetCounter[j] = 
+	                                            (unsigned char) ((m_ExpectedPacketCounter >> j) & 0xFF);
+	  ProcessFrame(reinterpret_cast<CC_STREAMHEADER*>(&empty_header), &m_EmptyFrame[0], m_PacketNo);
+	  ++m_ExpectedPacketCounter;
 	}
 }
 
 // This processes the contents of one UDP packet
 // pFrame is the start of the data
+// The samples are decoded in place, in the storage of the server. Only a sample straddling two packets is
+// stitched together in m_WorkBuffer. With the decode pool they are only queued (see DecodeBlocks).
 void CDataEvaluation::ProcessFrame(const CC_STREAMHEADER *header, const unsigned char *pFrame, unsigned int packetNo)
 {
-	if (!m_Running)
+	if (!m_Running || m_PaddedBlockSize == 0)
 		return;
 
-	memcpy(m_WorkBuffer + m_WritePtr, pFrame, m_ADCPacketSize);
-	m_DataLength += m_ADCPacketSize;
+	const unsigned char* pData = pFrame;
+	int length = m_ADCPacketSize;
 
-	unsigned char* pData = m_WorkBuffer;
+	// Complete the sample started in the previous packet
+	if (m_DataLength)
+	{
+		int missing = m_PaddedBlockSize - m_DataLength;
+		if (missing > length)
+		{
+			memcpy(m_WorkBuffer + m_DataLength, pData, length);
+			m_DataLength += length;
+			return;
+		}
 
-        // Prpcess until there is data for a full sample
-	while (m_DataLength >= m_BlockSize)
+		memcpy(m_WorkBuffer + m_DataLength, pData, missing);
+		DecodeBlocks(m_WorkBuffer, 1);
+
+		pData += missing;
+		length -= missing;
+		m_DataLength = 0;
+	}
+
+	// Process until there is data for a full sample
+	int blocks = length / m_PaddedBlockSize;
+	DecodeBlocks(pData, blocks);
+	pData += blocks * m_PaddedBlockSize;
+	length -= blocks * m_PaddedBlockSize;
+
+	// The beginning of a sample is left, the next packet completes it
+	if (length)
 	{
-		++m_SampleCount;
+		memcpy(m_WorkBuffer, pData, length);
+		m_DataLength = length;
+	}
+}
 
-		ProcessBlock(pData); // ProcessBlock(m_TempBuffer + m_ReadPtr);
 
-		pData += m_PaddedBlockSize;
-		m_DataLength -= m_PaddedBlockSize;
+// A trigger can fire: triggering is on for a channel and no stop point is set yet (see DoTrigger)
+bool CDataEvaluation::TriggerArmed() const
+{
+	if (!m_Triggered || !m_TriggerManager || m_StopAt != 0)
+		return false;
+	for (int channel = 0; channel < CHANNEL_NUM; ++channel)
+	{
+		if (m_TriggerEnabled[channel])
+			return true;
 	}
+	return false;
+}
 
-        // If some data is left move it to the beginning of the buffer and put the write buffer at the end
-        // The next packet will add more data
-	if (m_DataLength)
-		memcpy(m_WorkBuffer, pData, m_DataLength); // memcpy(m_WorkBuffer, m_WorkBuffer + m_ReadPtr, m_DataLength);
-	m_WritePtr = m_DataLength;
+
+void CDataEvaluation::SetDecodePool(CDecodePool *pool)
+{
+	if (pool && m_DecodeDone == NULL)
+		m_DecodeDone = CAPDFactory::GetAPDFactory()->GetEvent(CAPDFactory::EK_FUTEX);
+
+	m_DecodePool = pool;
+}
+
+
+// Places count unpacked samples of the active channels into the channel buffers from index on, splitting at the end of the ring
+// The interleaved ring has the layout of the tile, it is copied as it is.
+inline void CDataEvaluation::StoreSamplesAt(const int16_t *tile, unsigned int channels, unsigned int count, uint64_t index) const
+{
+	unsigned int first = count;
+	if (index + count > m_UserBufferSizeInSample)
+		first = (unsigned int)(m_UserBufferSizeInSample - index);
+
+	if (m_Interleaved)
+	{
+		int16_t *ring = reinterpret_cast<int16_t*>(m_UserBuffer);
+		memcpy(ring + index * channels, tile, first * channels * sizeof(int16_t));
+		if (first < count)
+			memcpy(ring, tile + first * channels, (count - first) * channels * sizeof(int16_t));
+		return;
+	}
+
+	m_StoreSamples(tile, channels, first, m_ChannelData, index, m_StreamStores);
+	if (first < count)
+		m_StoreSamples(tile + first * channels, channels, count - first, m_ChannelData, 0, m_StreamStores);
+}
+
+
+// Places count unpacked samples at m_SampleIndex and moves it over them
+inline void CDataEvaluation::StoreSamples(const int16_t *tile, unsigned int channels, unsigned int count)
+{
+	StoreSamplesAt(tile, channels, count, m_SampleIndex);
+	m_SampleIndex += count;
+	if (m_SampleIndex >= m_UserBufferSizeInSample)
+		m_SampleIndex -= m_UserBufferSizeInSample;
 }
 
 
-// Reads data of all channels from one sample block and places into the channel buffers 
-// pdata is the byte pointer of the start of the sample block
-void CDataEvaluation::ProcessBlock(unsigned char *pData)
+// Unpacks count consecutive sample blocks at pData into tile, one sample after the other
+// groups: the channel mask is made of that many full ADC blocks (the empty ones take no place), the channel
+// count is a constant and the unpack kernel takes all of them at once. 0: any other mask, by m_UnpackTable.
+template <unsigned int groups>
+inline void CDataEvaluation::UnpackSamples(const unsigned char *pData, int16_t *tile, unsigned int count) const
 {
-	if (m_Running || m_StopAt == 0)
+	const unsigned int channels = groups ? groups * UNPACK_GROUP_CHANNELS : m_ActiveChannelNo;
+
+	for (unsigned int sample = 0; sample < count; ++sample, pData += m_PaddedBlockSize)
 	{
-		int offset = 0;
-        //int *channelMap = m_ChannelMap;
-		uint32_t mask=1;
-		int channel=0;
-		// Looping through the 4 ADC blocks in one ADC card
-        for (int i_block=0; i_block<4; i_block++)
+		if (groups)
+			m_UnpackGroups(pData, tile + sample * channels, groups);
+		else
+			UnpackTable(pData, tile + sample * channels, m_UnpackTable, m_ActiveChannelNo, m_Mask);
+	}
+}
+
+
+// Reads data of all channels from count consecutive sample blocks and places into the channel buffers
+// pdata is the byte pointer of the start of the first sample block
+// Up to DECODE_BATCH samples are unpacked into a tile, then each channel gets them as one contiguous run.
+// While a trigger can fire the samples go one by one, the stop point is set from the sample that fired.
+// In calibrated mode the tile is corrected before the triggers see it, while it is in the cache.
+template <unsigned int groups>
+void CDataEvaluation::ProcessBlocks(const unsigned char *pData, unsigned int count)
+{
+	int16_t tile[DECODE_BATCH * CHANNEL_NUM] __attribute__((aligned(16)));
+	const unsigned int channels = groups ? groups * UNPACK_GROUP_CHANNELS : m_ActiveChannelNo;
+
+	while (count)
+	{
+		if (!m_Running && m_StopAt != 0)
 		{
-			// Looping thorugh the 8 channels in one ADC block
-			for (int i_ch=0; i_ch<8; i_ch++)
-			{
-                if (m_ChannelMask & mask)
-				{
-					// Get data from sample block
-                    int16_t data = 0;
-					switch (m_Bits)
-					{
-						case 8:
-							data = (int16_t)GetData8(pData, offset);
-							break;
-						case 12:
-							data = (int16_t)GetData12(pData, offset);
-							break;
-						case 14:
-							data = (int16_t)GetData14(pData, offset);
-							break;
-						default:
-							data = 0xFFFF;
-							break;
-					}
-                    //bitcount += m_Bits;
-                   // int luv = *channelMap++; // Gets the real channelindex
-                    Trigger(channel,data);
-                    *(m_ChannelData[channel++] + m_SampleIndex) = data;
-					offset += m_Bits;
-				}
-				mask <<= 1;
-			}
-                	// Padding to byte boundary
-			if (offset % 8)
-                offset = (offset / 8 +1)*8;
+			m_SampleCount += count;
+			return;
+		}
+
+		bool armed = TriggerArmed();
+		unsigned int batch = armed ? 1 : std::min(count, (unsigned int)DECODE_BATCH);
+		ULONGLONG stopAt = m_StopAt;
+		if (stopAt > m_SampleCount && stopAt - m_SampleCount < batch)
+			batch = (unsigned int)(stopAt - m_SampleCount);
+
+		UnpackSamples<groups>(pData, tile, batch);
+		if (m_CalibrateSamples)
+			m_CalibrateSamples(tile, channels, batch, m_CalibOffsets, m_CalibGains);
+		pData += batch * m_PaddedBlockSize;
+		m_SampleCount += batch;
+		count -= batch;
+
+		if (armed)
+		{
+			for (unsigned int channel = 0; channel < channels; ++channel)
+				Trigger(channel, tile[channel]);
 		}
 
-		m_SampleIndex++;
-		if (m_SampleIndex >= m_UserBufferSizeInSample)
-			m_SampleIndex = 0;
+		StoreSamples(tile, channels, batch);
 
-		if (m_StopAt != 0 && m_SampleCount == m_StopAt && m_pUserNotificationSignal)
+		/*
+		 * The stop point may be set by the trigger of another stream while the batch is decoded. If the batch
+		 * went past it, the samples after it are taken back.
+		 */
+		unsigned int kept = batch;
+		stopAt = m_StopAt;
+		if (stopAt != 0 && m_SampleCount >= stopAt && m_SampleCount - batch < stopAt && m_pUserNotificationSignal)
 		{
+			ULONGLONG over = m_SampleCount - stopAt;
+			kept -= (unsigned int)over;
+			m_SampleIndex = (m_SampleIndex + m_UserBufferSizeInSample - over) % m_UserBufferSizeInSample;
+			m_SampleCount = stopAt;
 			m_Running = false;
 			m_pUserNotificationSignal->Set();
 		}
+
+		if (m_DecimationSizeInSample)
+		{
+			Decimate(tile, channels, kept, m_SampleCount - kept, m_DecimationPart, NULL);
+			m_DecimatedCount = m_SampleCount / m_DecimationFactor;
+		}
+	}
+}
+
+
+// Decodes count sample blocks at pData, or queues them for the decode pool. The stitched sample in
+// m_WorkBuffer is copied, the next packet reuses the buffer.
+inline void CDataEvaluation::DecodeBlocks(const unsigned char *pData, unsigned int count)
+{
+	if (!m_Parallel)
+	{
+		(this->*m_ProcessBlocks)(pData, count);
+		return;
+	}
+
+	if (count == 0)
+		return;
+
+	DECODE_RUN run = { pData, 0, count, m_QueuedSamples };
+	if (pData == m_WorkBuffer)
+	{
+		run.data = NULL;
+		run.stitch = m_StitchBuffer.size();
+		m_StitchBuffer.insert(m_StitchBuffer.end(), pData, pData + count * m_PaddedBlockSize);
+	}
+	m_Runs.push_back(run);
+	m_QueuedSamples += count;
+}
+
+
+/*
+ * Decodes the runs queued in this ProcessData() on the decode pool, in tasks of whole runs. Then the sample
+ * counter and index move over them, up to the stop point, as in ProcessBlocks().
+ */
+void CDataEvaluation::DecodeQueued()
+{
+	if (!m_Parallel)
+		return;
+	m_Parallel = false;
+
+	if (m_Runs.empty())
+		return;
+
+	ULONGLONG first = m_SampleCount;
+	ULONGLONG stopAt = m_StopAt;
+	m_DecodeLimit = (stopAt > first && m_pUserNotificationSignal) ? stopAt : m_QueuedSamples;
+
+	m_Tasks.clear();
+	unsigned int samples = 0;
+	unsigned int end = 0;
+	for (; end < m_Runs.size() && m_Runs[end].sample < m_DecodeLimit; ++end)
+	{
+		DECODE_RUN &run = m_Runs[end];
+		if (run.data == NULL)
+			run.data = &m_StitchBuffer[run.stitch];
+
+		if (samples == 0)
+			m_Tasks.push_back(end);
+		samples += run.blocks;
+		if (samples >= DECODE_TASK_SAMPLES)
+			samples = 0;
+	}
+	m_Tasks.push_back(end);
+
+	/*
+	 * A batch longer than the ring wraps over itself. Only the samples left in the ring are stored, else the
+	 * tasks would race for the places of the earlier ones.
+	 */
+	ULONGLONG last = std::min(m_QueuedSamples, m_DecodeLimit);
+	m_StoreFrom = (last > m_UserBufferSizeInSample) ? last - m_UserBufferSizeInSample : 0;
+
+	unsigned int tasks = m_Tasks.size() - 1;
+	if (m_DecimationSizeInSample)
+	{
+		ULONGLONG windows = last / m_DecimationFactor;
+		m_EmitFrom = (windows > m_DecimationSizeInSample) ? windows - m_DecimationSizeInSample : 0;
+		m_DecimationParts.assign(2 * tasks, DECIMATION_PART());
+	}
+
+	if (tasks > 1)
+		m_DecodePool->Run(this, tasks, m_DecodeDone);
+	else if (tasks == 1)
+		RunTask(0);
+
+	for (unsigned int task = 0; m_DecimationSizeInSample && task < tasks; ++task)
+	{
+		MergeDecimated(m_DecimationParts[2 * task]);
+		MergeDecimated(m_DecimationParts[2 * task + 1]);
+	}
+
+	m_EmitFrom = 0;
+	m_SampleIndex = (m_SampleIndex + (last - first)) % m_UserBufferSizeInSample;
+	m_SampleCount = last;
+
+	// The stop point may be set by the trigger of another stream meanwhile
+	stopAt = m_StopAt;
+	if (stopAt != 0 && stopAt > first && stopAt <= last && m_pUserNotificationSignal)
+	{
+		m_SampleIndex = (m_SampleIndex + m_UserBufferSizeInSample - (last - stopAt)) % m_UserBufferSizeInSample;
+		m_SampleCount = stopAt;
+		m_Running = false;
+		m_pUserNotificationSignal->Set();
+	}
+
+	if (m_DecimationSizeInSample)
+		m_DecimatedCount = m_SampleCount / m_DecimationFactor;
+
+	m_Runs.clear();
+	m_StitchBuffer.clear();
+}
+
+
+// A task of DecodeQueued(), on any thread. The sample counter and index are not moved until all tasks are done.
+void CDataEvaluation::RunTask(unsigned int task)
+{
+	int16_t tile[DECODE_BATCH * CHANNEL_NUM] __attribute__((aligned(16)));
+	const unsigned int channels = m_ActiveChannelNo;
+	DECIMATION_PART *head = m_DecimationSizeInSample ? &m_DecimationParts[2 * task] : NULL;
+
+	for (unsigned int i = m_Tasks[task]; i < m_Tasks[task + 1]; ++i)
+	{
+		const DECODE_RUN &run = m_Runs[i];
+		const unsigned char *pData = run.data;
+		uint64_t end = std::min(run.sample + run.blocks, m_DecodeLimit);
+
+		for (uint64_t sample = run.sample; sample < end; )
+		{
+			unsigned int batch = (unsigned int)std::min(end - sample, (uint64_t)DECODE_BATCH);
+			(this->*m_UnpackSamples)(pData, tile, batch);
+			if (m_CalibrateSamples)
+				m_CalibrateSamples(tile, channels, batch, m_CalibOffsets, m_CalibGains);
+			if (sample + batch > m_StoreFrom)
+			{
+				unsigned int skip = (sample < m_StoreFrom) ? (unsigned int)(m_StoreFrom - sample) : 0;
+				StoreSamplesAt(tile + skip * channels, channels, batch - skip,
+					(m_SampleIndex + (sample + skip - m_SampleCount)) % m_UserBufferSizeInSample);
+			}
+			if (head)
+				Decimate(tile, channels, batch, sample, head[1], head);
+			pData += batch * m_PaddedBlockSize;
+			sample += batch;
+		}
 	}
 }
 
 
+/*
+ * Sums count samples of the tile, numbered from sample on, into part and writes out the windows completed.
+ * A window started before part (the first one of a pool task) is left in head instead, NULL: dropped.
+ */
+void CDataEvaluation::Decimate(const int16_t *tile, unsigned int channels, unsigned int count, uint64_t sample, DECIMATION_PART &part, DECIMATION_PART *head) const
+{
+	const unsigned int factor = m_DecimationFactor;
+
+	while (count)
+	{
+		unsigned int offset = (unsigned int)(sample % factor);
+		if (part.samples == 0)
+		{
+			part.window = sample / factor;
+			memset(part.sum, 0, channels * sizeof(part.sum[0]));
+		}
 
+		unsigned int n = std::min(count, factor - offset);
+		m_SumSamples(tile, channels, n, part.sum);
+		tile += n * channels;
+		part.samples += n;
+		sample += n;
+		count -= n;
+
+		// The end of the window
+		if (offset + n == factor)
+		{
+			if (part.samples == factor)
+				EmitDecimated(part);
+			else if (head)
+				*head = part;
+			part.samples = 0;
+		}
+	}
+}
+
+
+// Writes the average of a complete window into the decimated rings, rounded half away from 0
+void CDataEvaluation::EmitDecimated(const DECIMATION_PART &part) const
+{
+	if (part.window < m_EmitFrom)
+		return;
+
+	const int64_t factor = m_DecimationFactor;
+	uint64_t index = part.window % m_DecimationSizeInSample;
+
+	for (int channel = 0; channel < m_ActiveChannelNo; ++channel)
+	{
+		int64_t sum = part.sum[channel];
+		m_DecimationData[channel][index] = (INT16)(sum >= 0 ? (sum + factor / 2) / factor : -((factor / 2 - sum) / factor));
+	}
+}
+
+
+// Adds a part summed by a pool task to the window being summed, in task order
+void CDataEvaluation::MergeDecimated(const DECIMATION_PART &part)
+{
+	if (part.samples == 0)
+		return;
+
+	if (m_DecimationPart.samples == 0)
+		m_DecimationPart = part;
+	else
+	{
+		for (int channel = 0; channel < m_ActiveChannelNo; ++channel)
+			m_DecimationPart.sum[channel] += part.sum[channel];
+		m_DecimationPart.samples += part.samples;
+	}
+
+	if (m_DecimationPart.samples == m_DecimationFactor)
+	{
+		EmitDecimated(m_DecimationPart);
+		m_DecimationPart.samples = 0;
+	}
+}
 
 
 void CDataEvaluation::Trigger(int channel, INT16 data)
@@ -529,23 +1041,23 @@ bool CDataEvaluation::SetParams(unsigned int bits, uint32_t channelMask, unsigne
 void CDataEvaluation::SetCalibratedMode(bool calibrated) 
 { 
 	m_Calibrated = calibrated;
-	if (!m_Calibrated)
+}
+
+
+bool CDataEvaluation::SetCalibration(const INT16 *offsets, const double *gains)
+{
+	for (int i = 0; gains && i < CHANNEL_NUM; ++i)
 	{
-		INT16 max_value = 16383;
-		switch (m_Bits)
-		{
-			case 8:
-				max_value = 255;
-				break;
-			case 12:
-				max_value = 4095;
-				break;
-		}
-		for (int i = 0; i < CHANNEL_NUM; ++i)
-		{
-			m_ChannelOffsets[i] = max_value;
-		}
+		if (!(gains[i] >= -8.0 && gains[i] < 8.0))
+			return false;
+	}
+
+	for (int i = 0; i < CHANNEL_NUM; ++i)
+	{
+		m_ChannelOffsets[i] = offsets ? offsets[i] : 0;
+		m_ChannelGains[i] = gains ? (INT16)std::min(floor(gains[i] * (1 << CALIB_GAIN_BITS) + 0.5), 32767.0) : (1 << CALIB_GAIN_BITS);
 	}
+	return true;
 }
 
 
@@ -574,38 +1086,33 @@ void CDataEvaluation::SetTrigger(ADT_TRIGGERINFO *triggerInfo)
 }
 
 
-bool CDataEvaluation::SetupCalibrationData(CAPDClient *client, int streamNo)
+bool CDataEvaluation::SetupCalibrationData(CAPDClient *client)
 {
 	if (m_Bits != 8 && m_Bits != 12 && m_Bits != 14)
 		return false;
 
-	INT16 dacOffsets[32];
-	int channelIndex = (streamNo -1) * 8;
+	INT16 dacOffsets[CHANNEL_NUM];
 	// Retrieves the dac offsets from the calibration table.
-	bool retVal = RetrieveDACOffsets_01mV(client, dacOffsets, channelIndex, 8);
+	bool retVal = RetrieveDACOffsets_01mV(client, dacOffsets, 0, CHANNEL_NUM);
 	if (!retVal) return retVal; // Error reading calibration data
 	// Set dac offsets in the hw, using SetDACOffset()
-	retVal = SetDACOffset(client, dacOffsets, channelIndex, 8);
+	retVal = SetDACOffset(client, dacOffsets, 0, CHANNEL_NUM);
 	if (!retVal) return retVal; // Error while set DAC data
 
 	// Retrieve ADC offsets from the non-volative store, normalize them, according to the actual bitnumber.
-	INT16 adcOffsets[32];
-	retVal = RetrieveADCOffsets(client, adcOffsets, channelIndex, 8);
+	INT16 adcOffsets[CHANNEL_NUM];
+	retVal = RetrieveADCOffsets(client, adcOffsets, 0, CHANNEL_NUM);
 	if (!retVal) return retVal; // Error while retrieving adc offsets
 	
 	if (m_Bits < 14)
 	{
-		for (int i = 0; i < 8; i++)
+		for (int i = 0; i < CHANNEL_NUM; i++)
 		{
 			adcOffsets[i] = adcOffsets[i] >> (14 - m_Bits);
 		}
 	}
-	// Pack normalized adc offsets, according to the channel mask.
-	FillMap();
-	for (int i = 0; i < 8; i++)
-	{
-		m_ChannelOffsets[i] = adcOffsets[i];
-	}
+	// The gains are kept, the packing according to the channel mask is done at the start.
+	memcpy(m_ChannelOffsets, adcOffsets, sizeof(m_ChannelOffsets));
 
 	return retVal;
 }
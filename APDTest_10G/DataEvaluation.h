@@ -3,21 +3,29 @@
 #define __DATAEVALUATION_H__
 
 #include <list>
+#include <vector>
 
 #include "CamClient.h"
 #include "TypeDefs.h"
 
 #include "LnxClasses.h"
 #include "SysLnxClasses.h"
+#include "DataUnpack.h"
+#include "DecodePool.h"
 
 #define MAX_PACKET_LOSS 50
+#define DEF_REORDER_WINDOW 32   // Packets a packet may arrive ahead of its predecessors
+#define MAX_REORDER_WINDOW 1024
+#define DECODE_BATCH 256        // Samples unpacked together before they are written to the channel buffers
+#define DECODE_TASK_SAMPLES 2048 // Samples of a decode pool task, at least
+#define MAX_DECIMATION 65536    // The sum of a window fits in 32 bits
 
 void EvaluateData(unsigned char* pData, int length, int noofSample, UCHAR channelMask, int bits, int channelOffset);
 
 #define CHANNEL_NUM    32
 class CTriggerManager;
 
-class CDataEvaluation : public Thread
+class CDataEvaluation : public Thread, public CDecodeJob
 {
 	friend class CTriggerManager;
 
@@ -25,9 +33,25 @@ private:
 	CDataEvaluation(const CDataEvaluation&);
 	CDataEvaluation& operator=(const CDataEvaluation&);
 protected:
+	bool ProcessNotification();
 	void ProcessData();
+	bool IsHeld(uint64_t packetCounter) const;
+	void ProcessHeld();
+	bool AdvanceWindow(uint64_t packetCounter);
+	void InsertEmptyPackets(uint64_t count);
 	void ProcessFrame(const CC_STREAMHEADER *header, const unsigned char *pFrame, unsigned int packetNo);
-	void ProcessBlock(unsigned char *pData);
+	void DecodeBlocks(const unsigned char *pData, unsigned int count);
+	template <unsigned int groups> void ProcessBlocks(const unsigned char *pData, unsigned int count);
+	template <unsigned int groups> void UnpackSamples(const unsigned char *pData, int16_t *tile, unsigned int count) const;
+	void StoreSamples(const int16_t *tile, unsigned int channels, unsigned int count);
+	void StoreSamplesAt(const int16_t *tile, unsigned int channels, unsigned int count, uint64_t index) const;
+	void DecodeQueued();
+	void RunTask(unsigned int task);
+	struct DECIMATION_PART;
+	void Decimate(const int16_t *tile, unsigned int channels, unsigned int count, uint64_t sample, DECIMATION_PART &part, DECIMATION_PART *head) const;
+	void EmitDecimated(const DECIMATION_PART &part) const;
+	void MergeDecimated(const DECIMATION_PART &part);
+	bool TriggerArmed() const;
 	void Trigger(int channel, INT16 data);
 	void FillMap();
 
@@ -38,6 +62,11 @@ public:
 	virtual ~CDataEvaluation();
 	unsigned int Handler();
 
+	// Decoding driven by a reactor thread instead of Handler()
+	void BeginProcessing();
+	bool ReactorStep();
+	void EndProcessing();
+
 	inline ULONGLONG GetSampleCount()
 	{
 		return m_SampleCount;
@@ -48,18 +77,48 @@ public:
 		return m_SampleIndex;
 	};
 
+	// Decimated samples so far, and the index of the next one in the decimated ring
+	inline ULONGLONG GetDecimatedCount()
+	{
+		return m_DecimatedCount;
+	};
+
+	inline ULONGLONG GetDecimatedIndex()
+	{
+		return m_DecimationSizeInSample ? m_DecimatedCount % m_DecimationSizeInSample : 0;
+	};
+
 	inline void SetStopAt(ULONGLONG stopAt)
 	{
 		m_StopAt = stopAt;
 	}
 
 	bool SetParams(unsigned int bits, uint32_t channelMask, unsigned int packetSize);
-	inline void SetBuffers(unsigned char* srcBuffer, unsigned char* workBuffer, unsigned char* userBuffer, uint64_t userBufferSize) 
+	// Unpack kernels used from the next BeginProcessing, default: the best the CPU supports
+	void SetUnpackIsa(UNPACK_ISA isa) { m_UnpackIsa = isa; };
+	// Non temporal stores into the channel buffers, for buffers much larger than the cache that are read
+	// long after they are written. Only full ADC blocks with the SSE4.1 or AVX2 kernels. Default: off.
+	void SetStreamStores(bool stream) { m_StreamStores = stream; };
+	// Decodes the packets of a notification as tasks of pool, NULL: on the thread of the decoder.
+	// Not while a software trigger can fire, the samples are checked in order then.
+	void SetDecodePool(CDecodePool *pool);
+	// Averages of factor (2..MAX_DECIMATION) consecutive samples into a second ring, bufferSize bytes per active
+	// channel (rounded down to whole samples), the active channels one after the other. factor < 2 or no buffer: off.
+	// Takes effect at the next start.
+	inline void SetDecimation(unsigned int factor, unsigned char *buffer, uint64_t bufferSize)
+	{
+		m_DecimationFactor = factor;
+		m_DecimationBuffer = buffer;
+		m_DecimationBufferSize = bufferSize / sizeof(INT16) * sizeof(INT16);
+	};
+	// userBufferSize is the ring of one channel in bytes. interleaved: userBuffer holds the samples one after the
+	// other, each with the values of the active channels together (m_ActiveChannelNo times userBufferSize in all).
+	inline void SetBuffers(unsigned char* workBuffer, unsigned char* userBuffer, uint64_t userBufferSize, bool interleaved = false) 
 	{
-		m_SrcBuffer = srcBuffer;
 		m_WorkBuffer = workBuffer;
 		m_UserBuffer = userBuffer;
 		m_UserBufferSize = userBufferSize;
+		m_Interleaved = interleaved;
 	};
 
 	inline void SetServer(CAPDServer *server)
@@ -82,18 +141,35 @@ public:
 		m_pUserNotificationSignal = userNotification;
 	};
 
+	// In calibrated mode the decoder stores (value - offset) * gain. Offsets in ADC counts at the resolution
+	// of the stream, gains within +-8, a negative gain inverts the signal. Per channel of the stream (0..31),
+	// NULL: 0 offsets, unit gains. Takes effect at the next start.
 	void SetCalibratedMode(bool calibrated);
+	bool SetCalibration(const INT16 *offsets, const double *gains);
 	inline void DisableTrigger()
 	{
 		m_Triggered = true;
 	};
 
+	// Takes effect at the next start. 0: packets must arrive in order, gaps are filled at once.
+	void SetReorderWindow(unsigned int window)
+	{
+		m_ReorderWindow = window;
+	};
+
 	void SetTrigger(ADT_TRIGGERINFO *triggerInfo);
 	bool ContinuityError() const
 	{
 		return m_ContinuityError;
 	}
 
+	// Packets missing from the packet counter sequence, packets arrived after their place was filled,
+	// packets overwritten before processing, most packets waiting for processing
+	uint64_t GetLostPackets() const { return m_LostPackets; };
+	uint64_t GetLatePackets() const { return m_LatePackets; };
+	uint64_t GetOverruns() const { return m_Overruns; };
+	unsigned int GetMaxBacklog() const { return m_MaxNoofBlocks; };
+
 	void SetDumpFile(FILE *d)
 	{
 		if (dumpFile)
@@ -120,22 +196,35 @@ protected:
 public:
 	void DoTrigger();
 
-	// The SetupCalibrationData must be called after the SetParams, becaues it uses the bits and channelmask.
-	// The routin reads the appropiate calibration data from theADC board, normalizes them (according to bit number) and arrenges it, according to channel mask.
-	// The streamNo is 1..4
-	bool SetupCalibrationData(CAPDClient *client, int streamNo);
+	// The SetupCalibrationData must be called after the SetParams, becaues it uses the bits.
+	// The routin reads the calibration data of the 32 channels from the ADC board and normalizes them (according to bit number).
+	bool SetupCalibrationData(CAPDClient *client);
 protected:
 	CEvent *m_pDataNotificationSignal;
 	CEvent *m_pUserNotificationSignal;
 	unsigned int m_PacketNo;
 
 public:
+	// Buffer of the active channel ch (counting the active ones only), NULL past them
 	const INT16* GetChannelData(uint8_t ch) const
 	{
-		if (ch > CHANNEL_NUM)
+		if (ch >= CHANNEL_NUM)
 			return NULL;
 		return m_ChannelData[ch];
 	}
+	// The interleaved ring and the number of values of a sample in it, NULL if the buffers are per channel
+	const INT16* GetInterleavedData(unsigned int *stride) const
+	{
+		*stride = m_Interleaved ? m_ActiveChannelNo : 0;
+		return m_Interleaved ? reinterpret_cast<const INT16*>(m_UserBuffer) : NULL;
+	}
+	// Decimated ring of the active channel ch, NULL past the active channels or without decimation
+	const INT16* GetDecimatedData(uint8_t ch) const
+	{
+		if (ch >= CHANNEL_NUM)
+			return NULL;
+		return m_DecimationData[ch];
+	}
 
 protected:
 	INT16 *m_ChannelData[CHANNEL_NUM];
@@ -144,16 +233,15 @@ protected:
 
 protected:
 	CAPDServer *m_Server;
-	unsigned char* m_SrcBuffer;
-	unsigned int m_WritePtr;	// indicates the where have to write: (m_TempBuffer+m_WritePtr)
-	int m_DataLength;			// The amount of data to be processed.
+	int m_DataLength;			// The beginning of a sample straddling two packets, in m_WorkBuffer
 	bool m_Running;
 	bool m_Calibrated;
 
-	unsigned char* m_WorkBuffer;
+	unsigned char* m_WorkBuffer; // Stitch buffer, one padded sample
 
 	unsigned char *m_UserBuffer;	// points to the 0. channel
-	uint64_t m_UserBufferSize;	// per channel
+	uint64_t m_UserBufferSize;	// per channel, the buffer holds m_ActiveChannelNo of them
+	bool m_Interleaved;	// Sample-major user buffer, m_ChannelData is not used
 
 	unsigned int m_Bits;		// bit resolution. Values: 8,12,14
 	uint32_t m_ChannelMask;
@@ -162,13 +250,90 @@ protected:
 	int m_BlockSize;			// Size of one sample.
 	int m_PaddedBlockSize;			// Size of one sample padded to OCTET size
 	UINT16 m_Mask;		// Used in data decoding. Its value can be 0x3FFF (14 bit), 0x0FFF (12 bit) or 0x00FF (8 bit)
-
-	// The channel offset values in packed format. E.g. If 1st and 3rd channel are used, the m_ChannelOffsets[0] is for 1st, m_ChannelOffsets[1] is for 3rd.
+	UNPACK_ISA m_UnpackIsa;
+	UNPACK_GROUPS m_UnpackGroups;	// Unpack kernel of full ADC blocks for m_Bits
+	UNPACK_OFFSET m_UnpackTable[CHANNEL_NUM];	// Where the values of the active channels are in a sample block
+	void (CDataEvaluation::*m_ProcessBlocks)(const unsigned char *pData, unsigned int count);	// ProcessBlocks specialized for m_ChannelMask
+	void (CDataEvaluation::*m_UnpackSamples)(const unsigned char *pData, int16_t *tile, unsigned int count) const;	// UnpackSamples specialized for m_ChannelMask
+	STORE_SAMPLES m_StoreSamples;
+	bool m_StreamStores;	// Non temporal stores into the channel buffers
+
+	/*
+	 * Decode pool. The sample blocks of the packets are only queued while ProcessData() goes through them,
+	 * a sample straddling two packets is stitched into m_StitchBuffer in packet order. The runs are decoded
+	 * as tasks on any thread before the packets are released, each sample goes to the place its number
+	 * gives, so the result does not depend on the threads.
+	 */
+	struct DECODE_RUN
+	{
+		const unsigned char *data;   // NULL: stitched, at stitch in m_StitchBuffer
+		size_t               stitch;
+		unsigned int         blocks;
+		uint64_t             sample; // Number of the first sample
+	};
+	CDecodePool *m_DecodePool;
+	bool m_Parallel;	// The packets of this ProcessData() are queued for the pool
+	std::vector<DECODE_RUN> m_Runs;
+	std::vector<unsigned char> m_StitchBuffer;
+	std::vector<unsigned int> m_Tasks;	// First run of each task, and the end
+	uint64_t m_QueuedSamples;	// Sample number after the last queued one
+	uint64_t m_DecodeLimit;	// Samples from this number on are not decoded (stop point)
+	uint64_t m_StoreFrom;	// Samples before this number are not stored, a later one of the batch takes their place
+	CEvent *m_DecodeDone;
+	std::vector<unsigned char> m_EmptyFrame;	// Payload of a lost packet
+
+	/*
+	 * Decimation. Decimated sample w is the average of samples w * m_DecimationFactor on, taken from the tile
+	 * of the decoder. A pool task writes the windows it holds whole, the window it starts in (head) and ends
+	 * in (tail) are summed in parts and merged in task order on the decoder thread.
+	 */
+	struct DECIMATION_PART
+	{
+		int32_t      sum[CHANNEL_NUM];
+		uint64_t     window;  // Number of the decimated sample
+		unsigned int samples; // Summed so far, 0: empty
+	};
+	unsigned int m_DecimationFactor;	// < 2: off
+	unsigned char *m_DecimationBuffer;
+	uint64_t m_DecimationBufferSize;	// per channel
+	ULONGLONG m_DecimationSizeInSample;
+	INT16 *m_DecimationData[CHANNEL_NUM];	// NULL: not decimated
+	ULONGLONG m_EmitFrom;	// Decimated samples before this number are not written, as m_StoreFrom
+	SUM_SAMPLES m_SumSamples;
+	DECIMATION_PART m_DecimationPart;	// The window being summed
+	std::vector<DECIMATION_PART> m_DecimationParts;	// Head and tail of each pool task
+	ULONGLONG m_DecimatedCount;
+
+	// The calibration of the channels of the stream, m_ChannelOffsets[i] is for the channel i
 	INT16 m_ChannelOffsets[CHANNEL_NUM]; 
+	INT16 m_ChannelGains[CHANNEL_NUM];	// CALIB_GAIN_BITS fixed point
+	// The same in packed format, according to the channel mask. E.g. If 1st and 3rd channel are used, m_CalibOffsets[0] is for 1st, m_CalibOffsets[1] is for 3rd.
+	// Repeated for 8 samples, as the calibration kernels take them.
+	int16_t m_CalibOffsets[UNPACK_GROUP_CHANNELS * CHANNEL_NUM];
+	int16_t m_CalibGains[UNPACK_GROUP_CHANNELS * CHANNEL_NUM];
+	CALIBRATE_SAMPLES m_CalibrateSamples;	// NULL: not calibrated mode
 
 	unsigned int m_MaxNoofBlocks;
 	uint64_t     m_ExpectedPacketCounter;
 	bool m_ContinuityError;
+	uint64_t     m_LostPackets;
+	uint64_t     m_LatePackets;
+	uint64_t     m_Overruns;
+
+	/*
+	 * Reorder window. A packet ahead of m_ExpectedPacketCounter stays in the storage of the server and is
+	 * held here, in the slot of its packet counter, until the packets before it arrive or the window is full.
+	 */
+	struct REORDER_SLOT
+	{
+		bool         held;
+		uint64_t     packetCounter;
+		unsigned int packetNo;     // Where the packet is in the server
+	};
+	unsigned int m_ReorderWindow;
+	std::vector<REORDER_SLOT> m_ReorderSlots;
+	unsigned int m_HeldPackets;
+	uint64_t     m_HighestHeld;
 	ULONGLONG m_SampleCount;
 	ULONGLONG m_SampleIndex;  // Index in the ring buffer, where the data must be placed.
 	ULONGLONG m_UserBufferSizeInSample;
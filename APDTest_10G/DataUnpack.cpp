@@ -0,0 +1,639 @@
+#include <algorithm>
+#include <stdio.h>
+
+#include "DataUnpack.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UNPACK_X86
+#endif
+
+#define GET_BYTE(p)  (*((uint8_t*)(p)))
+
+/* ********** Scalar unpacking ********** */
+
+static inline uint16_t GetData8(const unsigned char *pData, int offset)
+{
+	int byteOffset = offset >> 3; // / 8
+	uint16_t data = GET_BYTE(pData + byteOffset);
+	return data;
+}
+
+
+static inline uint16_t GetData12(const unsigned char *pData, int offset)
+{
+	int byteOffset = offset >> 3; // / 8
+	uint16_t data;
+
+	if (offset % 8 == 0)
+		data = (GET_BYTE(pData + byteOffset) << 4) | (GET_BYTE(pData + byteOffset + 1) >> 4);
+	else
+		data = (GET_BYTE(pData + byteOffset) << 8) | GET_BYTE(pData + byteOffset + 1);
+	return data & 0x0FFF;
+}
+
+
+static inline uint16_t GetData14(const unsigned char *pData, int offset)
+{
+	int byteOffset = offset >> 3; // / 8
+	int bitOffset = offset & 0x07; // % 8;
+	uint16_t data;
+
+	if (bitOffset == 0)
+		data = (GET_BYTE(pData + byteOffset) <<  6) | (GET_BYTE(pData + byteOffset + 1) >> 2);
+	else if (bitOffset == 6)
+		data = (GET_BYTE(pData + byteOffset) << 12) | (GET_BYTE(pData + byteOffset + 1) << 4) | (GET_BYTE(pData + byteOffset + 2) >> 4);
+	else if (bitOffset == 4)
+		data = (GET_BYTE(pData + byteOffset) << 10) | (GET_BYTE(pData + byteOffset + 1) << 2) | (GET_BYTE(pData + byteOffset + 2) >> 6);
+	else if (bitOffset == 2)
+		data = (GET_BYTE(pData + byteOffset) <<  8) | GET_BYTE(pData + byteOffset + 1);
+	else
+	{
+		data = 0;
+		fprintf(stderr, "\n\n\nWrong bitlength!!!\n\n\n");
+	}
+	return data & 0x3FFF;
+}
+
+
+unsigned int FillUnpackTable(uint32_t channelMask, unsigned int bits, UNPACK_OFFSET *table)
+{
+	unsigned int channels = 0;
+	unsigned int offset = 0; // Bits from the start of the sample block
+
+	for (unsigned int channel = 0; channel < 32; ++channel)
+	{
+		if (channelMask & (1U << channel))
+		{
+			/*
+			 * The window ends with the last byte of the value, so it does not reach beyond the group. In the first
+			 * bytes it starts at 0, the block is padded to 8 bytes.
+			 */
+			unsigned int lastByte = (offset + bits - 1) / 8;
+			unsigned int byteOffset = (lastByte >= 2) ? lastByte - 2 : 0;
+			table[channels].byteOffset = byteOffset;
+			table[channels].shift = (byteOffset + 3) * 8 - (offset + bits);
+			++channels;
+			offset += bits;
+		}
+
+		// Padding to byte boundary after each group
+		if (channel % UNPACK_GROUP_CHANNELS == UNPACK_GROUP_CHANNELS - 1 && offset % 8)
+			offset += 8 - offset % 8;
+	}
+
+	return channels;
+}
+
+
+unsigned int GetFullGroups(uint32_t channelMask)
+{
+	unsigned int groups = 0;
+	for (unsigned int group = 0; group < 4; ++group)
+	{
+		uint32_t groupMask = (channelMask >> (group * UNPACK_GROUP_CHANNELS)) & 0xFF;
+		if (groupMask == 0xFF)
+			++groups;
+		else if (groupMask != 0)
+			return 0;
+	}
+	return groups;
+}
+
+
+/*
+ * A full group takes bits bytes.
+ */
+static void UnpackGroups8Scalar(const unsigned char *pData, int16_t *pSamples, unsigned int groups)
+{
+	for (unsigned int i = 0; i < groups * UNPACK_GROUP_CHANNELS; ++i)
+		pSamples[i] = (int16_t)GetData8(pData, i * 8);
+}
+
+
+static void UnpackGroups12Scalar(const unsigned char *pData, int16_t *pSamples, unsigned int groups)
+{
+	for (unsigned int i = 0; i < groups * UNPACK_GROUP_CHANNELS; ++i)
+		pSamples[i] = (int16_t)GetData12(pData, i * 12);
+}
+
+
+static void UnpackGroups14Scalar(const unsigned char *pData, int16_t *pSamples, unsigned int groups)
+{
+	for (unsigned int i = 0; i < groups * UNPACK_GROUP_CHANNELS; ++i)
+		pSamples[i] = (int16_t)GetData14(pData, i * 14);
+}
+
+
+#ifdef UNPACK_X86
+/* ********** SSE4.1 and AVX2 unpacking ********** */
+
+/*
+ * A group is read by two 8 byte loads into one register, the second one overlapping the first, so nothing is
+ * read beyond the group: 12 bit: bytes 0..7 and 4..11, 14 bit: bytes 0..7 and 6..13. A shuffle gathers the
+ * bytes of each value big endian into its lane, a shift per lane (a multiplication without AVX2) aligns it.
+ *
+ * 12 bit: value k is in bytes 3k/2 and 3k/2 + 1, at bit 4 of the first byte if k is odd. 16 bit lanes,
+ * x16 for the odd lanes then >> 4.
+ */
+static const int8_t g_Shuffle12[16] = {1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 12, 7, 14, 13, 15, 14};
+static const int16_t g_Multiplier12[8] = {1, 16, 1, 16, 1, 16, 1, 16};
+
+/*
+ * 14 bit: value k starts in byte 14k/8 at bit 0, 6, 4, 2 and may reach a third byte. 32 bit lanes of the three
+ * bytes, the value ends at bit 10 after shifting left by its bit offset. Values 0..3 and 4..7 have the same
+ * bit offsets.
+ */
+static const int8_t g_Shuffle14Low[16] = {2, 1, 0, -1, 3, 2, 1, -1, 5, 4, 3, -1, 7, 6, 5, -1};
+static const int8_t g_Shuffle14High[16] = {11, 10, 7, -1, 12, 11, 10, -1, 14, 13, 12, -1, -1, 15, 14, -1};
+static const int32_t g_Multiplier14[4] = {1, 64, 16, 4};
+static const int32_t g_Shift14[8] = {10, 4, 6, 8, 10, 4, 6, 8};
+
+__attribute__((target("sse4.1")))
+static inline __m128i LoadGroup(const unsigned char *pData, unsigned int second)
+{
+	return _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pData)),
+		_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pData + second)));
+}
+
+
+__attribute__((target("sse4.1")))
+static void UnpackGroups8Sse41(const unsigned char *pData, int16_t *pSamples, unsigned int groups)
+{
+	for (unsigned int i = 0; i < groups; ++i)
+	{
+		__m128i data = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pData + i * 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pSamples + i * UNPACK_GROUP_CHANNELS), _mm_cvtepu8_epi16(data));
+	}
+}
+
+
+__attribute__((target("sse4.1")))
+static void UnpackGroups12Sse41(const unsigned char *pData, int16_t *pSamples, unsigned int groups)
+{
+	const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g_Shuffle12));
+	const __m128i multiplier = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g_Multiplier12));
+
+	for (unsigned int i = 0; i < groups; ++i)
+	{
+		__m128i values = _mm_shuffle_epi8(LoadGroup(pData + i * 12, 4), shuffle);
+		values = _mm_srli_epi16(_mm_mullo_epi16(values, multiplier), 4);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pSamples + i * UNPACK_GROUP_CHANNELS), values);
+	}
+}
+
+
+__attribute__((target("sse4.1")))
+static void UnpackGroups14Sse41(const unsigned char *pData, int16_t *pSamples, unsigned int groups)
+{
+	const __m128i shuffleLow = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g_Shuffle14Low));
+	const __m128i shuffleHigh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g_Shuffle14High));
+	const __m128i multiplier = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g_Multiplier14));
+	const __m128i mask = _mm_set1_epi32(0x3FFF);
+
+	for (unsigned int i = 0; i < groups; ++i)
+	{
+		__m128i group = LoadGroup(pData + i * 14, 6);
+		__m128i low = _mm_mullo_epi32(_mm_shuffle_epi8(group, shuffleLow), multiplier);
+		__m128i high = _mm_mullo_epi32(_mm_shuffle_epi8(group, shuffleHigh), multiplier);
+		low = _mm_and_si128(_mm_srli_epi32(low, 10), mask);
+		high = _mm_and_si128(_mm_srli_epi32(high, 10), mask);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pSamples + i * UNPACK_GROUP_CHANNELS), _mm_packus_epi32(low, high));
+	}
+}
+
+
+/*
+ * Two groups per register, the rest by the SSE4.1 code.
+ */
+__attribute__((target("avx2")))
+static void UnpackGroups8Avx2(const unsigned char *pData, int16_t *pSamples, unsigned int groups)
+{
+	unsigned int i = 0;
+	for (; i + 2 <= groups; i += 2)
+	{
+		__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + i * 8));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(pSamples + i * UNPACK_GROUP_CHANNELS), _mm256_cvtepu8_epi16(data));
+	}
+	if (i < groups)
+		UnpackGroups8Sse41(pData + i * 8, pSamples + i * UNPACK_GROUP_CHANNELS, groups - i);
+}
+
+
+__attribute__((target("avx2")))
+static void UnpackGroups12Avx2(const unsigned char *pData, int16_t *pSamples, unsigned int groups)
+{
+	const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(g_Shuffle12)));
+	const __m256i multiplier = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(g_Multiplier12)));
+
+	unsigned int i = 0;
+	for (; i + 2 <= groups; i += 2)
+	{
+		__m256i values = _mm256_inserti128_si256(_mm256_castsi128_si256(LoadGroup(pData + i * 12, 4)), LoadGroup(pData + i * 12 + 12, 4), 1);
+		values = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_shuffle_epi8(values, shuffle), multiplier), 4);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(pSamples + i * UNPACK_GROUP_CHANNELS), values);
+	}
+	if (i < groups)
+		UnpackGroups12Sse41(pData + i * 12, pSamples + i * UNPACK_GROUP_CHANNELS, groups - i);
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i UnpackGroup14Avx2(const unsigned char *pData, __m256i shuffle, __m256i shift, __m256i mask)
+{
+	__m256i values = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(LoadGroup(pData, 6)), shuffle);
+	return _mm256_and_si256(_mm256_srlv_epi32(values, shift), mask);
+}
+
+
+__attribute__((target("avx2")))
+static void UnpackGroups14Avx2(const unsigned char *pData, int16_t *pSamples, unsigned int groups)
+{
+	const __m256i shuffle = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(g_Shuffle14Low))),
+		_mm_loadu_si128(reinterpret_cast<const __m128i*>(g_Shuffle14High)), 1);
+	const __m256i shift = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g_Shift14));
+	const __m256i mask = _mm256_set1_epi32(0x3FFF);
+
+	unsigned int i = 0;
+	for (; i + 2 <= groups; i += 2)
+	{
+		__m256i first = UnpackGroup14Avx2(pData + i * 14, shuffle, shift, mask);
+		__m256i second = UnpackGroup14Avx2(pData + i * 14 + 14, shuffle, shift, mask);
+		// The pack works per 128 bit lane: first 0..3, second 0..3, first 4..7, second 4..7
+		__m256i values = _mm256_permute4x64_epi64(_mm256_packus_epi32(first, second), 0xD8);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(pSamples + i * UNPACK_GROUP_CHANNELS), values);
+	}
+	if (i < groups)
+		UnpackGroups14Sse41(pData + i * 14, pSamples + i * UNPACK_GROUP_CHANNELS, groups - i);
+}
+#endif
+
+
+static void StoreSamplesScalar(const int16_t *tile, unsigned int channels, unsigned int count, int16_t *const *channelData, uint64_t index, bool)
+{
+	for (unsigned int channel = 0; channel < channels; ++channel)
+	{
+		int16_t *dst = channelData[channel] + index;
+		for (unsigned int sample = 0; sample < count; ++sample)
+			dst[sample] = tile[sample * channels + channel];
+	}
+}
+
+
+static inline int16_t CalibrateValue(int16_t value, int16_t offset, int16_t gain)
+{
+	int32_t diff = std::min(std::max((int32_t)value - offset, -32768), 32767);
+	int32_t calibrated = (diff * gain + (1 << (CALIB_GAIN_BITS - 1))) >> CALIB_GAIN_BITS;
+	return (int16_t)std::min(std::max(calibrated, -32768), 32767);
+}
+
+
+static void CalibrateSamplesScalar(int16_t *tile, unsigned int channels, unsigned int count, const int16_t *offsets, const int16_t *gains)
+{
+	for (unsigned int sample = 0; sample < count; ++sample, tile += channels)
+	{
+		for (unsigned int channel = 0; channel < channels; ++channel)
+			tile[channel] = CalibrateValue(tile[channel], offsets[channel], gains[channel]);
+	}
+}
+
+
+// From channel first on
+static void SumSamplesScalar(const int16_t *tile, unsigned int channels, unsigned int count, int32_t *sums, unsigned int first)
+{
+	for (unsigned int channel = first; channel < channels; ++channel)
+	{
+		int32_t sum = sums[channel];
+		for (unsigned int sample = 0; sample < count; ++sample)
+			sum += tile[sample * channels + channel];
+		sums[channel] = sum;
+	}
+}
+
+
+static void SumSamplesScalar(const int16_t *tile, unsigned int channels, unsigned int count, int32_t *sums)
+{
+	SumSamplesScalar(tile, channels, count, sums, 0);
+}
+
+
+#ifdef UNPACK_X86
+#define STORE_RUN 256 // Samples of a channel collected for the streaming stores
+
+// Transposes 8 samples of 8 channels (rows channels values apart) into 8 samples of each channel
+__attribute__((target("sse4.1")))
+static inline void Transpose8x8(const int16_t *rows, unsigned int channels, __m128i *columns)
+{
+	__m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + 0 * channels));
+	__m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + 1 * channels));
+	__m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + 2 * channels));
+	__m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + 3 * channels));
+	__m128i r4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + 4 * channels));
+	__m128i r5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + 5 * channels));
+	__m128i r6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + 6 * channels));
+	__m128i r7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + 7 * channels));
+
+	__m128i a0 = _mm_unpacklo_epi16(r0, r1);
+	__m128i a1 = _mm_unpackhi_epi16(r0, r1);
+	__m128i a2 = _mm_unpacklo_epi16(r2, r3);
+	__m128i a3 = _mm_unpackhi_epi16(r2, r3);
+	__m128i a4 = _mm_unpacklo_epi16(r4, r5);
+	__m128i a5 = _mm_unpackhi_epi16(r4, r5);
+	__m128i a6 = _mm_unpacklo_epi16(r6, r7);
+	__m128i a7 = _mm_unpackhi_epi16(r6, r7);
+
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+	columns[0] = _mm_unpacklo_epi64(b0, b4);
+	columns[1] = _mm_unpackhi_epi64(b0, b4);
+	columns[2] = _mm_unpacklo_epi64(b1, b5);
+	columns[3] = _mm_unpackhi_epi64(b1, b5);
+	columns[4] = _mm_unpacklo_epi64(b2, b6);
+	columns[5] = _mm_unpackhi_epi64(b2, b6);
+	columns[6] = _mm_unpacklo_epi64(b3, b7);
+	columns[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+
+/*
+ * Channels in eights, 8 samples of 8 channels are transposed in registers and each channel gets a 16 byte
+ * store. The samples before the first 16 byte boundary and after the last one are written one by one. All
+ * channel buffers must be at the same place relative to 16 bytes, else everything goes one by one.
+ * Streaming stores go out one channel after the other, STORE_RUN samples of a channel at once: the write
+ * combining buffers of the CPU are few, interleaving the channels would flush them half full.
+ */
+__attribute__((target("sse4.1")))
+static void StoreSamplesSse41(const int16_t *tile, unsigned int channels, unsigned int count, int16_t *const *channelData, uint64_t index, bool stream)
+{
+	uintptr_t phase = reinterpret_cast<uintptr_t>(channelData[0] + index) & 15;
+	bool aligned = (channels % UNPACK_GROUP_CHANNELS == 0) && (phase % sizeof(int16_t) == 0);
+	for (unsigned int channel = 1; aligned && channel < channels; ++channel)
+		aligned = (reinterpret_cast<uintptr_t>(channelData[channel] + index) & 15) == phase;
+
+	unsigned int head = aligned ? ((16 - phase) & 15) / sizeof(int16_t) : count;
+	if (head >= count)
+	{
+		StoreSamplesScalar(tile, channels, count, channelData, index, false);
+		return;
+	}
+	unsigned int end = head + ((count - head) & ~7U);
+
+	StoreSamplesScalar(tile, channels, head, channelData, index, false);
+
+	for (unsigned int group = 0; group < channels; group += UNPACK_GROUP_CHANNELS)
+	{
+		for (unsigned int run = head; run < end; run += STORE_RUN)
+		{
+			unsigned int runEnd = std::min(run + STORE_RUN, end);
+			__m128i runs[UNPACK_GROUP_CHANNELS][STORE_RUN / 8];
+			for (unsigned int sample = run; sample < runEnd; sample += 8)
+			{
+				__m128i columns[UNPACK_GROUP_CHANNELS];
+				Transpose8x8(tile + sample * channels + group, channels, columns);
+				for (unsigned int i = 0; i < UNPACK_GROUP_CHANNELS; ++i)
+				{
+					if (stream)
+						runs[i][(sample - run) / 8] = columns[i];
+					else
+						_mm_store_si128(reinterpret_cast<__m128i*>(channelData[group + i] + index + sample), columns[i]);
+				}
+			}
+			for (unsigned int i = 0; stream && i < UNPACK_GROUP_CHANNELS; ++i)
+			{
+				__m128i *dst = reinterpret_cast<__m128i*>(channelData[group + i] + index + run);
+				for (unsigned int v = 0; v < (runEnd - run) / 8; ++v)
+					_mm_stream_si128(dst + v, runs[i][v]);
+			}
+		}
+	}
+
+	StoreSamplesScalar(tile + end * channels, channels, count - end, channelData, index + end, false);
+
+	// The streaming stores are weakly ordered, they must be visible before the sample index moves on
+	if (stream)
+		_mm_sfence();
+}
+
+
+// The tile is taken as one run of values, 8 samples at a time. The products are 32 bits, as in CalibrateValue.
+__attribute__((target("sse4.1")))
+static void CalibrateSamplesSse41(int16_t *tile, unsigned int channels, unsigned int count, const int16_t *offsets, const int16_t *gains)
+{
+	const __m128i round = _mm_set1_epi32(1 << (CALIB_GAIN_BITS - 1));
+	unsigned int period = UNPACK_GROUP_CHANNELS * channels;
+	unsigned int total = count * channels;
+
+	for (unsigned int first = 0; first < total; first += period)
+	{
+		int16_t *values = tile + first;
+		unsigned int n = std::min(period, total - first);
+		unsigned int i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+			__m128i offset = _mm_loadu_si128(reinterpret_cast<const __m128i*>(offsets + i));
+			__m128i gain = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gains + i));
+			__m128i diff = _mm_subs_epi16(value, offset);
+			__m128i low = _mm_mullo_epi16(diff, gain);
+			__m128i high = _mm_mulhi_epi16(diff, gain);
+			__m128i p0 = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(low, high), round), CALIB_GAIN_BITS);
+			__m128i p1 = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(low, high), round), CALIB_GAIN_BITS);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), _mm_packs_epi32(p0, p1));
+		}
+		for (; i < n; ++i)
+			values[i] = CalibrateValue(values[i], offsets[i], gains[i]);
+	}
+}
+
+
+__attribute__((target("avx2")))
+static void CalibrateSamplesAvx2(int16_t *tile, unsigned int channels, unsigned int count, const int16_t *offsets, const int16_t *gains)
+{
+	const __m256i round = _mm256_set1_epi32(1 << (CALIB_GAIN_BITS - 1));
+	unsigned int period = UNPACK_GROUP_CHANNELS * channels;
+	unsigned int total = count * channels;
+
+	for (unsigned int first = 0; first < total; first += period)
+	{
+		int16_t *values = tile + first;
+		unsigned int n = std::min(period, total - first);
+		unsigned int i = 0;
+		for (; i + 16 <= n; i += 16)
+		{
+			__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+			__m256i offset = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + i));
+			__m256i gain = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gains + i));
+			__m256i diff = _mm256_subs_epi16(value, offset);
+			__m256i low = _mm256_mullo_epi16(diff, gain);
+			__m256i high = _mm256_mulhi_epi16(diff, gain);
+			// The unpacks and the pack work within the 128 bit lanes, the order is kept
+			__m256i p0 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(low, high), round), CALIB_GAIN_BITS);
+			__m256i p1 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(low, high), round), CALIB_GAIN_BITS);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(values + i), _mm256_packs_epi32(p0, p1));
+		}
+		for (; i < n; ++i)
+			values[i] = CalibrateValue(values[i], offsets[i], gains[i]);
+	}
+}
+
+
+// 8 channels at a time down the tile (it is in the L1 cache), the rest one by one
+__attribute__((target("sse4.1")))
+static unsigned int SumChannelsSse41(const int16_t *tile, unsigned int channels, unsigned int count, int32_t *sums, unsigned int first)
+{
+	unsigned int channel = first;
+	for (; channel + 8 <= channels; channel += 8)
+	{
+		__m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + channel));
+		__m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + channel + 4));
+		const int16_t *values = tile + channel;
+		for (unsigned int sample = 0; sample < count; ++sample, values += channels)
+		{
+			__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+			s0 = _mm_add_epi32(s0, _mm_cvtepi16_epi32(value));
+			s1 = _mm_add_epi32(s1, _mm_cvtepi16_epi32(_mm_srli_si128(value, 8)));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + channel), s0);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + channel + 4), s1);
+	}
+	return channel;
+}
+
+
+__attribute__((target("sse4.1")))
+static void SumSamplesSse41(const int16_t *tile, unsigned int channels, unsigned int count, int32_t *sums)
+{
+	SumSamplesScalar(tile, channels, count, sums, SumChannelsSse41(tile, channels, count, sums, 0));
+}
+
+
+__attribute__((target("avx2")))
+static void SumSamplesAvx2(const int16_t *tile, unsigned int channels, unsigned int count, int32_t *sums)
+{
+	unsigned int channel = 0;
+	for (; channel + 16 <= channels; channel += 16)
+	{
+		__m256i s0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums + channel));
+		__m256i s1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums + channel + 8));
+		const int16_t *values = tile + channel;
+		for (unsigned int sample = 0; sample < count; ++sample, values += channels)
+		{
+			__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+			s0 = _mm256_add_epi32(s0, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(value)));
+			s1 = _mm256_add_epi32(s1, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(value, 1)));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + channel), s0);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + channel + 8), s1);
+	}
+	SumSamplesScalar(tile, channels, count, sums, SumChannelsSse41(tile, channels, count, sums, channel));
+}
+#endif
+
+
+STORE_SAMPLES GetSampleStorer(UNPACK_ISA isa)
+{
+#ifdef UNPACK_X86
+	if (isa >= UI_SSE41 && GetUnpackIsa() >= UI_SSE41)
+		return StoreSamplesSse41;
+#endif
+	(void)isa;
+	return StoreSamplesScalar;
+}
+
+
+CALIBRATE_SAMPLES GetSampleCalibrator(UNPACK_ISA isa)
+{
+#ifdef UNPACK_X86
+	if (isa >= UI_AVX2 && GetUnpackIsa() >= UI_AVX2)
+		return CalibrateSamplesAvx2;
+	if (isa >= UI_SSE41 && GetUnpackIsa() >= UI_SSE41)
+		return CalibrateSamplesSse41;
+#endif
+	(void)isa;
+	return CalibrateSamplesScalar;
+}
+
+
+SUM_SAMPLES GetSampleSummer(UNPACK_ISA isa)
+{
+#ifdef UNPACK_X86
+	if (isa >= UI_AVX2 && GetUnpackIsa() >= UI_AVX2)
+		return SumSamplesAvx2;
+	if (isa >= UI_SSE41 && GetUnpackIsa() >= UI_SSE41)
+		return SumSamplesSse41;
+#endif
+	(void)isa;
+	return SumSamplesScalar;
+}
+
+
+UNPACK_ISA GetUnpackIsa()
+{
+#ifdef UNPACK_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return UI_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return UI_SSE41;
+#endif
+	return UI_SCALAR;
+}
+
+
+const char* GetUnpackIsaName(UNPACK_ISA isa)
+{
+	switch (isa)
+	{
+		case UI_AVX2:
+			return "AVX2";
+		case UI_SSE41:
+			return "SSE4.1";
+		default:
+			return "scalar";
+	}
+}
+
+
+UNPACK_GROUPS GetGroupUnpacker(unsigned int bits, UNPACK_ISA isa)
+{
+	// Nothing the CPU cannot run
+	if (isa > GetUnpackIsa())
+		isa = GetUnpackIsa();
+
+	switch (bits)
+	{
+		case 8:
+#ifdef UNPACK_X86
+			if (isa == UI_AVX2)
+				return UnpackGroups8Avx2;
+			if (isa == UI_SSE41)
+				return UnpackGroups8Sse41;
+#endif
+			return UnpackGroups8Scalar;
+		case 12:
+#ifdef UNPACK_X86
+			if (isa == UI_AVX2)
+				return UnpackGroups12Avx2;
+			if (isa == UI_SSE41)
+				return UnpackGroups12Sse41;
+#endif
+			return UnpackGroups12Scalar;
+		case 14:
+#ifdef UNPACK_X86
+			if (isa == UI_AVX2)
+				return UnpackGroups14Avx2;
+			if (isa == UI_SSE41)
+				return UnpackGroups14Sse41;
+#endif
+			return UnpackGroups14Scalar;
+		default:
+			return NULL;
+	}
+}
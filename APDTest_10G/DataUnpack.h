@@ -0,0 +1,69 @@
+#pragma once
+#ifndef __DATAUNPACK_H__
+
+#define __DATAUNPACK_H__
+
+#include <stdint.h>
+
+#define UNPACK_GROUP_CHANNELS 8 // Channels of an ADC block, its values are padded to a byte together
+#define CALIB_GAIN_BITS 12      // Fraction bits of the calibration gains, a gain is within +-8
+
+/*
+ * Sample unpacking. A sample block holds 4 ADC groups of 8 channels. The values of the active channels of a
+ * group are packed big endian, one after the other on bits bits, and the group is padded to a byte.
+ * Full groups (all 8 channels active) take 8, 12 or 14 bytes and are expanded by a kernel picked for the CPU.
+ * Other channel masks are expanded through a table of where each value is.
+ */
+enum UNPACK_ISA { UI_SCALAR, UI_SSE41, UI_AVX2 };
+
+// Expands groups consecutive full groups at pData into 8 * groups values
+typedef void (*UNPACK_GROUPS)(const unsigned char *pData, int16_t *pSamples, unsigned int groups);
+
+UNPACK_ISA GetUnpackIsa(); // The best one the CPU supports
+const char* GetUnpackIsaName(UNPACK_ISA isa);
+UNPACK_GROUPS GetGroupUnpacker(unsigned int bits, UNPACK_ISA isa); // NULL if bits is not 8, 12 or 14
+
+// Writes count samples of channels values each, one after the other in tile, to the channel buffers: value c
+// of sample s goes to channelData[c][index + s]. stream: around the cache (non temporal), for buffers much
+// larger than the cache.
+typedef void (*STORE_SAMPLES)(const int16_t *tile, unsigned int channels, unsigned int count, int16_t *const *channelData, uint64_t index, bool stream);
+
+STORE_SAMPLES GetSampleStorer(UNPACK_ISA isa);
+
+// Calibrates count samples of channels values each in place: value = (value - offset) * gain, rounded and
+// saturated to 16 bits. offsets and gains (CALIB_GAIN_BITS fixed point) are per value of 8 samples
+// (UNPACK_GROUP_CHANNELS * channels of them, the ones of a sample repeated), so that they are taken in
+// vectors whatever the channel count is.
+typedef void (*CALIBRATE_SAMPLES)(int16_t *tile, unsigned int channels, unsigned int count, const int16_t *offsets, const int16_t *gains);
+
+CALIBRATE_SAMPLES GetSampleCalibrator(UNPACK_ISA isa);
+
+// Adds count samples of channels values each to the sums of the channels: sums[c] += value c of every sample
+typedef void (*SUM_SAMPLES)(const int16_t *tile, unsigned int channels, unsigned int count, int32_t *sums);
+
+SUM_SAMPLES GetSampleSummer(UNPACK_ISA isa);
+
+// A value is in the three bytes from byteOffset, shift bits above the end. The bytes are within the value's
+// group, or within the 8 byte padding of the sample block.
+typedef struct UNPACK_OFFSET_
+{
+	uint16_t byteOffset;
+	uint16_t shift;
+} UNPACK_OFFSET;
+
+// Returns the number of active channels, table has room for 32
+unsigned int FillUnpackTable(uint32_t channelMask, unsigned int bits, UNPACK_OFFSET *table);
+// Full groups only if every 8 channels of channelMask are all active or all inactive, 0 otherwise
+unsigned int GetFullGroups(uint32_t channelMask);
+
+static inline void UnpackTable(const unsigned char *pData, int16_t *pSamples, const UNPACK_OFFSET *table, unsigned int channels, uint16_t mask)
+{
+	for (unsigned int i = 0; i < channels; ++i)
+	{
+		const unsigned char *p = pData + table[i].byteOffset;
+		uint32_t window = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+		pSamples[i] = (int16_t)((window >> table[i].shift) & mask);
+	}
+}
+
+#endif  /* __DATAUNPACK_H__ */
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "DecodePool.h"
+
+
+/* ******************* CDecodeWorker ******************* */
+
+unsigned int CDecodeWorker::Handler(void)
+{
+	CWaitForEvents *waitObject = CAPDFactory::GetAPDFactory()->GetWaitForEvents();
+	if (!waitObject)
+		return 1;
+
+	waitObject->Add(m_Pool->m_WorkSignal);
+	waitObject->Add(m_ExitSignal);
+
+	InitDone();
+
+	for (;;)
+	{
+		int index = -1;
+		if (waitObject->WaitAny(-1, &index) != CWaitForEvents::WR_OK)
+			continue;
+		if (index != 0)
+			break; // Exit signal
+
+		while (m_Pool->RunTask(NULL))
+			;
+	}
+
+	delete waitObject;
+
+	return 0;
+}
+
+
+/* ******************* CDecodePool ******************* */
+
+CDecodePool::CDecodePool() :
+	m_Lock(),
+	m_Jobs(),
+	m_WorkSignal(CAPDFactory::GetAPDFactory()->GetEvent()),
+	m_WorkersLock(),
+	m_Workers()
+{
+}
+
+
+CDecodePool::~CDecodePool()
+{
+	SetThreads(0);
+	delete m_WorkSignal;
+}
+
+
+bool CDecodePool::SetThreads(unsigned int threads)
+{
+	MutexGuard guard(m_WorkersLock);
+
+	for (std::vector<CDecodeWorker*>::iterator it = m_Workers.begin(); it != m_Workers.end(); ++it)
+		delete *it;
+	m_Workers.clear();
+
+	for (unsigned int i = 0; i < threads; ++i)
+	{
+		CDecodeWorker *worker = new CDecodeWorker(this);
+
+		ADT_THREAD_CONFIG config;
+		memset(&config, 0, sizeof(config));
+		config.cpu = -1;
+		config.numaNode = -1;
+		snprintf(config.name, sizeof(config.name), "apd-decode%u", i % 100000);
+		worker->SetThreadConfig(config);
+
+		if (worker->Start(true) == false)
+		{
+			fprintf(stderr, "Cannot start decode thread %u\n", i);
+			delete worker;
+			return false;
+		}
+
+		m_Workers.push_back(worker);
+	}
+
+	return true;
+}
+
+
+void CDecodePool::Run(CDecodeJob *job, unsigned int tasks, CEvent *finished)
+{
+	if (tasks == 0)
+		return;
+
+	POOL_JOB entry = { job, tasks, 0, 0, finished };
+	finished->Reset();
+
+	m_Lock.lock();
+	m_Jobs.push_back(&entry);
+	m_WorkSignal->Set();
+	m_Lock.unlock();
+
+	while (RunTask(&entry))
+		;
+
+	finished->Wait(-1);
+}
+
+
+bool CDecodePool::RunTask(POOL_JOB *own)
+{
+	m_Lock.lock();
+
+	std::list<POOL_JOB*>::iterator it = m_Jobs.begin();
+	if (own)
+	{
+		while (it != m_Jobs.end() && *it != own)
+			++it;
+	}
+	if (it == m_Jobs.end())
+	{
+		m_Lock.unlock();
+		return false;
+	}
+
+	POOL_JOB *entry = *it;
+	unsigned int task = entry->next++;
+	if (entry->next == entry->tasks)
+	{
+		m_Jobs.erase(it);
+		if (m_Jobs.empty())
+			m_WorkSignal->Reset();
+	}
+
+	m_Lock.unlock();
+
+	entry->job->RunTask(task);
+
+	// The entry is on the stack of Run(), it must not be touched after the last increment
+	unsigned int tasks = entry->tasks;
+	CEvent *finished = entry->finished;
+	if (__atomic_add_fetch(&entry->done, 1, __ATOMIC_ACQ_REL) == tasks)
+		finished->Set();
+
+	return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#ifndef __DECODEPOOL_H__
+
+#define __DECODEPOOL_H__
+
+#include <list>
+#include <vector>
+
+#include "InterfaceDefs.h"
+#include "SysLnxClasses.h"
+
+/*
+ * Work handed to the decode pool: a number of independent tasks, run by any thread in any order.
+ */
+class CDecodeJob
+{
+public:
+	virtual ~CDecodeJob() {};
+
+	virtual void RunTask(unsigned int task) = 0;
+};
+
+class CDecodePool;
+
+class CDecodeWorker : public Thread
+{
+public:
+	CDecodeWorker(CDecodePool *pool) : Thread(), m_Pool(pool) {};
+	~CDecodeWorker() { Stop(); };
+
+private:
+	CDecodeWorker(const CDecodeWorker&);
+	CDecodeWorker& operator=(const CDecodeWorker&);
+
+	unsigned int Handler(void);
+
+	CDecodePool *m_Pool;
+};
+
+/*
+ * Helper threads shared by the decoders of all streams. A decoder puts the tasks of a batch of packets into
+ * the pool and takes its own tasks too, the idle helpers take tasks of whichever stream has some left. The
+ * decoder returns when all its tasks are done, so with no helpers it decodes everything itself.
+ */
+class CDecodePool
+{
+	friend class CDecodeWorker;
+public:
+	CDecodePool();
+	~CDecodePool();
+
+	bool SetThreads(unsigned int threads); // Stops the current helpers (after their task) and starts threads new ones
+	unsigned int GetThreadCount() const { return m_Workers.size(); };
+
+	// Returns when all tasks of job are done. finished: an event of the caller, kept for its next jobs
+	// (the thread finishing the last task may still be in finished->Set() when Run() returns).
+	void Run(CDecodeJob *job, unsigned int tasks, CEvent *finished);
+
+private:
+	CDecodePool(const CDecodePool&);
+	CDecodePool& operator=(const CDecodePool&);
+
+	struct POOL_JOB
+	{
+		CDecodeJob  *job;
+		unsigned int tasks;
+		unsigned int next;     // First task not taken yet, under m_Lock
+		unsigned int done;     // Tasks finished
+		CEvent      *finished; // Set by the thread finishing the last task
+	};
+
+	bool RunTask(POOL_JOB *own); // Takes a task of own, or of any job if NULL. false: there was none.
+
+	Mutex                      m_Lock;
+	std::list<POOL_JOB*>       m_Jobs;       // Jobs with tasks not taken yet
+	CEvent                    *m_WorkSignal; // Set while m_Jobs is not empty
+	Mutex                      m_WorkersLock;
+	std::vector<CDecodeWorker*> m_Workers;
+};
+
+#endif  /* __DECODEPOOL_H__ */
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "DumpWriter.h"
+#include "LnxClasses.h"
+
+
+CDumpWriter::CDumpWriter() :
+	Thread(),
+	m_Fd(-1),
+	m_Direct(false),
+	m_Failed(false),
+	m_Buffer(NULL),
+	m_Size(0),
+	m_DataSignal(CAPDFactory::GetAPDFactory()->GetEvent()),
+	m_CursorPad0(),
+	m_Head(0),
+	m_DroppedPackets(0),
+	m_DroppedBytes(0),
+	m_CursorPad1(),
+	m_Tail(0),
+	m_CursorPad2()
+{
+}
+
+
+CDumpWriter::~CDumpWriter()
+{
+	Close();
+	delete m_DataSignal;
+}
+
+
+/*
+ * Opens the file and starts the writer thread. bufferSize is rounded up to DUMP_WRITE_SIZE, at least two pieces:
+ * the receiver wakes the writer when it crosses into the next piece, which must have room. Without O_DIRECT
+ * support in the file system (EINVAL, e.g. tmpfs) the file is written through the page cache.
+ */
+bool CDumpWriter::Open(const char *fileName, bool direct, unsigned int bufferSize)
+{
+	Close();
+
+	m_Size = ((uint64_t)std::max(bufferSize, 2U * DUMP_WRITE_SIZE) + DUMP_WRITE_SIZE - 1) / DUMP_WRITE_SIZE * DUMP_WRITE_SIZE;
+	void *buffer = NULL;
+	int res = posix_memalign(&buffer, DUMP_ALIGNMENT, m_Size);
+	if (res)
+	{
+		fprintf(stderr, "Cannot allocate %" PRIu64 " bytes for the dump of %s: %s\n", m_Size, fileName, strerror(res));
+		return false;
+	}
+	m_Buffer = static_cast<unsigned char*>(buffer);
+
+	m_Direct = direct;
+	m_Fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (direct ? O_DIRECT : 0), 0644);
+	if (m_Fd == -1 && direct && errno == EINVAL)
+	{
+		m_Direct = false;
+		m_Fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+	if (m_Fd == -1)
+	{
+		fprintf(stderr, "Cannot open dump file %s: %s\n", fileName, strerror(errno));
+		Close();
+		return false;
+	}
+
+	m_Failed = false;
+	m_Head = 0;
+	m_Tail = 0;
+	m_DroppedPackets = 0;
+	m_DroppedBytes = 0;
+	m_DataSignal->Reset();
+
+	if (Start(true) == false)
+	{
+		fprintf(stderr, "Cannot start the writer of dump file %s\n", fileName);
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+
+void CDumpWriter::Close()
+{
+	Stop();
+
+	if (m_Fd != -1)
+	{
+		close(m_Fd);
+		m_Fd = -1;
+	}
+
+	free(m_Buffer);
+	m_Buffer = NULL;
+	m_Size = 0;
+}
+
+
+/*
+ * Called by the receiver for every packet. Copies the packet into the ring, or drops it if the ring is full.
+ * Nothing happens after Close().
+ */
+bool CDumpWriter::Write(const unsigned char *data, unsigned int length)
+{
+	if (m_Buffer == NULL)
+		return false; // Closed
+
+	uint64_t tail = __atomic_load_n(&m_Tail, __ATOMIC_ACQUIRE);
+	if (m_Head + length - tail > m_Size || __atomic_load_n(&m_Failed, __ATOMIC_RELAXED))
+	{
+		++m_DroppedPackets;
+		m_DroppedBytes += length;
+		return false;
+	}
+
+	uint64_t offset = m_Head % m_Size;
+	uint64_t first = std::min((uint64_t)length, m_Size - offset);
+	memcpy(m_Buffer + offset, data, first);
+	memcpy(m_Buffer, data + first, length - first);
+
+	uint64_t head = m_Head + length;
+	__atomic_store_n(&m_Head, head, __ATOMIC_RELEASE);
+
+	// The writer only wants complete pieces, one wakeup per DUMP_WRITE_SIZE
+	if (head / DUMP_WRITE_SIZE != (head - length) / DUMP_WRITE_SIZE)
+		m_DataSignal->Set();
+
+	return true;
+}
+
+
+unsigned int CDumpWriter::Handler(void)
+{
+	CLnxWaitForEvents waitObjects;
+	waitObjects.Add(m_DataSignal);
+	waitObjects.Add(m_ExitSignal);
+
+	InitDone();
+
+	bool quit = false;
+	while (!quit)
+	{
+		int index = -1;
+		if (waitObjects.WaitAny(-1, &index) != CWaitForEvents::WR_OK)
+			fprintf(stderr, "WaitAny is not WR_OK!\n");
+
+		switch (index)
+		{
+			case 0:
+				m_DataSignal->Reset();
+				WriteOut(false);
+				break;
+			case 1:
+				quit = true;
+				break;
+			default:
+				break;
+		}
+	}
+
+	// The receiver is stopped or the dump is being replaced, write everything
+	WriteOut(true);
+	return 0;
+}
+
+
+/*
+ * Writes the complete DUMP_WRITE_SIZE pieces of the ring, final: everything. The ring is written in as few
+ * calls as possible, up to its end at once. The offsets in the ring and in the file stay DUMP_WRITE_SIZE
+ * aligned until the final partial piece, which is written without O_DIRECT.
+ */
+bool CDumpWriter::WriteOut(bool final)
+{
+	while (!m_Failed)
+	{
+		uint64_t head = __atomic_load_n(&m_Head, __ATOMIC_ACQUIRE);
+		uint64_t offset = m_Tail % m_Size;
+		uint64_t length = std::min(head - m_Tail, m_Size - offset);
+		if (final == false)
+			length -= length % DUMP_WRITE_SIZE;
+		if (length == 0)
+			break;
+
+		if (m_Direct && length % DUMP_ALIGNMENT)
+			ClearDirect();
+
+		ssize_t written = write(m_Fd, m_Buffer + offset, length);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EINVAL && m_Direct)
+			{
+				ClearDirect();
+				continue;
+			}
+
+			fprintf(stderr, "Cannot write the dump file, dumping stopped: %s\n", strerror(errno));
+			__atomic_store_n(&m_Failed, true, __ATOMIC_RELAXED);
+			return false;
+		}
+
+		__atomic_store_n(&m_Tail, m_Tail + written, __ATOMIC_RELEASE);
+	}
+
+	return m_Failed == false;
+}
+
+
+void CDumpWriter::ClearDirect()
+{
+	int flags = fcntl(m_Fd, F_GETFL);
+	if (flags != -1)
+		fcntl(m_Fd, F_SETFL, flags & ~O_DIRECT);
+	m_Direct = false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#ifndef __DUMPWRITER_H__
+
+#define __DUMPWRITER_H__
+
+#include "InterfaceDefs.h"
+#include "SysLnxClasses.h"
+
+#define DUMP_BUFFER_SIZE (64 * 1024 * 1024) // Packets waiting for the disk, about 50 ms at 10 Gbit/s
+#define DUMP_WRITE_SIZE  (1024 * 1024)      // The writer writes in multiples of this, DUMP_BUFFER_SIZE is a multiple of it
+#define DUMP_ALIGNMENT   4096               // O_DIRECT alignment of the buffer, the file offsets and the lengths
+
+/*
+ * Raw packet dump of a stream. The receiver only copies the packet into a ring buffer, a writer thread takes
+ * the data out in large writes (O_DIRECT if the file system supports it). The ring is single producer
+ * (receiver), single consumer (writer): each cursor is written by one side only. If the disk falls behind
+ * and the ring is full, the packet is left out of the dump and counted, the receiver never waits for the disk.
+ */
+class CDumpWriter : public Thread
+{
+public:
+	CDumpWriter();
+	~CDumpWriter();
+
+	bool Open(const char *fileName, bool direct = true, unsigned int bufferSize = DUMP_BUFFER_SIZE);
+	void Close(); // Writes what is in the ring and closes the file
+
+	// Receiver side
+	bool Write(const unsigned char *data, unsigned int length);
+
+	uint64_t GetDroppedPackets() const { return m_DroppedPackets; };
+	uint64_t GetDroppedBytes() const { return m_DroppedBytes; };
+
+private:
+	CDumpWriter(const CDumpWriter&);
+	CDumpWriter& operator=(const CDumpWriter&);
+
+	unsigned int Handler(void);
+	bool WriteOut(bool final);
+	void ClearDirect();
+
+	int            m_Fd;
+	bool           m_Direct;   // O_DIRECT is set on m_Fd
+	bool           m_Failed;   // Write error, the rest is dropped
+	unsigned char *m_Buffer;
+	uint64_t       m_Size;
+	CEvent        *m_DataSignal; // Set by the receiver each time a DUMP_WRITE_SIZE piece is complete
+
+	// Receiver
+	char         m_CursorPad0[CACHE_LINE_SIZE];
+	uint64_t     m_Head;           // Bytes put into the ring
+	uint64_t     m_DroppedPackets;
+	uint64_t     m_DroppedBytes;
+	char         m_CursorPad1[CACHE_LINE_SIZE - 3 * sizeof(uint64_t)];
+	// Writer
+	uint64_t     m_Tail;           // Bytes written to the file
+	char         m_CursorPad2[CACHE_LINE_SIZE - sizeof(uint64_t)];
+};
+
+#endif  /* __DUMPWRITER_H__ */
@@ -201,7 +201,7 @@ struct CC_STREAMHEADER
 	ADT_CC_COUNTER sampleCounter;
 };
 
-uint64_t inline CC_PacketCounter_fast(CC_STREAMHEADER* header)
+uint64_t inline CC_PacketCounter_fast(const CC_STREAMHEADER* header)
 {
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 	return MSB_TO_HOST_64(&header->S2, uint64_t) & COUNTER_MASK;
@@ -212,7 +212,7 @@ uint64_t inline CC_PacketCounter_fast(CC_STREAMHEADER* header)
 #endif
 }
 
-uint64_t inline CC_SampleCounter_fast(CC_STREAMHEADER* header)
+uint64_t inline CC_SampleCounter_fast(const CC_STREAMHEADER* header)
 {
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 	return MSB_TO_HOST_64(&header->S3, uint64_t) & COUNTER_MASK;
@@ -224,23 +224,23 @@ uint64_t inline CC_SampleCounter_fast(CC_STREAMHEADER* header)
 }
 
 #ifdef ENABLE_SLOW_COUNTER
-uint64_t inline CC_PacketCounter(CC_STREAMHEADER* header)
+uint64_t inline CC_PacketCounter(const CC_STREAMHEADER* header)
 {
 	return COUNTER_TO_INT64(header->packetCounter);
 }
 
-uint64_t inline CC_SampleCounter(CC_STREAMHEADER* header)
+uint64_t inline CC_SampleCounter(const CC_STREAMHEADER* header)
 {
 	return COUNTER_TO_INT64(header->sampleCounter);
 }
 #endif
 
-uint8_t inline CC_StreamNum(CC_STREAMHEADER* header)
+uint8_t inline CC_StreamNum(const CC_STREAMHEADER* header)
 {
 	return header->S1.Stream_num + 1;
 }
 
-uint8_t inline CC_SampleStart(CC_STREAMHEADER* header)
+uint8_t inline CC_SampleStart(const CC_STREAMHEADER* header)
 {
 	return header->S1.Sample_Start_Condition;
 }
@@ -3,6 +3,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
 
 #include "APDLib.h"
 #include "InternalFunctions.h"
@@ -12,14 +19,12 @@
 #include "DataEvaluation.h"
 #include "helper.h"
 #include "CCRegs.h"
+#include "Reactor.h"
 
 #define LIBVERSION_MAJOR 1
 #define LIBVERSION_MINOR 2
 
 
-#define STREAM_PORT_IP      "10.123.13.202"
-#define STREAM_PORT_MAC     {0x90, 0xE2, 0xBA, 0x45, 0xD7, 0x6E}
-
 #define SLOTNUMBER 2
 #define MAX_STREAMNUM       4
 #define MTU                 9000
@@ -31,6 +36,12 @@
 #define STREAM_PORT_BASE    10001
 #define PAGESIZE            getpagesize()
 #define MAX_SAMPLECOUNT     0xFFFFFFFFFFFF
+#define DEF_BUSY_POLL_TIME  50    // SO_BUSY_POLL in us
+#define DEF_SPIN_BUDGET     10000 // Empty reads before the receiver sleeps in poll()
+#define BASE_CLOCK          20000000 // Hz, input of the basic PLL
+#define DEF_STALL_TOLERANCE 100   // Receiver stall in ms the socket buffer must absorb
+#define MIN_RCVBUF_SIZE     (4 * 1024 * 1024)
+#define MAX_RCVBUF_SIZE     (1024 * 1024 * 1024) // The kernel doubles it, must stay below INT_MAX
 
 #define NOT_IMPL   { fprintf(stderr, "%s is NOT IMPLEMENTED!\n", __FUNCTION__); return ADT_NOT_IMPLEMENTED; }
 
@@ -96,11 +107,29 @@ typedef struct _Stream
 	int              bits;
 	uint32_t         channelMask;
 	uint16_t         stream_port_h; // port number for stream in host format.
+	unsigned int     rx_queue; // NIC receive queue of the stream (AF_XDP receiver only)
+	ADT_STREAM_TRANSPORT transport; // How the camera sends the stream
+	uint32_t         dest_ip_h; // Multicast group or unicast destination of the stream in host format
+	uint8_t          dest_mac[6]; // Unicast destination MAC
+	char             stream_interface[32]; // Receiving interface, empty: the one of APDCAM_SetStreamInterface
+	int              busy_poll_cpu; // CPU of the receiver in busy poll mode, < 0: not pinned
+	int              busy_poll_time; // SO_BUSY_POLL in us
+	unsigned int     spin_budget; // Empty reads before the receiver sleeps in busy poll mode
+	ADT_THREAD_CONFIG receiver_thread; // Placement of the stream server thread
+	ADT_THREAD_CONFIG decoder_thread; // Placement of the data evaluation thread
+	bool             in_reactor; // Received and decoded by a reactor thread, not by its own threads
+	uint64_t         data_rate; // Expected UDP payload of the stream in bytes/s, 0: unknown
+	int              rcvbuf_size; // Socket buffer asked for at the last APDCAM_ARM
+	unsigned int     reorder_window; // Packets the decoder waits for a packet arriving out of order
+	ADT_BUFFER_LAYOUT buffer_layout; // Of the user buffer allocated by the next APDCAM_Allocate
+	unsigned int     decimation_factor; // Samples averaged into a decimated sample, < 2: no decimation
+	uint64_t         decimation_samples; // Length of the decimated ring
 	// Primary buffer where the server collects the incoming UDP frames.
 	// Temporary buffer is for the data evaluation.
 	// User buffer where the evaluated data are stored.
-	// The size of non-paged memory is primeryBuffer + temporaryBuffer + CHANNEL_NUM * userBuffer
-	// user_buffer_1_i = user_buffer_1 + i * user_buffer_size_1.
+	// The size of non-paged memory is primeryBuffer + temporaryBuffer + active channels * userBuffer
+	// user_buffer_1_i = user_buffer_1 + i * user_buffer_size_1, i counting the active channels.
+	// BL_INTERLEAVED: one ring of the active channels, sample after sample, of the same size.
 	CAPDServer      *stream_server;
 	CNPMAllocator   *np_memory;
 	CEvent          *dataNotification; // Set by the server to notify the data processor to start data evaluation;
@@ -112,6 +141,8 @@ typedef struct _Stream
 	uint64_t         temp_buffer_size;
 	unsigned char   *user_buffer;
 	uint64_t         user_buffer_size;
+	unsigned char   *decimation_buffer; // After the user buffer, active channels * decimation_buffer_size
+	uint64_t         decimation_buffer_size;
 	uint64_t         requestedData;
 } Stream;
 
@@ -126,6 +157,7 @@ typedef struct tagWORKING_SET
 	ADT_STATE state;
 
 	CAPDClient *client;
+	ADT_THREAD_CONFIG command_thread; // Placement of the command client thread
 
 	int    n_streams;
 	Stream streams[MAX_STREAMNUM];
@@ -142,6 +174,18 @@ typedef struct tagWORKING_SET
 	// The size of user data in an UDP packet (without CW_FRAME)
 	unsigned int packetsize;
 
+	// Number of packets the stream servers drain per wakeup (1: one recvfrom() per packet)
+	unsigned int receiveBatch;
+
+	// The stream sockets receive datagrams coalesced by UDP_GRO
+	bool receiveGro;
+
+	// Longest delay in us between receiving a packet and signaling the decoder, 0: signal by packet count only
+	unsigned int signalLatency;
+
+	// Receiver stall in ms the socket buffers are sized for
+	unsigned int stallTolerance;
+
 	uint64_t bufferSizeInSampleNo;	// the size of buffers in samples. The real size of a buffer depends on the data type, stored in that buffer.
 	bool setupComplete;
 
@@ -159,6 +203,15 @@ typedef struct tagWORKING_SET
 
 WORKING_SET g_WorkingSets[SLOTNUMBER];
 
+// Reactor mode: the streams of all cameras are served by a shared pool of epoll threads
+bool         g_ReactorMode = false;
+unsigned int g_ReactorThreads = 0; // 0: one per CPU
+CReactor    *g_Reactor = NULL;
+
+// Helper threads decoding the packets of all streams together with their decoders, 0: each decoder alone
+unsigned int g_DecodeThreads = 0;
+CDecodePool *g_DecodePool = NULL;
+
 CAPDFactory* CAPDFactory::g_pFactory;
 
 
@@ -300,6 +353,198 @@ void APDCAM_Find(ApdCam10G_t *devices, UINT32 from_ip_h, UINT32 to_ip_h, UINT32
 }
 
 
+static void StopReceiver(Stream *stream)
+{
+	if (stream->stream_server == NULL)
+		return;
+
+	if (stream->in_reactor && g_Reactor)
+		g_Reactor->RemoveSource(stream->stream_server->GetReactorSource());
+	else
+		stream->stream_server->Stop();
+}
+
+
+static void StopDecoder(Stream *stream)
+{
+	if (stream->eval == NULL)
+		return;
+
+	if (stream->in_reactor && g_Reactor)
+		g_Reactor->RemoveDecoder(stream->eval);
+	else
+		stream->eval->Stop();
+
+	stream->in_reactor = false;
+}
+
+
+/*
+ * Starts the receiver and the decoder of a stream, on their own threads or, in reactor mode, on a reactor thread.
+ * Receivers that cannot be served by a reactor (packet ring, AF_XDP) always get their own threads.
+ */
+static bool StartStream(Stream *stream)
+{
+	/*
+	 * Armed again without a stop
+	 */
+	if (stream->in_reactor)
+	{
+		StopReceiver(stream);
+		StopDecoder(stream);
+	}
+
+	CReactorSource *source = g_ReactorMode ? stream->stream_server->GetReactorSource() : NULL;
+	if (source)
+	{
+		if (g_Reactor == NULL)
+		{
+			g_Reactor = new CReactor();
+			if (g_Reactor->Start(g_ReactorThreads) == false)
+			{
+				delete g_Reactor;
+				g_Reactor = NULL;
+				return false;
+			}
+		}
+
+		stream->in_reactor = g_Reactor->Add(source, stream->eval, stream->dataNotification);
+		return stream->in_reactor;
+	}
+
+	if (stream->stream_server->Start() == false)
+		return false;
+
+	stream->eval->Start();
+
+	return true;
+}
+
+
+/*
+ * Expected UDP payload of a stream in bytes/s from the sample rate (basic PLL, sample divider),
+ * the size of a sample (channel mask, resolution) and the packet headers. 0 if not known.
+ * The frequency of an external clock is not known, the internal clock is assumed then.
+ */
+static uint64_t GetStreamDataRate(const WORKING_SET &WorkingSet, const Stream *stream)
+{
+	if (WorkingSet.basicPLLdiv_0 == 0 || WorkingSet.sampleDiv == 0 || WorkingSet.packetsize <= sizeof(CC_STREAMHEADER))
+		return 0;
+
+	double adcClock = (double)BASE_CLOCK * WorkingSet.basicPLLmul / WorkingSet.basicPLLdiv_0;
+	double sampleRate = adcClock / WorkingSet.sampleDiv;
+
+	int blockSize = GetBlockSize(GetBitCount(stream->channelMask), stream->bits);
+	if (blockSize % CC_OCTET_SIZE)
+		blockSize += CC_OCTET_SIZE - (blockSize % CC_OCTET_SIZE);
+
+	double payload = WorkingSet.packetsize - sizeof(CC_STREAMHEADER);
+
+	return (uint64_t)(sampleRate * blockSize * WorkingSet.packetsize / payload);
+}
+
+
+/*
+ * Sizes the socket buffer of a stream to hold stallTolerance ms of data.
+ */
+static void SizeReceiveBuffer(const WORKING_SET &WorkingSet, Stream *stream)
+{
+	stream->data_rate = GetStreamDataRate(WorkingSet, stream);
+	if (stream->data_rate == 0)
+	{
+		stream->rcvbuf_size = 0; // Server default
+	}
+	else
+	{
+		uint64_t size = stream->data_rate * WorkingSet.stallTolerance / 1000;
+		size = std::max(size, (uint64_t)MIN_RCVBUF_SIZE);
+		size = std::min(size, (uint64_t)MAX_RCVBUF_SIZE);
+		stream->rcvbuf_size = (int)size;
+	}
+
+	if (WorkingSet.clkSource)
+		printf("External clock, the data rate of ADC %d is estimated from the internal clock\n", stream->address);
+
+	stream->stream_server->SetReceiveBuffer(stream->rcvbuf_size, stream->data_rate);
+}
+
+
+/*
+ * NUMA node of a CPU, -1 if unknown.
+ */
+static int GetCpuNode(int cpu)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+
+	int node = -1;
+	struct dirent *entry;
+	while (node < 0 && (entry = readdir(dir)) != NULL)
+	{
+		if (sscanf(entry->d_name, "node%d", &node) != 1)
+			node = -1;
+	}
+	closedir(dir);
+
+	return node;
+}
+
+
+static const char* GetStreamInterface(const WORKING_SET &WorkingSet, const Stream *stream)
+{
+	return stream->stream_interface[0] ? stream->stream_interface : WorkingSet.streamInterface;
+}
+
+
+/*
+ * The node the buffers of a stream go to: where its decoder runs, or else where the stream interface is attached.
+ * -1 if neither is known.
+ */
+static int GetStreamNode(const WORKING_SET &WorkingSet, const Stream *stream)
+{
+	if (stream->decoder_thread.numaNode >= 0)
+		return stream->decoder_thread.numaNode;
+
+	if (stream->decoder_thread.cpu >= 0)
+		return GetCpuNode(stream->decoder_thread.cpu);
+
+	const char *ifname = GetStreamInterface(WorkingSet, stream);
+	if (ifname[0] == '\0')
+		return -1;
+
+	char path[96];
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return -1;
+
+	int node = -1;
+	if (fscanf(file, "%d", &node) != 1)
+		node = -1;
+	fclose(file);
+
+	return node;
+}
+
+
+/*
+ * Default placement of an acquisition thread: anywhere, normal scheduling, named after slot and stream.
+ */
+static void InitThreadConfig(ADT_THREAD_CONFIG *config, const char *nameFormat, int slotNumber, int streamNo)
+{
+	memset(config, 0, sizeof(*config));
+	config->cpu = -1;
+	config->numaNode = -1;
+	config->priority = 0;
+	snprintf(config->name, sizeof(config->name), nameFormat, slotNumber, streamNo);
+}
+
+
 ADT_HANDLE APDCAM_Open(UINT32 ip_h)
 {
 	ApdCam10G_t device;
@@ -340,10 +585,23 @@ ADT_HANDLE APDCAM_OpenDevice(ApdCam10G_t *device)
 
 	WorkingSet.packetsize = DEF_PACKETSIZE;
 
+	WorkingSet.receiveBatch = 1;
+
+	WorkingSet.receiveGro = false;
+
+	WorkingSet.signalLatency = 0;
+
+	WorkingSet.stallTolerance = DEF_STALL_TOLERANCE;
+
+	WorkingSet.clkSource = 0;
+
 	WorkingSet.setupComplete = false;
 
+	InitThreadConfig(&WorkingSet.command_thread, "apd%d-cmd", slotNumber, 0);
+
 	WorkingSet.client = CAPDFactory::GetAPDFactory()->GetClient();
 	WorkingSet.client->SetIPAddress(WorkingSet.ip_h);
+	WorkingSet.client->SetThreadConfig(WorkingSet.command_thread);
 	WorkingSet.client->Start();
 
 	WorkingSet.triggerManager = new CLnxTriggerManager();
@@ -359,6 +617,23 @@ ADT_HANDLE APDCAM_OpenDevice(ApdCam10G_t *device)
 		stream->channelMask = 0xFFFFFFFF;
 		stream->bits = 8;
 		stream->stream_port_h = STREAM_PORT_BASE + 1 + i + MAX_STREAMNUM * slotNumber;
+		stream->rx_queue = i;
+		stream->transport = STT_MULTICAST;
+		stream->dest_ip_h = ntohl(inet_addr(DEF_MULTICAST_GROUP));
+		memset(stream->dest_mac, 0, sizeof(stream->dest_mac));
+		stream->stream_interface[0] = '\0';
+		stream->busy_poll_cpu = -1;
+		stream->busy_poll_time = DEF_BUSY_POLL_TIME;
+		stream->spin_budget = DEF_SPIN_BUDGET;
+		stream->in_reactor = false;
+		stream->data_rate = 0;
+		stream->rcvbuf_size = 0;
+		stream->reorder_window = DEF_REORDER_WINDOW;
+		stream->buffer_layout = BL_CHANNELS;
+		stream->decimation_factor = 0;
+		stream->decimation_samples = 0;
+		InitThreadConfig(&stream->receiver_thread, "apd%d-rx%d", slotNumber, i + 1);
+		InitThreadConfig(&stream->decoder_thread, "apd%d-dec%d", slotNumber, i + 1);
 		stream->stream_server = CAPDFactory::GetAPDFactory()->GetServer();
 		stream->dataNotification = CAPDFactory::GetAPDFactory()->GetEvent();
 		stream->userNotification = CAPDFactory::GetAPDFactory()->GetEvent();
@@ -470,6 +745,9 @@ ADT_RESULT APDCAM_Close(ADT_HANDLE handle)
 	{
 		Stream *stream = &WorkingSet.streams[i];
 
+		StopReceiver(stream);
+		StopDecoder(stream);
+
 		if (stream->stream_server)
 			delete stream->stream_server;
 		stream->stream_server = NULL;
@@ -524,6 +802,11 @@ ADT_RESULT APDCAM_Save(ADT_HANDLE handle, uint64_t sampleCount)
 		if (sampleCount && save_sampleCount > sampleCount)
 			save_sampleCount = sampleCount;
 
+		// An interleaved ring is taken apart channel by channel
+		unsigned int stride = 0;
+		const INT16 *interleaved = WorkingSet.streams[i].eval->GetInterleavedData(&stride);
+		std::vector<INT16> channelData(interleaved ? save_sampleCount : 0);
+
 		for (n = 0, s = 0; n < CHANNEL_NUM; ++n, bit <<= 1, ++ch)
 		{
 			if (bit & WorkingSet.streams[i].channelMask)
@@ -540,6 +823,12 @@ ADT_RESULT APDCAM_Save(ADT_HANDLE handle, uint64_t sampleCount)
 					int lerrno = errno;
 					fprintf(stderr, "===Cannot create file '%s': %s===\n", filename, strerror(lerrno));
 				}
+				else if (interleaved)
+				{
+					for (uint64_t sample = 0; sample < save_sampleCount; ++sample)
+						channelData[sample] = interleaved[sample * stride + s];
+					fwrite(channelData.data(), sizeof(INT16), save_sampleCount, file);
+				}
 				else
 					fwrite(WorkingSet.streams[i].eval->GetChannelData(s), sizeof(INT16), save_sampleCount, file);
 				++s;
@@ -736,25 +1025,36 @@ ADT_RESULT APDCAM_Allocate(ADT_HANDLE handle, uint64_t sampleCount, int bits, ui
 		 */
 		stream->primary_buffer_size = (buffersize / PAGESIZE + 1) * PAGESIZE;
 		/*
-		 * Need to hold a packet
+		 * The packets are decoded in place, this only stitches together a sample straddling two packets
 		 */
-		stream->temp_buffer_size = (WorkingSet.packetsize - sizeof(CC_STREAMHEADER) / PAGESIZE + 1) * PAGESIZE;
+		stream->temp_buffer_size = PAGESIZE;
 		/*
 		 * Every sample is stored in its 16 bit word (ie. unpacked)
 		 * Enlarge it to PAGESIZE boundary so that it can be properly aligned
 		 */
 		stream->user_buffer_size = ((WorkingSet.bufferSizeInSampleNo * sizeof(UINT16)) / PAGESIZE + 1) * PAGESIZE;
 		/*
-		 * Every channel has its own buffer
+		 * Every active channel has its own buffer, or they share an interleaved ring of the same length.
+		 * The memory is locked, the inactive channels would only take it from the length of the shot.
+		 */
+		bool interleaved = stream->buffer_layout == BL_INTERLEAVED;
+		uint64_t size = stream->primary_buffer_size + stream->temp_buffer_size + std::max(channels, 1U) * stream->user_buffer_size;
+		/*
+		 * The decimated rings of the active channels, if any
 		 */
-		uint64_t size = stream->primary_buffer_size + stream->temp_buffer_size + CHANNEL_NUM * stream->user_buffer_size;
+		stream->decimation_buffer_size = 0;
+		if (stream->decimation_factor >= 2)
+			stream->decimation_buffer_size = ((stream->decimation_samples * sizeof(UINT16)) / PAGESIZE + 1) * PAGESIZE;
+		size += channels * stream->decimation_buffer_size;
 
-		stream->np_memory = CAPDFactory::GetAPDFactory()->GetNPMemory(size);
+		stream->np_memory = CAPDFactory::GetAPDFactory()->GetNPMemory(size, GetStreamNode(WorkingSet, stream));
 		stream->primary_buffer = stream->np_memory->GetBuffer();
 		stream->temp_buffer = stream->primary_buffer + stream->primary_buffer_size;
 		stream->user_buffer = stream->temp_buffer + stream->temp_buffer_size;
 		stream->requestedData = requestedDataSize;
-		stream->eval->SetBuffers(stream->primary_buffer, stream->temp_buffer, stream->user_buffer, stream->user_buffer_size);
+		stream->decimation_buffer = stream->user_buffer + std::max(channels, 1U) * stream->user_buffer_size;
+		stream->eval->SetBuffers(stream->temp_buffer, stream->user_buffer, stream->user_buffer_size, interleaved);
+		stream->eval->SetDecimation(stream->decimation_factor, stream->decimation_buffer, stream->decimation_buffer_size);
 		stream->eval->SetParams(stream->bits, stream->channelMask, WorkingSet.packetsize - sizeof(CC_STREAMHEADER));
 
 		SetChannel_1(WorkingSet.client, stream->address, reverseBits(stream->channelMask & 0xFF));
@@ -794,6 +1094,67 @@ ADT_RESULT APDCAM_GetBuffers(ADT_HANDLE handle, INT16 **buffers)
 }
 
 
+ADT_RESULT APDCAM_GetInterleavedBuffers(ADT_HANDLE handle, INT16 **buffers, unsigned int *strides)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+	if (buffers == NULL || strides == NULL)
+		return ADT_PARAMETER_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	int i = 0;
+	for (i = 0; i < WorkingSet.n_streams; ++i)
+	{
+		if (WorkingSet.streams[i].eval)
+			buffers[i] = const_cast<INT16*>(WorkingSet.streams[i].eval->GetInterleavedData(&strides[i]));
+		else
+		{
+			buffers[i] = NULL;
+			strides[i] = 0;
+		}
+	}
+	for (; i < MAX_STREAMNUM; ++i)
+	{
+		buffers[i] = NULL;
+		strides[i] = 0;
+	}
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_GetDecimatedBuffers(ADT_HANDLE handle, INT16 **buffers, ULONGLONG *sampleCounts, ULONGLONG *sampleIndices)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+	if (buffers == NULL || sampleCounts == NULL || sampleIndices == NULL)
+		return ADT_PARAMETER_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	int i = 0;
+	for (i = 0; i < WorkingSet.n_streams; ++i)
+	{
+		CDataEvaluation *eval = WorkingSet.streams[i].eval;
+		for (int ch = 0; ch < CHANNEL_NUM; ++ch)
+			buffers[i * CHANNEL_NUM + ch] = eval ? const_cast<INT16*>(eval->GetDecimatedData(ch)) : NULL;
+		sampleCounts[i] = eval ? eval->GetDecimatedCount() : 0;
+		sampleIndices[i] = eval ? eval->GetDecimatedIndex() : 0;
+	}
+	for (; i < MAX_STREAMNUM; ++i)
+	{
+		memset(buffers + i * CHANNEL_NUM, 0, CHANNEL_NUM * sizeof(INT16*));
+		sampleCounts[i] = 0;
+		sampleIndices[i] = 0;
+	}
+
+	return ADT_OK;
+}
+
+
 ADT_RESULT APDCAM_GetSampleInfo(ADT_HANDLE handle, ULONGLONG *sampleCounts, ULONGLONG *sampleIndices)
 {
 	int index = GetIndex(handle);
@@ -830,7 +1191,7 @@ ADT_RESULT APDCAM_GetSampleInfo(ADT_HANDLE handle, ULONGLONG *sampleCounts, ULON
 }
 
 
-ADT_RESULT APDCAM_ARM(ADT_HANDLE handle, ADT_MEASUREMENT_MODE mode, uint64_t sampleCount, ADT_CALIB_MODE calibMode, int signalFrequency)
+ADT_RESULT APDCAM_ARM(ADT_HANDLE handle, ADT_MEASUREMENT_MODE mode, uint64_t sampleCount, ADT_CALIB_MODE calibMode, int signalFrequency, ADT_RECEIVE_MODE receiveMode)
 {
 	APDCAM_Stop(handle);
 	int index = GetIndex(handle);
@@ -915,11 +1276,20 @@ ADT_RESULT APDCAM_ARM(ADT_HANDLE handle, ADT_MEASUREMENT_MODE mode, uint64_t sam
 		stream->stream_server->SetBuffer(stream->primary_buffer, stream->primary_buffer_size);
 		stream->stream_server->SetPacketSize(WorkingSet.packetsize);
 		stream->stream_server->SetStreamSerial(WorkingSet.streamSerial_n);
-		stream->stream_server->SetStreamInterface(WorkingSet.streamInterface);
+		stream->stream_server->SetStreamInterface(GetStreamInterface(WorkingSet, stream));
+		stream->stream_server->SetStreamDestination(htonl(stream->dest_ip_h), stream->transport == STT_MULTICAST);
+		stream->stream_server->SetBatchSize(WorkingSet.receiveBatch);
+		stream->stream_server->SetGro(WorkingSet.receiveGro);
+		SizeReceiveBuffer(WorkingSet, stream);
+		stream->stream_server->SetReceiveQueue(stream->rx_queue);
+		stream->stream_server->SetBusyPoll(receiveMode == RM_BUSY_POLL, stream->busy_poll_cpu, stream->busy_poll_time, stream->spin_budget);
+		stream->stream_server->SetThreadConfig(stream->receiver_thread);
+		stream->eval->SetThreadConfig(stream->decoder_thread);
 //		stream->eval->SetDumpFile(fopen("dump01_samples.dat", "wb"));
 
 		stream->userNotification->Reset();
 		stream->eval->SetStreamSerial(WorkingSet.streamSerial_n);
+		stream->eval->SetReorderWindow(stream->reorder_window);
 		stream->eval->SetUserNotificationSignal(stream->userNotification);
 		WorkingSet.waitObject->Add(stream->userNotification);
 
@@ -927,8 +1297,10 @@ ADT_RESULT APDCAM_ARM(ADT_HANDLE handle, ADT_MEASUREMENT_MODE mode, uint64_t sam
 		int signal_frequency = std::min(signalFrequency, primary_buffer_size_in_packets / 4);
 		signal_frequency = std::max(signal_frequency, 100);
 		stream->stream_server->SetSignalFrequency(signal_frequency);
+		stream->stream_server->SetSignalLatency(WorkingSet.signalLatency);
 
 		stream->eval->SetCalibratedMode(calibMode == CM_CALIBRATED);
+		stream->eval->SetDecodePool(g_DecodeThreads ? g_DecodePool : NULL);
 		stream->eval->DisableTrigger();
 
 		unsigned char satabit;
@@ -938,45 +1310,34 @@ ADT_RESULT APDCAM_ARM(ADT_HANDLE handle, ADT_MEASUREMENT_MODE mode, uint64_t sam
 			res = ADT_ERROR;
 		}
 		printf("SATA register: %d\n",(int)satabit);
-#define MULTICAST
-#ifdef MULTICAST
-               
+
+		uint8_t streamNum = i + 1;
 		if (satabit) 
 		{
-                  printf("Running in DualSATA mode\n");
-		  if (SetMulticastUDPStream(WorkingSet.client, i*2 + 1, DEF_OCTET, ntohl(inet_addr("239.123.13.100")), stream->stream_port_h) == false)
-			fprintf(stderr, "Error setting UDP stream %d\n", i + 1);
-		} else
-		{
-		  if (SetMulticastUDPStream(WorkingSet.client, i + 1, DEF_OCTET, ntohl(inet_addr("239.123.13.100")), stream->stream_port_h) == false)
-			fprintf(stderr, "Error setting UDP stream %d\n", i + 1);
+			printf("Running in DualSATA mode\n");
+			streamNum = i * 2 + 1;
 		}
-#else
-		uint8_t mac[] = STREAM_PORT_MAC;
-		if (satabit) 
-		{
-                  printf("Running in DualSATA mode\n");
-		  if (SetUDPStream(WorkingSet.client, i*2 + 1, DEF_OCTET, mac, ntohl(inet_addr(STREAM_PORT_IP)), stream->stream_port_h) == false)
-			fprintf(stderr, "Error setting UDP stream %d\n", i + 1);
-		} else {
-		  if (SetUDPStream(WorkingSet.client, i + 1, DEF_OCTET, mac, ntohl(inet_addr(STREAM_PORT_IP)), stream->stream_port_h) == false)
+
+		bool streamSet;
+		if (stream->transport == STT_MULTICAST)
+			streamSet = SetMulticastUDPStream(WorkingSet.client, streamNum, DEF_OCTET, stream->dest_ip_h, stream->stream_port_h);
+		else
+			streamSet = SetUDPStream(WorkingSet.client, streamNum, DEF_OCTET, stream->dest_mac, stream->dest_ip_h, stream->stream_port_h);
+		if (streamSet == false)
 			fprintf(stderr, "Error setting UDP stream %d\n", i + 1);
-		}
-#endif
 
 		if (mode == MM_ONE_SHOT)
 		{
 			stream->stream_server->SetType(CAPDServer::ST_ONE_SHOT);
 			if (stream->requestedData != 0)
 			{
-				if (stream->stream_server->Start())
-				{
-					printf("Stream %d started\n", i + 1);
 // Changed by S. Zoletnik    10.07.2014
 // Wait for less samples
 // stream->eval->SetStopAt(WorkingSet.sampleCount);
-					stream->eval->SetStopAt(WorkingSet.sampleCount);
-					stream->eval->Start();
+				stream->eval->SetStopAt(WorkingSet.sampleCount);
+				if (StartStream(stream))
+				{
+					printf("Stream %d started\n", i + 1);
 				}
 				else
 				{
@@ -989,11 +1350,10 @@ ADT_RESULT APDCAM_ARM(ADT_HANDLE handle, ADT_MEASUREMENT_MODE mode, uint64_t sam
 		else
 		{
 			stream->stream_server->SetType(CAPDServer::ST_CYCLIC);
-			if (stream->stream_server->Start())
+			stream->eval->SetStopAt(0);
+			if (StartStream(stream))
 			{
 				printf("Stream %d started\n", i + 1);
-				stream->eval->SetStopAt(0);
-				stream->eval->Start();
 			}
 			else
 			{
@@ -1071,7 +1431,19 @@ ADT_RESULT APDCAM_StreamDump(ADT_HANDLE handle, uint8_t streamNo, const char *du
 		case 3:
 		case 4:
 			if (WorkingSet.streams[streamNo - 1].stream_server)
-				WorkingSet.streams[streamNo - 1].stream_server->SetDumpFile(fopen(dumpFileName, "wb"));
+			{
+				CDumpWriter *dumpWriter = NULL;
+				if (dumpFileName && dumpFileName[0])
+				{
+					dumpWriter = new CDumpWriter();
+					if (!dumpWriter->Open(dumpFileName))
+					{
+						delete dumpWriter;
+						return ADT_ERROR;
+					}
+				}
+				WorkingSet.streams[streamNo - 1].stream_server->SetDumpWriter(dumpWriter);
+			}
 			break;
 		default:
 			return ADT_PARAMETER_ERROR;
@@ -1177,7 +1549,7 @@ ADT_RESULT APDCAM_Stop(ADT_HANDLE handle)
 
 	for (int i = 0; i < WorkingSet.n_streams; ++i)
 	{
-		WorkingSet.streams[i].stream_server->Stop();
+		StopReceiver(&WorkingSet.streams[i]);
 	}
 
 	WorkingSet.waitObject->RemoveAll();
@@ -1188,7 +1560,7 @@ ADT_RESULT APDCAM_Stop(ADT_HANDLE handle)
 
 	for (int i = 0; i < WorkingSet.n_streams; ++i)
 	{
-		WorkingSet.streams[i].eval->Stop();
+		StopDecoder(&WorkingSet.streams[i]);
 	}
 
 	return res;
@@ -1318,6 +1690,530 @@ ADT_RESULT APDCAM_SetStreamInterface(ADT_HANDLE handle, const char *ifname)
 }
 
 
+ADT_RESULT APDCAM_SetReceiveBatch(ADT_HANDLE handle, int batchSize)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	if (batchSize < 1 || batchSize > MAX_RECV_BATCH)
+		return ADT_PARAMETER_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	WorkingSet.receiveBatch = batchSize;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetReceiveGro(ADT_HANDLE handle, bool enable)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	WorkingSet.receiveGro = enable;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetSignalLatency(ADT_HANDLE handle, unsigned int latency)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	WorkingSet.signalLatency = latency;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetStreamQueue(ADT_HANDLE handle, uint8_t streamNo, unsigned int queue)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams)
+		return ADT_PARAMETER_ERROR;
+
+	WorkingSet.streams[streamNo - 1].rx_queue = queue;
+
+	return ADT_OK;
+}
+
+
+/*
+ * IPv4 address and MAC of a network interface.
+ */
+static bool GetInterfaceAddress(const char *ifname, uint32_t *ip_h, uint8_t mac[6])
+{
+	size_t length = strlen(ifname);
+	if (length >= IFNAMSIZ)
+	{
+		fprintf(stderr, "Interface name %s is too long\n", ifname);
+		return false;
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock == -1)
+		return false;
+
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, ifname, length);
+
+	bool res = false;
+	if (ioctl(sock, SIOCGIFADDR, &ifr))
+	{
+		fprintf(stderr, "Cannot get the address of %s: %s\n", ifname, strerror(errno));
+	}
+	else
+	{
+		*ip_h = ntohl(reinterpret_cast<struct sockaddr_in*>(&ifr.ifr_addr)->sin_addr.s_addr);
+		if (ioctl(sock, SIOCGIFHWADDR, &ifr))
+		{
+			fprintf(stderr, "Cannot get the MAC of %s: %s\n", ifname, strerror(errno));
+		}
+		else
+		{
+			memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+			res = true;
+		}
+	}
+
+	close(sock);
+	return res;
+}
+
+
+/*
+ * MAC of another host from the ARP cache of this one.
+ */
+static bool LookupArp(uint32_t ip_h, uint8_t mac[6])
+{
+	FILE *file = fopen("/proc/net/arp", "r");
+	if (file == NULL)
+		return false;
+
+	bool found = false;
+	char line[256];
+	while (!found && fgets(line, sizeof(line), file))
+	{
+		char ip[64];
+		unsigned int flags;
+		unsigned int m[6];
+		if (sscanf(line, "%63s %*s %x %x:%x:%x:%x:%x:%x", ip, &flags, &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 8)
+			continue;
+		if (ntohl(inet_addr(ip)) != ip_h || (flags & ATF_COM) == 0)
+			continue;
+		for (int i = 0; i < 6; ++i)
+			mac[i] = m[i];
+		found = true;
+	}
+
+	fclose(file);
+	return found;
+}
+
+
+ADT_RESULT APDCAM_SetStreamDestination(ADT_HANDLE handle, uint8_t streamNo, ADT_STREAM_TRANSPORT transport, uint32_t ip_h, const uint8_t *mac, const char *ifname)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams)
+		return ADT_PARAMETER_ERROR;
+
+	Stream *stream = &WorkingSet.streams[streamNo - 1];
+
+	char streamInterface[sizeof(stream->stream_interface)];
+	strncpy(streamInterface, ifname ? ifname : "", sizeof(streamInterface));
+	streamInterface[sizeof(streamInterface) - 1] = '\0';
+	const char *receiveInterface = streamInterface[0] ? streamInterface : WorkingSet.streamInterface;
+
+	uint8_t destMac[6] = {0};
+	switch (transport)
+	{
+		case STT_MULTICAST:
+			if (ip_h == 0)
+				ip_h = ntohl(inet_addr(DEF_MULTICAST_GROUP));
+			if (!IN_MULTICAST(ip_h))
+				return ADT_PARAMETER_ERROR;
+			break;
+		case STT_UNICAST:
+			/*
+			 * Whatever is not given comes from the receiving interface, or for another host from the ARP cache.
+			 */
+			if (ip_h == 0 || mac == NULL)
+			{
+				uint32_t interfaceIp = 0;
+				uint8_t interfaceMac[6];
+				if (receiveInterface[0] != '\0' && GetInterfaceAddress(receiveInterface, &interfaceIp, interfaceMac) == false)
+					return ADT_ERROR;
+
+				if (ip_h == 0)
+					ip_h = interfaceIp;
+				if (ip_h == 0)
+					return ADT_PARAMETER_ERROR;
+
+				if (mac)
+					memcpy(destMac, mac, sizeof(destMac));
+				else if (ip_h == interfaceIp)
+					memcpy(destMac, interfaceMac, sizeof(destMac));
+				else if (LookupArp(ip_h, destMac) == false)
+				{
+					fprintf(stderr, "The MAC of %u.%u.%u.%u is not known, give it or ping the host first\n",
+						ip_h >> 24, (ip_h >> 16) & 0xFF, (ip_h >> 8) & 0xFF, ip_h & 0xFF);
+					return ADT_ERROR;
+				}
+			}
+			else
+				memcpy(destMac, mac, sizeof(destMac));
+			if (IN_MULTICAST(ip_h))
+				return ADT_PARAMETER_ERROR;
+			break;
+		default:
+			return ADT_PARAMETER_ERROR;
+	}
+
+	stream->transport = transport;
+	stream->dest_ip_h = ip_h;
+	memcpy(stream->dest_mac, destMac, sizeof(stream->dest_mac));
+	strcpy(stream->stream_interface, streamInterface);
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetBusyPoll(ADT_HANDLE handle, uint8_t streamNo, int cpu, int busyPollTime, unsigned int spinBudget)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams || cpu >= CPU_SETSIZE || busyPollTime < 0 || spinBudget == 0)
+		return ADT_PARAMETER_ERROR;
+
+	Stream *stream = &WorkingSet.streams[streamNo - 1];
+	stream->busy_poll_cpu = cpu;
+	stream->busy_poll_time = busyPollTime;
+	stream->spin_budget = spinBudget;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetStallTolerance(ADT_HANDLE handle, unsigned int stallTime)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (stallTime == 0 || stallTime > 60000)
+		return ADT_PARAMETER_ERROR;
+
+	WorkingSet.stallTolerance = stallTime;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetReorderWindow(ADT_HANDLE handle, uint8_t streamNo, unsigned int window)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams || window > MAX_REORDER_WINDOW)
+		return ADT_PARAMETER_ERROR;
+
+	WorkingSet.streams[streamNo - 1].reorder_window = window;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetBufferLayout(ADT_HANDLE handle, uint8_t streamNo, ADT_BUFFER_LAYOUT layout)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams || (layout != BL_CHANNELS && layout != BL_INTERLEAVED))
+		return ADT_PARAMETER_ERROR;
+
+	WorkingSet.streams[streamNo - 1].buffer_layout = layout;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetDecimation(ADT_HANDLE handle, uint8_t streamNo, unsigned int factor, uint64_t sampleCount)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams || factor > MAX_DECIMATION)
+		return ADT_PARAMETER_ERROR;
+	if (factor >= 2 && (sampleCount == 0 || sampleCount > MAX_SAMPLECOUNT))
+		return ADT_PARAMETER_ERROR;
+
+	WorkingSet.streams[streamNo - 1].decimation_factor = factor;
+	WorkingSet.streams[streamNo - 1].decimation_samples = sampleCount;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetCalibration(ADT_HANDLE handle, uint8_t streamNo, const INT16 *offsets, const double *gains)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams)
+		return ADT_PARAMETER_ERROR;
+
+	if (!WorkingSet.streams[streamNo - 1].eval->SetCalibration(offsets, gains))
+		return ADT_PARAMETER_ERROR;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_GetReceiveBuffer(ADT_HANDLE handle, uint8_t streamNo, int *requested, int *achieved, unsigned int *headroom)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams || requested == NULL || achieved == NULL || headroom == NULL)
+		return ADT_PARAMETER_ERROR;
+
+	Stream *stream = &WorkingSet.streams[streamNo - 1];
+	if (stream->stream_server == NULL)
+		return ADT_ERROR;
+
+	*requested = stream->rcvbuf_size;
+	*achieved = stream->stream_server->GetReceiveBufferSize();
+	*headroom = stream->data_rate ? (unsigned int)((uint64_t)*achieved * 1000 / stream->data_rate) : 0;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_GetStreamStats(ADT_HANDLE handle, uint8_t streamNo, ADT_STREAM_STATS *stats)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams || stats == NULL)
+		return ADT_PARAMETER_ERROR;
+
+	Stream *stream = &WorkingSet.streams[streamNo - 1];
+	if (stream->stream_server == NULL || stream->eval == NULL)
+		return ADT_ERROR;
+
+	memset(stats, 0, sizeof(*stats));
+	stream->stream_server->GetStreamStats(stats);
+	stats->lostPackets = stream->eval->GetLostPackets();
+	stats->latePackets = stream->eval->GetLatePackets();
+	stats->decoderOverruns += stream->eval->GetOverruns();
+	stats->maxBacklog = stream->eval->GetMaxBacklog();
+	stats->continuityError = stream->eval->ContinuityError() ? 1 : 0;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetThreadConfig(ADT_HANDLE handle, uint8_t streamNo, ADT_THREAD_ROLE role, int cpu, int numaNode, int priority, const char *name)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (cpu >= CPU_SETSIZE || priority < 0 || priority > sched_get_priority_max(SCHED_FIFO))
+		return ADT_PARAMETER_ERROR;
+
+	if (role != THR_COMMAND && (streamNo < 1 || streamNo > WorkingSet.n_streams))
+		return ADT_PARAMETER_ERROR;
+
+	ADT_THREAD_CONFIG *config = NULL;
+	switch (role)
+	{
+		case THR_RECEIVER:
+			config = &WorkingSet.streams[streamNo - 1].receiver_thread;
+			break;
+		case THR_DECODER:
+			config = &WorkingSet.streams[streamNo - 1].decoder_thread;
+			break;
+		case THR_COMMAND:
+			config = &WorkingSet.command_thread;
+			break;
+		default:
+			return ADT_PARAMETER_ERROR;
+	}
+
+	config->cpu = cpu < 0 ? -1 : cpu;
+	config->numaNode = numaNode < 0 ? -1 : numaNode;
+	config->priority = priority;
+	if (name)
+	{
+		strncpy(config->name, name, sizeof(config->name) - 1);
+		config->name[sizeof(config->name) - 1] = '\0';
+	}
+
+	/*
+	 * Running threads are moved at once, the others at their next start
+	 */
+	switch (role)
+	{
+		case THR_RECEIVER:
+			if (WorkingSet.streams[streamNo - 1].stream_server)
+				WorkingSet.streams[streamNo - 1].stream_server->SetThreadConfig(*config);
+			break;
+		case THR_DECODER:
+			if (WorkingSet.streams[streamNo - 1].eval)
+				WorkingSet.streams[streamNo - 1].eval->SetThreadConfig(*config);
+			break;
+		case THR_COMMAND:
+			if (WorkingSet.client)
+				WorkingSet.client->SetThreadConfig(*config);
+			break;
+	}
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_GetBusyPollStats(ADT_HANDLE handle, uint8_t streamNo, ADT_BUSY_POLL_STATS *stats)
+{
+	int index = GetIndex(handle);
+	if (index < 0)
+		return ADT_INVALID_HANDLE_ERROR;
+
+	WORKING_SET &WorkingSet = g_WorkingSets[index];
+
+	if (streamNo < 1 || streamNo > WorkingSet.n_streams || stats == NULL)
+		return ADT_PARAMETER_ERROR;
+
+	CAPDServer *server = WorkingSet.streams[streamNo - 1].stream_server;
+	if (server == NULL)
+		return ADT_ERROR;
+
+	server->GetBusyPollStats(&stats->hits, &stats->spins, &stats->sleeps);
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetReactorMode(bool enable, unsigned int threads)
+{
+	if (threads > CPU_SETSIZE)
+		return ADT_PARAMETER_ERROR;
+
+	/*
+	 * The pool is resized only when no stream uses it
+	 */
+	if (g_Reactor && g_Reactor->GetStreamCount() == 0 && (enable == false || threads != g_ReactorThreads))
+	{
+		delete g_Reactor;
+		g_Reactor = NULL;
+	}
+
+	g_ReactorMode = enable;
+	g_ReactorThreads = threads;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetDecodeThreads(unsigned int threads)
+{
+	if (threads > CPU_SETSIZE)
+		return ADT_PARAMETER_ERROR;
+
+	if (g_DecodePool == NULL)
+	{
+		if (threads == 0)
+			return ADT_OK;
+		g_DecodePool = new CDecodePool();
+	}
+
+	/*
+	 * The decoders using the pool take their own tasks, they are not left waiting while the helpers change
+	 */
+	if (threads != g_DecodePool->GetThreadCount() && g_DecodePool->SetThreads(threads) == false)
+	{
+		g_DecodePool->SetThreads(0);
+		g_DecodeThreads = 0;
+		return ADT_ERROR;
+	}
+
+	g_DecodeThreads = threads;
+
+	return ADT_OK;
+}
+
+
+ADT_RESULT APDCAM_SetReceiveBackend(ADT_RECEIVE_BACKEND backend)
+{
+	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
+	if (factory == NULL)
+		return ADT_ERROR;
+
+	switch (backend)
+	{
+		case RB_SOCKET:
+			factory->SetServerBackend(CAPDFactory::SB_SOCKET);
+			break;
+		case RB_PACKET_RING:
+			factory->SetServerBackend(CAPDFactory::SB_PACKET_RING);
+			break;
+		case RB_XDP:
+			factory->SetServerBackend(CAPDFactory::SB_XDP);
+			break;
+		default:
+			return ADT_PARAMETER_ERROR;
+	}
+
+	return ADT_OK;
+}
+
+
 ADT_RESULT APDCAM_SetTiming(ADT_HANDLE handle, int basicPLLmul, int basicPLLdiv_0, int basicPLLdiv_1, int clkSource, int extDCMmul, int extDCMdiv)
 {
 	int index = GetIndex(handle);
@@ -1364,6 +2260,7 @@ ADT_RESULT APDCAM_SetTiming(ADT_HANDLE handle, int basicPLLmul, int basicPLLdiv_
 		WorkingSet.extDCMmul = extDCMmul;
 	if (extDCMdiv > 0)
 		WorkingSet.extDCMdiv = extDCMdiv;
+	WorkingSet.clkSource = clkSource;
 
 	ADT_RESULT retVal = ADT_OK;
 
@@ -90,12 +90,18 @@ public:
 	virtual void SetIPAddress(char *ipAddress) = 0;
 	virtual void SetUDPPort(UINT16 port_h) = 0;
 	virtual void SetTimeout(int timeout) = 0;
+	virtual void SetThreadConfig(const ADT_THREAD_CONFIG &config) = 0; // Affinity, priority and name of the receiving thread
 	virtual void Start() = 0;
 	virtual void Stop() = 0;
 	virtual bool SendData(GECCOMMAND* command, CClientContext *clientContext = 0, UINT32 ipAddress_h = 0, UINT16 ipPort_h = 0) = 0;
 	virtual bool SendData(BULKCMD* commands, CClientContext *clientContext = 0, UINT32 ipAddress_h = 0, UINT16 ipPort_h = 0) = 0;
 };
 
+#define DEF_MULTICAST_GROUP "239.123.13.100" // Where the streams go unless APDCAM_SetStreamDestination says otherwise
+
+class CReactorSource;
+class CDumpWriter;
+
 class CAPDServer
 {
 public:
@@ -106,16 +112,32 @@ public:
 	virtual void SetPacketSize(unsigned int packetsize) = 0;
 	virtual void SetStreamSerial(uint32_t serial) = 0;
 	virtual void SetStreamInterface(const char *ifname) = 0;
+	virtual void SetStreamDestination(uint32_t addr_n, bool multicast) = 0; // Destination address of the stream, a multicast group is joined
 	virtual void SetNotification(unsigned int requested_data, CEvent *event) = 0;
 	virtual void SetSignalFrequency(unsigned int frequency) = 0;
+	virtual void SetSignalLatency(unsigned int latency) = 0; // us, signal after latency at the latest (packet count up to the frequency), 0: off
+	virtual void SetBatchSize(unsigned int batchSize) = 0; // Number of packets to receive per wakeup
+	virtual void SetGro(bool enable) = 0; // Receive datagrams coalesced by UDP_GRO, several packets per receive call
+	virtual void SetReceiveBuffer(int size, uint64_t dataRate) = 0; // Socket buffer (bytes) and the data rate (bytes/s) it is sized for
+	virtual int GetReceiveBufferSize() = 0; // Socket buffer granted by the kernel at the start, 0 if there is no socket buffer
+	virtual void SetReceiveQueue(unsigned int queue) = 0; // NIC receive queue of the stream, used by the AF_XDP receiver
+	virtual void SetBusyPoll(bool enable, int cpu, int busyPollTime, unsigned int spinBudget) = 0; // Spin on the socket instead of sleeping in poll()
+	virtual void GetBusyPollStats(uint64_t *hits, uint64_t *spins, uint64_t *sleeps) = 0;
+	virtual void SetThreadConfig(const ADT_THREAD_CONFIG &config) = 0; // Affinity, priority and name of the receiver thread
+	virtual CReactorSource* GetReactorSource() = 0; // The receiver for a reactor thread, NULL if it needs its own thread
 	virtual void Reset() = 0;
 	virtual bool Start() = 0;
 	virtual void Stop() = 0;
 	virtual void SetType(SERVER_TYPE type) = 0;
-	virtual void SetDumpFile(FILE *dumpFile) = 0;
+	virtual void SetDumpWriter(CDumpWriter *dumpWriter) = 0; // Takes over the writer, NULL: no dump
 	virtual unsigned int GetReceivedData() = 0; // Returns the number of byte received, including the CW_FRAME
 	virtual unsigned int GetMaxPacketNo() = 0; // Returns the...
 	virtual unsigned int GetPacketNo() = 0; // Returns the...
+	virtual const unsigned char* GetPacket(unsigned int packetNo) = 0; // Returns the packet received as packetNo, starting with its CC_STREAMHEADER
+	virtual void ReleasePackets(unsigned int packetNo) = 0; // The packets before packetNo are processed, their storage can be reused
+	virtual uint64_t GetPacketTime(unsigned int packetNo) = 0; // Kernel arrival time of packetNo in ns since the epoch, 0 if unknown
+	virtual uint64_t GetSocketDrops() = 0; // Packets dropped by the kernel since the start
+	virtual void GetStreamStats(ADT_STREAM_STATS *stats) = 0; // Fills the receiver fields of stats
 };
 
 /* Interface definition for non-paged memory allocator. */
@@ -143,13 +165,26 @@ public:
 	inline static CAPDFactory* GetAPDFactory() { return g_pFactory; };
 	inline static void SetAPDFactory(CAPDFactory *factory) { g_pFactory = factory; };
 
+	enum SERVER_BACKEND { SB_SOCKET, SB_PACKET_RING, SB_XDP };
+	// EK_POLLABLE: can be waited for together with sockets and other events, EK_FUTEX: cheaper, but only waited for alone
+	enum EVENT_KIND { EK_POLLABLE, EK_FUTEX };
+
+	CAPDFactory() : m_ServerBackend(SB_SOCKET) {};
 	virtual ~CAPDFactory() {};
+
+	// Selects the receiver implementation returned by GetServer()
+	void SetServerBackend(SERVER_BACKEND backend) { m_ServerBackend = backend; };
+	SERVER_BACKEND GetServerBackend() const { return m_ServerBackend; };
+
 	virtual CAPDServer* GetServer() = 0;
 	virtual CAPDClient* GetClient() = 0;
-	virtual CEvent* GetEvent() = 0;
+	virtual CEvent* GetEvent(EVENT_KIND kind = EK_POLLABLE) = 0;
 	virtual CWaitForEvents* GetWaitForEvents() = 0;
 	virtual CClientContext* GetClientContext() = 0;
-	virtual CNPMAllocator* GetNPMemory(ULONGLONG requestedSize) = 0;
+	virtual CNPMAllocator* GetNPMemory(ULONGLONG requestedSize, int numaNode = -1) = 0; // numaNode < 0: any node
+
+protected:
+	SERVER_BACKEND m_ServerBackend;
 };
 
 
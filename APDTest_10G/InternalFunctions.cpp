@@ -355,8 +355,8 @@ bool SetDACOffset(CAPDClient *client, INT16 *offsets, int first, int no)
 {
 	bool retVal = false;
 	if (first < 0 || 32 <= first) return retVal;
-	if (first + no >= 32) return retVal;
-	retVal = WritePDI(client, ADC_BOARD, ADC_REG_OFFSET + first*sizeof(INT16), (unsigned char*)&offsets, no*sizeof(INT16));
+	if (no < 0 || first + no > 32) return retVal;
+	retVal = WritePDI(client, ADC_BOARD, ADC_REG_OFFSET + first*sizeof(INT16), (unsigned char*)offsets, no*sizeof(INT16));
 	Sleep(20);
 	return retVal;
 }
@@ -365,7 +365,7 @@ bool GetDACOffset(CAPDClient *client, INT16 *offsets, int first, int no)
 {
 	bool retVal = false;
 	if (first < 0 || 32 <= first) return retVal;
-	if (first + no >= 32) return retVal;
+	if (no < 0 || first + no > 32) return retVal;
 	retVal = ReadPDI(client, ADC_BOARD, ADC_REG_OFFSET + first*sizeof(INT16), (unsigned char*)offsets, no*sizeof(INT16));
 	return retVal;
 }
@@ -465,7 +465,7 @@ bool StoreADCOffsets_01mV(CAPDClient *client, INT16 *adcOffsets, int first, int
 #ifdef ENABLE_CALTABLE
 	bool retVal = false;
 	if (first < 0 || 32 <= first) return retVal;
-	if (first + no >= 32) return retVal;
+	if (no < 0 || first + no > 32) return retVal;
 
 	retVal = WritePDI(client, ADC_BOARD, ADC_REG_ADC_OFFSET_01MV + first*sizeof(INT16), (unsigned char*)adcOffsets, no*sizeof(INT16));
 	Sleep(20);
@@ -483,7 +483,7 @@ bool RetrieveADCOffsets_01mV(CAPDClient *client, INT16 *adcOffsets, int first, i
 #ifdef ENABLE_CALTABLE
 	bool retVal = false;
 	if (first < 0 || 32 <= first) return retVal;
-	if (first + no >= 32) return retVal;
+	if (no < 0 || first + no > 32) return retVal;
 
 	retVal = ReadPDI(client, ADC_BOARD, ADC_REG_ADC_OFFSET_01MV + first*sizeof(INT16), (unsigned char*)adcOffsets, no*sizeof(INT16));
 	return retVal;
@@ -498,7 +498,7 @@ bool StoreDACOffsets_01mV(CAPDClient *client, INT16 *dacOffsets, int first, int
 #ifdef ENABLE_CALTABLE
 	bool retVal = false;
 	if (first < 0 || 32 <= first) return retVal;
-	if (first + no >= 32) return retVal;
+	if (no < 0 || first + no > 32) return retVal;
 
 	retVal = WritePDI(client, ADC_BOARD, ADC_REG_DAC_OFFSET_01MV + first*sizeof(INT16), (unsigned char*)dacOffsets, no*sizeof(INT16));
 	Sleep(20);
@@ -516,7 +516,7 @@ bool RetrieveDACOffsets_01mV(CAPDClient *client, INT16 *dacOffsets, int first, i
 #ifdef ENABLE_CALTABLE
 	bool retVal = false;
 	if (first < 0 || 32 <= first) return retVal;
-	if (first + no >= 32) return retVal;
+	if (no < 0 || first + no > 32) return retVal;
 
 	retVal = ReadPDI(client, ADC_BOARD, ADC_REG_DAC_OFFSET_01MV + first*sizeof(INT16), (unsigned char*)dacOffsets, no*sizeof(INT16));
 	return retVal;
@@ -530,7 +530,7 @@ bool StoreADCOffsets(CAPDClient *client, INT16 *adcOffsets, int first, int no)
 #ifdef ENABLE_CALTABLE
 	bool retVal = false;
 	if (first < 0 || 32 <= first) return retVal;
-	if (first + no >= 32) return retVal;
+	if (no < 0 || first + no > 32) return retVal;
 
 	retVal = WritePDI(client, ADC_BOARD, ADC_REG_ADC_OFFSET + first*sizeof(INT16), (unsigned char*)adcOffsets, no*sizeof(INT16));
 	Sleep(20);
@@ -548,7 +548,7 @@ bool RetrieveADCOffsets(CAPDClient *client, INT16 *adcOffsets, int first, int no
 #ifdef ENABLE_CALTABLE
 	bool retVal = false;
 	if (first < 0 || 32 <= first) return retVal;
-	if (first + no >= 32) return retVal;
+	if (no < 0 || first + no > 32) return retVal;
 
 	retVal = ReadPDI(client, ADC_BOARD, ADC_REG_ADC_OFFSET + first*sizeof(INT16), (unsigned char*)adcOffsets, no*sizeof(INT16));
 	return retVal;
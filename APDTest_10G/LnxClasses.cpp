@@ -6,6 +6,11 @@
 #include <sys/resource.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <time.h>
 
 #include "LnxClasses.h"
 #include "CamClient.h"
@@ -28,44 +33,39 @@ static int timeval_to_millisec(struct timeval *tv)
 
 
 CLnxEvent::CLnxEvent() :
+	m_Fd(-1),
+	m_OwnFd(true),
 	m_LastSetterErrorCode(0),
 	m_LastWaiterErrorCode(0)
 {
-	if (pipe(pipefd))
-		m_LastSetterErrorCode = m_LastWaiterErrorCode = errno;
-	else
+	m_Fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_Fd == -1)
 	{
-		fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
-		fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
-
-		fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
-		fcntl(pipefd[1], F_SETFL, O_NONBLOCK);
+		m_LastSetterErrorCode = m_LastWaiterErrorCode = errno;
+		fprintf(stderr, "Cannot create event: %s\n", strerror(errno));
 	}
 }
 
 CLnxEvent::CLnxEvent(int fd) :
+	m_Fd(fd),
+	m_OwnFd(false),
 	m_LastSetterErrorCode(0),
 	m_LastWaiterErrorCode(0)
 {
-	pipefd[0] = fd;
-	pipefd[1] = -1;
 }
 
 CLnxEvent::~CLnxEvent()
 {
-	if (pipefd[1] != -1)
-	{
-		close(pipefd[0]);
-		close(pipefd[1]);
-	}
+	if (m_OwnFd && m_Fd != -1)
+		close(m_Fd);
 }
 
 void CLnxEvent::Set() 
 {
-	uint8_t set = 0xFF;
+	uint64_t set = 1;
 
 	m_LastSetterErrorCode = 0;
-	while (write(pipefd[1], &set, sizeof(set)) < 0)
+	while (write(m_Fd, &set, sizeof(set)) < 0)
 	{
 		m_LastSetterErrorCode = errno;
 		if (errno != EINTR)
@@ -81,25 +81,25 @@ void CLnxEvent::Reset()
 	/*
 	 * NEVER reset an event bound to a real network socket
 	 */
-	if (pipefd[1] == -1)
-		return;
-
-	m_LastWaiterErrorCode = 0;
-	if (IsSignaled() == false)
+	if (m_OwnFd == false)
 		return;
 
-	uint8_t reset;
-	errno = 0;
+	/*
+	 * The read clears the counter, EAGAIN: the event was not set
+	 */
+	uint64_t reset;
 	m_LastWaiterErrorCode = 0;
-	while (read(pipefd[0], &reset, sizeof(reset)) < 1)
+	while (read(m_Fd, &reset, sizeof(reset)) < 0)
 	{
+		if (errno == EAGAIN)
+			break;
+
 		m_LastWaiterErrorCode = errno;
 		if (errno != EINTR)
 		{
 			fprintf(stderr, "Cannot reset event: %s\n", strerror(m_LastWaiterErrorCode));
 			break;
 		}
-		errno = 0;
 	}
 }
 
@@ -113,7 +113,7 @@ bool CLnxEvent::Wait(int timeout)
 	struct pollfd pfd;
 	struct timeval begin;
 
-	pfd.fd = pipefd[0];
+	pfd.fd = m_Fd;
 	pfd.events = POLLIN;
 	pfd.revents = 0;
 
@@ -148,6 +148,108 @@ fprintf(stderr, "CLnxEvent::Wait() : %s\n", strerror(m_LastWaiterErrorCode));
 
 
 
+/* ******************* CLnxFutexEvent ******************* */
+
+static long futex(int *uaddr, int op, int val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+
+CLnxFutexEvent::CLnxFutexEvent() :
+	m_State(0),
+	m_Waiters(0),
+	m_LastErrorCode(0)
+{
+}
+
+/*
+ * The exchange and the load of m_Waiters are ordered against the increment and the FUTEX_WAIT
+ * of the waiter: either the setter sees the waiter, or the waiter's FUTEX_WAIT sees m_State == 1.
+ */
+void CLnxFutexEvent::Set()
+{
+	if (__atomic_exchange_n(&m_State, 1, __ATOMIC_SEQ_CST) == 0 && __atomic_load_n(&m_Waiters, __ATOMIC_SEQ_CST) != 0)
+	{
+		if (futex(&m_State, FUTEX_WAKE_PRIVATE, INT_MAX, NULL) < 0)
+		{
+			m_LastErrorCode = errno;
+			fprintf(stderr, "Cannot set event: %s\n", strerror(m_LastErrorCode));
+		}
+	}
+}
+
+void CLnxFutexEvent::Reset()
+{
+	__atomic_store_n(&m_State, 0, __ATOMIC_SEQ_CST);
+}
+
+bool CLnxFutexEvent::IsSignaled()
+{
+	return __atomic_load_n(&m_State, __ATOMIC_ACQUIRE) != 0;
+}
+
+bool CLnxFutexEvent::Wait(int timeout)
+{
+	struct timespec end;
+
+	if (timeout > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		end.tv_sec += timeout / 1000;
+		end.tv_nsec += (timeout % 1000) * 1000000L;
+		if (end.tv_nsec >= 1000000000L)
+		{
+			end.tv_nsec -= 1000000000L;
+			++end.tv_sec;
+		}
+	}
+
+	m_LastErrorCode = 0;
+	while (__atomic_load_n(&m_State, __ATOMIC_ACQUIRE) == 0)
+	{
+		if (timeout == 0)
+			return false;
+
+		struct timespec remaining;
+		struct timespec *pRemaining = NULL;
+		if (timeout > 0)
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining.tv_sec = end.tv_sec - now.tv_sec;
+			remaining.tv_nsec = end.tv_nsec - now.tv_nsec;
+			if (remaining.tv_nsec < 0)
+			{
+				remaining.tv_nsec += 1000000000L;
+				--remaining.tv_sec;
+			}
+			if (remaining.tv_sec < 0)
+				return false;
+			pRemaining = &remaining;
+		}
+
+		__atomic_add_fetch(&m_Waiters, 1, __ATOMIC_SEQ_CST);
+		long res = futex(&m_State, FUTEX_WAIT_PRIVATE, 0, pRemaining);
+		int error = errno;
+		__atomic_sub_fetch(&m_Waiters, 1, __ATOMIC_SEQ_CST);
+
+		/*
+		 * EAGAIN: set before the wait, ETIMEDOUT is found by the next round
+		 */
+		if (res < 0 && error != EAGAIN && error != EINTR && error != ETIMEDOUT)
+		{
+			m_LastErrorCode = error;
+			fprintf(stderr, "CLnxFutexEvent::Wait() : %s\n", strerror(m_LastErrorCode));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
 /* ******************* CLnxWaitForEvents ******************* */
 
 size_t CLnxWaitForEvents::GetMaxWaitObjects()
@@ -163,6 +265,14 @@ CWaitForEvents::WAIT_RESULT CLnxWaitForEvents::Add(CEvent *event)
 		return WR_TOO_MANY_OBJECTS;
 	}
 
+	CLnxFutexEvent *futexEvent = dynamic_cast<CLnxFutexEvent*>(event);
+	if (event != m_FutexEvent && (m_FutexEvent != NULL || (futexEvent != NULL && m_Events.empty() == false)))
+	{
+		fprintf(stderr, "A futex event can only be waited for alone\n");
+		return WR_ERROR;
+	}
+	m_FutexEvent = futexEvent;
+
 	m_Events.push_back(event);
 	m_Events.unique();
 
@@ -175,6 +285,8 @@ CWaitForEvents::WAIT_RESULT CLnxWaitForEvents::Add(CEvent *event)
 void CLnxWaitForEvents::Remove(CEvent *event) 
 {
 	m_Events.remove(event);
+	if (event == m_FutexEvent)
+		m_FutexEvent = NULL;
 
 	createPollFd();
 }
@@ -184,6 +296,7 @@ void CLnxWaitForEvents::RemoveAll()
 {
 	m_Events.clear();
 	m_nfds = 0;
+	m_FutexEvent = NULL;
 }
 
 
@@ -191,6 +304,12 @@ void CLnxWaitForEvents::createPollFd()
 {
 	int i = 0;
 
+	if (m_FutexEvent != NULL)
+	{
+		m_nfds = 0;
+		return;
+	}
+
 	for (EVENTLIST::const_iterator itr = m_Events.begin(); itr != m_Events.end(); ++itr, ++i)
 	{
 		m_pfds[i].fd = ((CLnxEvent*)(*itr))->readFd();
@@ -208,6 +327,8 @@ CWaitForEvents::WAIT_RESULT CLnxWaitForEvents::WaitAll(int timeout)
 	struct timeval begin;
 	int n = m_nfds;
 
+	if (m_FutexEvent != NULL)
+		return WaitFutex(timeout, NULL);
 
 	if (timeout > 0)
 		gettimeofday(&begin, NULL);
@@ -300,9 +421,27 @@ fprintf(stderr, "CLnxWaitForEvents::WaitAny: %s\n", strerror(m_LastErrorCode));
 }
 
 
+CWaitForEvents::WAIT_RESULT CLnxWaitForEvents::WaitFutex(int timeout, int *index)
+{
+	if (m_FutexEvent->Wait(timeout))
+	{
+		if (index != NULL)
+			*index = 0;
+		return WR_OK;
+	}
+
+	m_LastErrorCode = m_FutexEvent->GetError();
+	return m_LastErrorCode ? WR_ERROR : WR_TIMEOUT;
+}
+
+
 CWaitForEvents::WAIT_RESULT CLnxWaitForEvents::WaitAny(int *index)
 {
 	int timeout = -1;
+
+	if (m_FutexEvent != NULL)
+		return WaitFutex(timeout, index);
+
 	return WaitAny(m_nfds, NULL, &timeout, false, index);
 }
 
@@ -311,6 +450,9 @@ CWaitForEvents::WAIT_RESULT CLnxWaitForEvents::WaitAny(int timeout, int *index)
 {
 	struct timeval begin;
 
+	if (m_FutexEvent != NULL)
+		return WaitFutex(timeout, index);
+
 	if (timeout > 0)
 		gettimeofday(&begin, NULL);
 
@@ -388,6 +530,12 @@ void CLnxClient::SetTimeout(int timeout)
 		m_pClient->SetTimeout(m_Timeout);
 }
 
+void CLnxClient::SetThreadConfig(const ADT_THREAD_CONFIG &config)
+{
+	if (m_pClient)
+		m_pClient->SetThreadConfig(config);
+}
+
 void CLnxClient::Start()
 {
 	if (m_pClient)
@@ -482,6 +630,13 @@ void CLnxServer::SetStreamInterface(const char *ifname)
 }
 
 
+void CLnxServer::SetStreamDestination(uint32_t addr_n, bool multicast)
+{
+	if (m_pServer)
+		m_pServer->SetDestination(addr_n, multicast);
+}
+
+
 void CLnxServer::SetNotification(unsigned int requested_data, CEvent *event)
 {
 	if (m_pServer)
@@ -496,6 +651,79 @@ void CLnxServer::SetSignalFrequency(unsigned int frequency)
 }
 
 
+void CLnxServer::SetSignalLatency(unsigned int latency)
+{
+	if (m_pServer)
+		m_pServer->SetSignalLatency(latency);
+}
+
+
+void CLnxServer::SetBatchSize(unsigned int batchSize)
+{
+	if (m_pServer)
+		m_pServer->SetBatchSize(batchSize);
+}
+
+
+void CLnxServer::SetGro(bool enable)
+{
+	if (m_pServer)
+		m_pServer->SetGro(enable);
+}
+
+
+void CLnxServer::SetReceiveBuffer(int size, uint64_t dataRate)
+{
+	if (m_pServer)
+		m_pServer->SetRcvBuffer(size, dataRate);
+}
+
+
+int CLnxServer::GetReceiveBufferSize()
+{
+	if (m_pServer)
+		return m_pServer->GetActualRcvBufferSize();
+
+	return 0;
+}
+
+
+/*
+ * The socket receives from every queue of the interface.
+ */
+void CLnxServer::SetReceiveQueue(unsigned int /*queue*/)
+{
+}
+
+
+void CLnxServer::SetBusyPoll(bool enable, int cpu, int busyPollTime, unsigned int spinBudget)
+{
+	if (m_pServer)
+		m_pServer->SetBusyPoll(enable, cpu, busyPollTime, spinBudget);
+}
+
+
+void CLnxServer::GetBusyPollStats(uint64_t *hits, uint64_t *spins, uint64_t *sleeps)
+{
+	*hits = *spins = *sleeps = 0;
+	if (m_pServer)
+		m_pServer->GetBusyPollStats(hits, spins, sleeps);
+}
+
+
+void CLnxServer::SetThreadConfig(const ADT_THREAD_CONFIG &config)
+{
+	if (m_pServer)
+		m_pServer->SetThreadConfig(config);
+}
+
+
+CReactorSource* CLnxServer::GetReactorSource()
+{
+	return m_pServer;
+}
+
+
 void CLnxServer::Reset()
 {
 	if (m_pServer)
@@ -530,10 +758,12 @@ void CLnxServer::SetType(SERVER_TYPE type)
 }
 
 
-void CLnxServer::SetDumpFile(FILE *dumpFile)
+void CLnxServer::SetDumpWriter(CDumpWriter *dumpWriter)
 {
 	if (m_pServer)
-		m_pServer->SetDumpFile(dumpFile);
+		m_pServer->SetDumpWriter(dumpWriter);
+	else
+		delete dumpWriter;
 }
 
 
@@ -564,127 +794,809 @@ unsigned int CLnxServer::GetPacketNo()
 }
 
 
+const unsigned char* CLnxServer::GetPacket(unsigned int packetNo)
+{
+	if (m_pServer)
+		return m_pServer->GetPacket(packetNo);
 
-/* ****** CLnxNPMAllocator ******* */
-#define MESSAGE_SIZE 1024
+	return NULL; // throw ??
+}
 
-ULONGLONG CLnxNPMAllocator::m_LockedSoFar = 0;
 
-CLnxNPMAllocator::CLnxNPMAllocator(uint64_t requestedSize) throw (CNPMemoryException) : CNPMAllocator(requestedSize),
-	m_MemDesc(),
-	m_BufferSize(0)
+void CLnxServer::ReleasePackets(unsigned int packetNo)
 {
-	int pageSize = getpagesize();
-	// Calculate the number of pages of memory to request.
-	m_MemDesc.NumberOfPages = uint64_t((requestedSize + pageSize) - 1) / pageSize;
-	if (m_MemDesc.NumberOfPages == 0)
-	{
-		return;
-	}
-
-	int map_locked = 0;
+	if (m_pServer)
+		m_pServer->ReleasePackets(packetNo);
+}
 
-	// Round up requested size to the next page boundary.
-	m_BufferSize = m_MemDesc.NumberOfPages * pageSize;
 
-	struct rlimit rlim;
-	if (getrlimit(RLIMIT_MEMLOCK, &rlim))
-	{
-		int lerrno = errno;
-		char message[MESSAGE_SIZE];
+uint64_t CLnxServer::GetPacketTime(unsigned int packetNo)
+{
+	if (m_pServer)
+		return m_pServer->GetPacketTime(packetNo);
 
-		snprintf(message, MESSAGE_SIZE, "Cannot get resource limits: %s\n", strerror(lerrno));
-		ErrorLog(message);
-	}
-	printf( "Lockable memory limits: %ld:%ld\n", rlim.rlim_cur, rlim.rlim_max);
-	fflush(stdout);
-	if (rlim.rlim_cur < m_BufferSize + m_LockedSoFar)
-	{
-		fprintf(stderr, "Trying to adjust the size of the lockable memory from %ld to %" PRIu64 "...\n", rlim.rlim_cur, m_LockedSoFar + m_BufferSize);
-		fprintf(stderr, "Hardlimit: %ld\n", rlim.rlim_max);
-		rlim.rlim_cur = m_LockedSoFar + m_BufferSize;
-		if (rlim.rlim_max < rlim.rlim_cur)
-		{
-			cap_t caps;
-			cap_flag_value_t cap_eff_state = CAP_CLEAR;
-			cap_flag_value_t cap_perm_state = CAP_CLEAR;
-			cap_flag_value_t cap_inh_state = CAP_CLEAR;
+	return 0;
+}
 
-			if ((caps = cap_get_proc()) == NULL)
-			{
-				int lerrno = errno;
-				char message[MESSAGE_SIZE];
 
-				snprintf(message, MESSAGE_SIZE, "Cannot get capabilities: %s\n", strerror(lerrno));
-				ErrorLog(message);
-			}
-			cap_get_flag(caps, CAP_SYS_RESOURCE, CAP_EFFECTIVE, &cap_eff_state);
-			cap_get_flag(caps, CAP_SYS_RESOURCE, CAP_PERMITTED, &cap_perm_state);
-			cap_get_flag(caps, CAP_SYS_RESOURCE, CAP_INHERITABLE, &cap_inh_state);
-fprintf(stderr, "CAP_INHERITABLE is %s on CAP_SYS_RESOURCE\n", cap_inh_state == CAP_SET ? "set" : "not set");
-			if (cap_eff_state == CAP_CLEAR && cap_perm_state == CAP_CLEAR)
-			{
-				char message[MESSAGE_SIZE];
+uint64_t CLnxServer::GetSocketDrops()
+{
+	if (m_pServer)
+		return m_pServer->GetSocketDrops();
 
-				snprintf(message, MESSAGE_SIZE, "Cannot acquire CAP_SYS_RESOURCE\n");
-				ErrorLog(message);
-			}
-			cap_value_t new_caps = CAP_SYS_RESOURCE;
-			if (cap_set_flag(caps, CAP_PERMITTED, 1, &new_caps, CAP_SET))
-			{
-				int lerrno = errno;
-				fprintf(stderr, "Cannot CAP_PERMITTED cap_set_flag: %s\n", strerror(lerrno));
-			}
-			if (cap_set_flag(caps, CAP_EFFECTIVE, 1, &new_caps, CAP_SET))
-			{
-				int lerrno = errno;
-				fprintf(stderr, "Cannot CAP_EFFECTIVE cap_set_flag: %s\n", strerror(lerrno));
-			}
-			else if (cap_set_proc(caps))
-			{
-				int lerrno = errno;
-				fprintf(stderr, "Cannot set CAP_SYS_RESOURCE: %s\n", strerror(lerrno));
-			}
+	return 0;
+}
 
-			cap_free(caps);
-			rlim.rlim_max = rlim.rlim_cur;
-		}
-		if (setrlimit(RLIMIT_MEMLOCK, &rlim))
-		{
-			int lerrno = errno;
-			char message[MESSAGE_SIZE];
 
-			snprintf(message, MESSAGE_SIZE, "Cannot set resource limits: %s\n", strerror(lerrno));
-			ErrorLog(message);
-		}
-		else
-			map_locked = MAP_LOCKED;
-	}
-	else
-		map_locked = MAP_LOCKED;
+void CLnxServer::GetStreamStats(ADT_STREAM_STATS *stats)
+{
+	if (m_pServer)
+		m_pServer->GetStreamStats(stats);
+}
 
-	void *addr = mmap(NULL, m_BufferSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | map_locked /*| MAP_HUGETLB*/, -1, 0);
 
-	if (addr == MAP_FAILED)
-	{
-		int lerrno = errno;
-		char message[MESSAGE_SIZE];
 
-		snprintf(message, MESSAGE_SIZE, "Cannot mmap() %" PRIu64 " bytes of memory: %s\n", m_BufferSize, strerror(lerrno));
-		ErrorLog(message);
-		throw CNPMemoryException();
-	}
+/* ******************* CLnxRingServer ******************* */
 
-	m_LockedSoFar += m_BufferSize;
-	m_MemDesc.lpMemReserved = addr;
+CLnxRingServer::CLnxRingServer() :
+	m_pServer(new CPacketRingServer())
+{
 }
 
-void CLnxNPMAllocator::ErrorLog(char *message)
+
+CLnxRingServer::~CLnxRingServer()
 {
-	fprintf(stderr, message);
+	if (m_pServer)
+	{
+		delete m_pServer;
+		m_pServer = NULL;
+	}
 }
 
-CLnxNPMAllocator::CMemDesc::~CMemDesc()
+
+void CLnxRingServer::SetListeningPort(UINT16 port_h)
+{
+	if (m_pServer)
+		m_pServer->SetListeningPort(port_h);
+}
+
+
+void CLnxRingServer::SetBuffer(unsigned char *buffer, ULONGLONG size)
+{
+	if (m_pServer)
+		m_pServer->SetBuffer(buffer, size);
+}
+
+
+void CLnxRingServer::SetPacketSize(unsigned int packetsize)
+{
+	if (m_pServer)
+		m_pServer->SetPacketSize(packetsize);
+}
+
+
+void CLnxRingServer::SetStreamSerial(uint32_t serial)
+{
+	if (m_pServer)
+		m_pServer->SetStreamSerial(serial);
+}
+
+
+void CLnxRingServer::SetStreamInterface(const char *ifname)
+{
+	if (m_pServer)
+		m_pServer->SetInterfacename(ifname);
+}
+
+
+void CLnxRingServer::SetStreamDestination(uint32_t addr_n, bool multicast)
+{
+	if (m_pServer)
+		m_pServer->SetDestination(addr_n, multicast);
+}
+
+
+void CLnxRingServer::SetNotification(unsigned int requested_data, CEvent *event)
+{
+	if (m_pServer)
+		m_pServer->SetNotification(requested_data, event);
+}
+
+
+void CLnxRingServer::SetSignalFrequency(unsigned int frequency)
+{
+	if (m_pServer)
+		m_pServer->SetSignalFrequency(frequency);
+}
+
+
+/*
+ * Signals by packet count only. A partially filled block is retired by the kernel after RING_BLOCK_TIMEOUT,
+ * that bounds the delay of the last packets.
+ */
+void CLnxRingServer::SetSignalLatency(unsigned int /*latency*/)
+{
+}
+
+
+/*
+ * The packet ring hands over whole blocks of packets, the batch size does not apply.
+ */
+void CLnxRingServer::SetBatchSize(unsigned int /*batchSize*/)
+{
+}
+
+
+/*
+ * UDP_GRO is a UDP socket option, the packet ring gets the frames one by one.
+ */
+void CLnxRingServer::SetGro(bool /*enable*/)
+{
+}
+
+
+/*
+ * The packet ring is sized after the primary buffer, there is no socket buffer.
+ */
+void CLnxRingServer::SetReceiveBuffer(int /*size*/, uint64_t /*dataRate*/)
+{
+}
+
+
+int CLnxRingServer::GetReceiveBufferSize()
+{
+	return 0;
+}
+
+
+/*
+ * The packet ring receives from every queue of the interface.
+ */
+void CLnxRingServer::SetReceiveQueue(unsigned int /*queue*/)
+{
+}
+
+
+/*
+ * The packet ring receiver always waits for whole blocks, busy polling does not apply.
+ */
+void CLnxRingServer::SetBusyPoll(bool /*enable*/, int /*cpu*/, int /*busyPollTime*/, unsigned int /*spinBudget*/)
+{
+}
+
+
+void CLnxRingServer::GetBusyPollStats(uint64_t *hits, uint64_t *spins, uint64_t *sleeps)
+{
+	*hits = *spins = *sleeps = 0;
+}
+
+
+void CLnxRingServer::SetThreadConfig(const ADT_THREAD_CONFIG &config)
+{
+	if (m_pServer)
+		m_pServer->SetThreadConfig(config);
+}
+
+
+/*
+ * The packet ring receiver waits on its own ring, it keeps its thread.
+ */
+CReactorSource* CLnxRingServer::GetReactorSource()
+{
+	return NULL;
+}
+
+
+void CLnxRingServer::Reset()
+{
+	if (m_pServer)
+		m_pServer->Reset();
+}
+
+
+bool CLnxRingServer::Start()
+{
+	if (m_pServer)
+		return m_pServer->Start(true);
+
+	return false; // throw ??
+}
+
+
+void CLnxRingServer::Stop()
+{
+	if (m_pServer)
+		m_pServer->Stop();
+}
+
+
+void CLnxRingServer::SetType(SERVER_TYPE type)
+{
+	if (!m_pServer)
+		return; // throw ?
+	if (type == ST_ONE_SHOT)
+		m_pServer->SetType(0);
+	else
+		m_pServer->SetType(1);
+}
+
+
+void CLnxRingServer::SetDumpWriter(CDumpWriter *dumpWriter)
+{
+	if (m_pServer)
+		m_pServer->SetDumpWriter(dumpWriter);
+	else
+		delete dumpWriter;
+}
+
+
+unsigned int CLnxRingServer::GetReceivedData()
+{
+	if (m_pServer)
+		return (unsigned int)m_pServer->GetReceivedData();
+
+	return 0; // throw ??
+}
+
+
+unsigned int CLnxRingServer::GetMaxPacketNo()
+{
+	if (m_pServer)
+		return (unsigned int)m_pServer->GetMaxPacketNo();
+
+	return 0; // throw ??
+}
+
+
+unsigned int CLnxRingServer::GetPacketNo()
+{
+	if (m_pServer)
+		return (unsigned int)m_pServer->GetPacketNo();
+
+	return 0; // throw ??
+}
+
+
+const unsigned char* CLnxRingServer::GetPacket(unsigned int packetNo)
+{
+	if (m_pServer)
+		return m_pServer->GetPacket(packetNo);
+
+	return NULL; // throw ??
+}
+
+
+void CLnxRingServer::ReleasePackets(unsigned int packetNo)
+{
+	if (m_pServer)
+		m_pServer->ReleasePackets(packetNo);
+}
+
+
+/*
+ * The packet ring receiver keeps no arrival times and drop counts.
+ */
+uint64_t CLnxRingServer::GetPacketTime(unsigned int /*packetNo*/)
+{
+	return 0;
+}
+
+
+uint64_t CLnxRingServer::GetSocketDrops()
+{
+	return 0;
+}
+
+
+void CLnxRingServer::GetStreamStats(ADT_STREAM_STATS *stats)
+{
+	if (m_pServer)
+	{
+		stats->packets = m_pServer->GetPacketNo();
+		stats->dumpDrops = m_pServer->GetDumpDrops();
+	}
+}
+
+
+
+/* ******************* CLnxXskServer ******************* */
+
+CLnxXskServer::CLnxXskServer() :
+	m_pServer(new CXskServer())
+{
+}
+
+
+CLnxXskServer::~CLnxXskServer()
+{
+	if (m_pServer)
+	{
+		delete m_pServer;
+		m_pServer = NULL;
+	}
+}
+
+
+void CLnxXskServer::SetListeningPort(UINT16 port_h)
+{
+	if (m_pServer)
+		m_pServer->SetListeningPort(port_h);
+}
+
+
+void CLnxXskServer::SetBuffer(unsigned char *buffer, ULONGLONG size)
+{
+	if (m_pServer)
+		m_pServer->SetBuffer(buffer, size);
+}
+
+
+void CLnxXskServer::SetPacketSize(unsigned int packetsize)
+{
+	if (m_pServer)
+		m_pServer->SetPacketSize(packetsize);
+}
+
+
+void CLnxXskServer::SetStreamSerial(uint32_t serial)
+{
+	if (m_pServer)
+		m_pServer->SetStreamSerial(serial);
+}
+
+
+void CLnxXskServer::SetStreamInterface(const char *ifname)
+{
+	if (m_pServer)
+		m_pServer->SetInterfacename(ifname);
+}
+
+
+void CLnxXskServer::SetStreamDestination(uint32_t addr_n, bool multicast)
+{
+	if (m_pServer)
+		m_pServer->SetDestination(addr_n, multicast);
+}
+
+
+void CLnxXskServer::SetNotification(unsigned int requested_data, CEvent *event)
+{
+	if (m_pServer)
+		m_pServer->SetNotification(requested_data, event);
+}
+
+
+void CLnxXskServer::SetSignalFrequency(unsigned int frequency)
+{
+	if (m_pServer)
+		m_pServer->SetSignalFrequency(frequency);
+}
+
+
+/*
+ * Signals by packet count only, the receive loop has no timer.
+ */
+void CLnxXskServer::SetSignalLatency(unsigned int /*latency*/)
+{
+}
+
+
+/*
+ * The AF_XDP receiver takes everything available in the rx ring, the batch size does not apply.
+ */
+void CLnxXskServer::SetBatchSize(unsigned int /*batchSize*/)
+{
+}
+
+
+/*
+ * The XDP program takes the frames from the driver, before GRO.
+ */
+void CLnxXskServer::SetGro(bool /*enable*/)
+{
+}
+
+
+/*
+ * The packets go to the UMEM, there is no socket buffer.
+ */
+void CLnxXskServer::SetReceiveBuffer(int /*size*/, uint64_t /*dataRate*/)
+{
+}
+
+
+int CLnxXskServer::GetReceiveBufferSize()
+{
+	return 0;
+}
+
+
+void CLnxXskServer::SetReceiveQueue(unsigned int queue)
+{
+	if (m_pServer)
+		m_pServer->SetQueue(queue);
+}
+
+
+/*
+ * The AF_XDP receiver always waits in poll(), busy polling does not apply.
+ */
+void CLnxXskServer::SetBusyPoll(bool /*enable*/, int /*cpu*/, int /*busyPollTime*/, unsigned int /*spinBudget*/)
+{
+}
+
+
+void CLnxXskServer::GetBusyPollStats(uint64_t *hits, uint64_t *spins, uint64_t *sleeps)
+{
+	*hits = *spins = *sleeps = 0;
+}
+
+
+void CLnxXskServer::SetThreadConfig(const ADT_THREAD_CONFIG &config)
+{
+	if (m_pServer)
+		m_pServer->SetThreadConfig(config);
+}
+
+
+/*
+ * The AF_XDP receiver waits on its own ring, it keeps its thread.
+ */
+CReactorSource* CLnxXskServer::GetReactorSource()
+{
+	return NULL;
+}
+
+
+void CLnxXskServer::Reset()
+{
+	if (m_pServer)
+		m_pServer->Reset();
+}
+
+
+bool CLnxXskServer::Start()
+{
+	if (m_pServer)
+		return m_pServer->Start(true);
+
+	return false; // throw ??
+}
+
+
+void CLnxXskServer::Stop()
+{
+	if (m_pServer)
+		m_pServer->Stop();
+}
+
+
+void CLnxXskServer::SetType(SERVER_TYPE type)
+{
+	if (!m_pServer)
+		return; // throw ?
+	if (type == ST_ONE_SHOT)
+		m_pServer->SetType(0);
+	else
+		m_pServer->SetType(1);
+}
+
+
+void CLnxXskServer::SetDumpWriter(CDumpWriter *dumpWriter)
+{
+	if (m_pServer)
+		m_pServer->SetDumpWriter(dumpWriter);
+	else
+		delete dumpWriter;
+}
+
+
+unsigned int CLnxXskServer::GetReceivedData()
+{
+	if (m_pServer)
+		return (unsigned int)m_pServer->GetReceivedData();
+
+	return 0; // throw ??
+}
+
+
+unsigned int CLnxXskServer::GetMaxPacketNo()
+{
+	if (m_pServer)
+		return (unsigned int)m_pServer->GetMaxPacketNo();
+
+	return 0; // throw ??
+}
+
+
+unsigned int CLnxXskServer::GetPacketNo()
+{
+	if (m_pServer)
+		return (unsigned int)m_pServer->GetPacketNo();
+
+	return 0; // throw ??
+}
+
+
+const unsigned char* CLnxXskServer::GetPacket(unsigned int packetNo)
+{
+	if (m_pServer)
+		return m_pServer->GetPacket(packetNo);
+
+	return NULL; // throw ??
+}
+
+
+void CLnxXskServer::ReleasePackets(unsigned int packetNo)
+{
+	if (m_pServer)
+		m_pServer->ReleasePackets(packetNo);
+}
+
+
+/*
+ * The AF_XDP receiver keeps no arrival times and drop counts.
+ */
+uint64_t CLnxXskServer::GetPacketTime(unsigned int /*packetNo*/)
+{
+	return 0;
+}
+
+
+uint64_t CLnxXskServer::GetSocketDrops()
+{
+	return 0;
+}
+
+
+void CLnxXskServer::GetStreamStats(ADT_STREAM_STATS *stats)
+{
+	if (m_pServer)
+	{
+		stats->packets = m_pServer->GetPacketNo();
+		stats->dumpDrops = m_pServer->GetDumpDrops();
+	}
+}
+
+
+
+/* ****** CLnxNPMAllocator ******* */
+#define MESSAGE_SIZE 1024
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define MPOL_PREFERRED 1 // numaif.h, without linking libnuma
+
+#define THP_SIZE (2 * 1024 * 1024)
+
+/*
+ * Explicit huge page sizes, largest first. A size is only tried if rounding the buffer up to it wastes
+ * less than 1/HUGE_PAGE_WASTE of the mapping.
+ */
+#define HUGE_PAGE_WASTE 8
+static const struct
+{
+	uint64_t    size;
+	int         flags;
+	const char *name;
+} g_HugePages[] =
+{
+	{ 1024ULL * 1024 * 1024, MAP_HUGETLB | MAP_HUGE_1GB, "1 GiB" },
+	{ 2ULL * 1024 * 1024,    MAP_HUGETLB | MAP_HUGE_2MB, "2 MiB" },
+};
+
+ULONGLONG CLnxNPMAllocator::m_LockedSoFar = 0;
+
+CLnxNPMAllocator::CLnxNPMAllocator(uint64_t requestedSize, int numaNode) throw (CNPMemoryException) : CNPMAllocator(requestedSize),
+	m_MemDesc(),
+	m_BufferSize(0)
+{
+	int pageSize = getpagesize();
+	// Calculate the number of pages of memory to request.
+	m_MemDesc.NumberOfPages = uint64_t((requestedSize + pageSize) - 1) / pageSize;
+	if (m_MemDesc.NumberOfPages == 0)
+	{
+		return;
+	}
+
+	// Round up requested size to the next page boundary.
+	m_BufferSize = m_MemDesc.NumberOfPages * pageSize;
+
+	/*
+	 * Huge pages first: the user buffers are written channel by channel, a few bytes to every channel
+	 * buffer per sample, with 4 KiB pages that is a TLB miss on nearly every store.
+	 */
+	ULONGLONG mappedSize = m_BufferSize;
+	const char *pageName = NULL;
+	void *addr = MapHugePages(m_BufferSize, &mappedSize, &pageName);
+
+	if (addr == MAP_FAILED)
+	{
+		mappedSize = m_BufferSize;
+		addr = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+		if (addr == MAP_FAILED)
+		{
+			int lerrno = errno;
+			char message[MESSAGE_SIZE];
+
+			snprintf(message, MESSAGE_SIZE, "Cannot mmap() %" PRIu64 " bytes of memory: %s\n", m_BufferSize, strerror(lerrno));
+			ErrorLog(message);
+			throw CNPMemoryException();
+		}
+
+		pageName = "4 KiB";
+		if (mappedSize >= THP_SIZE && madvise(addr, mappedSize, MADV_HUGEPAGE) == 0)
+			pageName = "transparent huge";
+	}
+
+	/*
+	 * The node policy must be set before the pages are touched. mlock() (instead of MAP_LOCKED) faults them in afterwards.
+	 */
+	if (numaNode >= 0)
+		SetPreferredNode(addr, mappedSize, numaNode);
+
+	/*
+	 * The limit is checked against the mapped size: huge pages round the buffer up, and mlock() charges all of it.
+	 */
+	int map_locked = 0;
+
+	struct rlimit rlim;
+	if (getrlimit(RLIMIT_MEMLOCK, &rlim))
+	{
+		int lerrno = errno;
+		char message[MESSAGE_SIZE];
+
+		snprintf(message, MESSAGE_SIZE, "Cannot get resource limits: %s\n", strerror(lerrno));
+		ErrorLog(message);
+	}
+	printf( "Lockable memory limits: %ld:%ld\n", rlim.rlim_cur, rlim.rlim_max);
+	fflush(stdout);
+	if (rlim.rlim_cur < mappedSize + m_LockedSoFar)
+	{
+		fprintf(stderr, "Trying to adjust the size of the lockable memory from %ld to %" PRIu64 "...\n", rlim.rlim_cur, m_LockedSoFar + mappedSize);
+		fprintf(stderr, "Hardlimit: %ld\n", rlim.rlim_max);
+		rlim.rlim_cur = m_LockedSoFar + mappedSize;
+		if (rlim.rlim_max < rlim.rlim_cur)
+		{
+			cap_t caps;
+			cap_flag_value_t cap_eff_state = CAP_CLEAR;
+			cap_flag_value_t cap_perm_state = CAP_CLEAR;
+			cap_flag_value_t cap_inh_state = CAP_CLEAR;
+
+			if ((caps = cap_get_proc()) == NULL)
+			{
+				int lerrno = errno;
+				char message[MESSAGE_SIZE];
+
+				snprintf(message, MESSAGE_SIZE, "Cannot get capabilities: %s\n", strerror(lerrno));
+				ErrorLog(message);
+			}
+			cap_get_flag(caps, CAP_SYS_RESOURCE, CAP_EFFECTIVE, &cap_eff_state);
+			cap_get_flag(caps, CAP_SYS_RESOURCE, CAP_PERMITTED, &cap_perm_state);
+			cap_get_flag(caps, CAP_SYS_RESOURCE, CAP_INHERITABLE, &cap_inh_state);
+fprintf(stderr, "CAP_INHERITABLE is %s on CAP_SYS_RESOURCE\n", cap_inh_state == CAP_SET ? "set" : "not set");
+			if (cap_eff_state == CAP_CLEAR && cap_perm_state == CAP_CLEAR)
+			{
+				char message[MESSAGE_SIZE];
+
+				snprintf(message, MESSAGE_SIZE, "Cannot acquire CAP_SYS_RESOURCE\n");
+				ErrorLog(message);
+			}
+			cap_value_t new_caps = CAP_SYS_RESOURCE;
+			if (cap_set_flag(caps, CAP_PERMITTED, 1, &new_caps, CAP_SET))
+			{
+				int lerrno = errno;
+				fprintf(stderr, "Cannot CAP_PERMITTED cap_set_flag: %s\n", strerror(lerrno));
+			}
+			if (cap_set_flag(caps, CAP_EFFECTIVE, 1, &new_caps, CAP_SET))
+			{
+				int lerrno = errno;
+				fprintf(stderr, "Cannot CAP_EFFECTIVE cap_set_flag: %s\n", strerror(lerrno));
+			}
+			else if (cap_set_proc(caps))
+			{
+				int lerrno = errno;
+				fprintf(stderr, "Cannot set CAP_SYS_RESOURCE: %s\n", strerror(lerrno));
+			}
+
+			cap_free(caps);
+			rlim.rlim_max = rlim.rlim_cur;
+		}
+		if (setrlimit(RLIMIT_MEMLOCK, &rlim))
+		{
+			int lerrno = errno;
+			char message[MESSAGE_SIZE];
+
+			snprintf(message, MESSAGE_SIZE, "Cannot set resource limits: %s\n", strerror(lerrno));
+			ErrorLog(message);
+		}
+		else
+			map_locked = MAP_LOCKED;
+	}
+	else
+		map_locked = MAP_LOCKED;
+
+	if (map_locked && mlock(addr, mappedSize))
+	{
+		int lerrno = errno;
+		char message[MESSAGE_SIZE];
+
+		snprintf(message, MESSAGE_SIZE, "Cannot lock %" PRIu64 " bytes of memory: %s\n", mappedSize, strerror(lerrno));
+		ErrorLog(message);
+	}
+
+	if (numaNode >= 0)
+		printf("Stream buffer: %" PRIu64 " bytes in %s pages on node %d\n", mappedSize, pageName, numaNode);
+	else
+		printf("Stream buffer: %" PRIu64 " bytes in %s pages\n", mappedSize, pageName);
+	fflush(stdout);
+
+	m_BufferSize = mappedSize;
+	m_MemDesc.NumberOfPages = mappedSize / pageSize;
+	m_LockedSoFar += m_BufferSize;
+	m_MemDesc.lpMemReserved = addr;
+}
+
+
+/*
+ * Maps size bytes in the largest explicit huge pages available. Fails (MAP_FAILED) if no huge page pool can hold it.
+ */
+void* CLnxNPMAllocator::MapHugePages(ULONGLONG size, ULONGLONG *mappedSize, const char **pageName)
+{
+	for (unsigned int i = 0; i < sizeof(g_HugePages) / sizeof(g_HugePages[0]); ++i)
+	{
+		ULONGLONG hugeSize = (size + g_HugePages[i].size - 1) / g_HugePages[i].size * g_HugePages[i].size;
+		if ((hugeSize - size) * HUGE_PAGE_WASTE >= hugeSize)
+			continue;
+
+		void *addr = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | g_HugePages[i].flags, -1, 0);
+		if (addr != MAP_FAILED)
+		{
+			*mappedSize = hugeSize;
+			*pageName = g_HugePages[i].name;
+			return addr;
+		}
+	}
+
+	return MAP_FAILED;
+}
+
+
+/*
+ * Preferred, not bound: a node out of (huge) pages falls back to the others instead of failing at the first touch.
+ */
+void CLnxNPMAllocator::SetPreferredNode(void *addr, ULONGLONG size, int numaNode)
+{
+	const unsigned long bits = 8 * sizeof(unsigned long);
+	unsigned long nodeMask[numaNode / bits + 1];
+	memset(nodeMask, 0, sizeof(nodeMask));
+	nodeMask[numaNode / bits] = 1UL << (numaNode % bits);
+
+	if (syscall(SYS_mbind, addr, size, MPOL_PREFERRED, nodeMask, sizeof(nodeMask) * 8, 0))
+	{
+		int lerrno = errno;
+		char message[MESSAGE_SIZE];
+
+		snprintf(message, MESSAGE_SIZE, "Cannot place the stream buffer on node %d: %s\n", numaNode, strerror(lerrno));
+		ErrorLog(message);
+	}
+}
+
+void CLnxNPMAllocator::ErrorLog(char *message)
+{
+	fprintf(stderr, message);
+}
+
+CLnxNPMAllocator::CMemDesc::~CMemDesc()
 {
 	if (lpMemReserved)
 	{
@@ -702,6 +1614,11 @@ CLnxNPMAllocator::CMemDesc::~CMemDesc()
 /* ****** CLnxFactory ******* */
 CAPDServer* CLnxFactory::GetServer()
 {
+	if (m_ServerBackend == SB_PACKET_RING)
+		return new CLnxRingServer();
+	if (m_ServerBackend == SB_XDP)
+		return new CLnxXskServer();
+
 	return new CLnxServer();
 }
 
@@ -710,8 +1627,11 @@ CAPDClient* CLnxFactory::GetClient()
 	return new CLnxClient();
 }
 
-CEvent* CLnxFactory::GetEvent()
+CEvent* CLnxFactory::GetEvent(EVENT_KIND kind)
 {
+	if (kind == EK_FUTEX)
+		return new CLnxFutexEvent();
+
 	return new CLnxEvent();
 }
 
@@ -725,12 +1645,12 @@ CClientContext* CLnxFactory::GetClientContext()
 	return new CLnxClientContext();
 }
 
-CNPMAllocator* CLnxFactory::GetNPMemory(ULONGLONG requestedSize)
+CNPMAllocator* CLnxFactory::GetNPMemory(ULONGLONG requestedSize, int numaNode)
 {
 	CLnxNPMAllocator *pAllocator = NULL;
 	try
 	{
-		pAllocator = new CLnxNPMAllocator(requestedSize);
+		pAllocator = new CLnxNPMAllocator(requestedSize, numaNode);
 	}
 	catch (const CNPMemoryException &e)
 	{
@@ -7,10 +7,16 @@
 #include "InterfaceDefs.h"
 #include "GECClient.h"
 #include "CamServer.h"
+#include "PacketRingServer.h"
+#include "XskServer.h"
 
 class CCamClient;
 #define MAXIMUM_WAIT_OBJECTS	64
 
+/*
+ * Event on an eventfd, it can be waited for together with sockets (poll, epoll).
+ * Set() adds to the counter, Reset() clears it with a single non-blocking read.
+ */
 class CLnxEvent : public CEvent
 {
 	class CLnxEventPrivate;
@@ -18,11 +24,15 @@ class CLnxEvent : public CEvent
 	friend class CLnxWaitForEvents;
 	friend class CLnxClient;
 	friend class CLnxServer;
+	friend class CLnxRingServer;
+	friend class CLnxXskServer;
 	friend class CLnxClientContext;
+	friend class CReactorThread;
 private:
-	int readFd() const { return pipefd[0]; }
+	int readFd() const { return m_Fd; }
 
-	int pipefd[2];
+	int  m_Fd;
+	bool m_OwnFd; // false: bound to a socket, never read or closed
 	int m_LastSetterErrorCode;
 	int m_LastWaiterErrorCode;
 public:
@@ -38,18 +48,45 @@ public:
 	int GetWaiterError() { return m_LastWaiterErrorCode; };
 };
 
+/*
+ * Event without a file descriptor, for a waiter that does not multiplex with sockets (command replies).
+ * Set() and Reset() are atomic operations, Set() enters the kernel (FUTEX_WAKE) only if a thread waits.
+ */
+class CLnxFutexEvent : public CEvent
+{
+	friend class CLnxFactory;
+private:
+	CLnxFutexEvent();
+
+	int m_State;   // 1: signaled
+	int m_Waiters; // Threads in FUTEX_WAIT or about to enter it
+	int m_LastErrorCode;
+public:
+	~CLnxFutexEvent() {};
+	void Set();
+	void Reset();
+	bool IsSignaled();
+	bool Wait(int timeout);
+	int GetError() { return m_LastErrorCode; };
+};
+
+/*
+ * A CLnxFutexEvent can only be waited for alone, it has no descriptor to poll.
+ */
 class CLnxWaitForEvents : public CWaitForEvents
 {
 	friend class CLnxFactory;
 private:
-	struct pollfd m_pfds[MAXIMUM_WAIT_OBJECTS];
-	int           m_nfds;
-	unsigned int  m_LastErrorCode;
+	struct pollfd   m_pfds[MAXIMUM_WAIT_OBJECTS];
+	int             m_nfds;
+	unsigned int    m_LastErrorCode;
+	CLnxFutexEvent *m_FutexEvent;
 
 	void createPollFd();
 	WAIT_RESULT WaitAny(int size, struct timeval *begin, int *timeout, bool update_timeout, int *index);
+	WAIT_RESULT WaitFutex(int timeout, int *index);
 public:
-	CLnxWaitForEvents() : m_pfds(), m_nfds(0), m_LastErrorCode(0) {};
+	CLnxWaitForEvents() : m_pfds(), m_nfds(0), m_LastErrorCode(0), m_FutexEvent(NULL) {};
 	size_t GetMaxWaitObjects();
 	WAIT_RESULT Add(CEvent *event);
 	void Remove(CEvent *event);
@@ -90,6 +127,7 @@ public:
 	void SetIPAddress(UINT32 ipAddress_h);
 	void SetIPAddress(char *ipAddress);
 	void SetTimeout(int timeout);
+	void SetThreadConfig(const ADT_THREAD_CONFIG &config);
 	void Start();
 	void Stop();
 	bool SendData(GECCOMMAND* command, CClientContext *clientContext = 0, UINT32 ipAddress_h = 0, UINT16 ipPort_h = 0);
@@ -111,23 +149,125 @@ public:
 	void SetPacketSize(unsigned int packetsize);
 	void SetStreamSerial(uint32_t serial);
 	void SetStreamInterface(const char *ifname);
+	void SetStreamDestination(uint32_t addr_n, bool multicast);
+	void SetNotification(unsigned int requested_data, CEvent *event);
+	void SetSignalFrequency(unsigned int frequency);
+	void SetSignalLatency(unsigned int latency);
+	void SetBatchSize(unsigned int batchSize);
+	void SetGro(bool enable);
+	void SetReceiveBuffer(int size, uint64_t dataRate);
+	int GetReceiveBufferSize();
+	void SetReceiveQueue(unsigned int queue);
+	void SetBusyPoll(bool enable, int cpu, int busyPollTime, unsigned int spinBudget);
+	void GetBusyPollStats(uint64_t *hits, uint64_t *spins, uint64_t *sleeps);
+	void SetThreadConfig(const ADT_THREAD_CONFIG &config);
+	CReactorSource* GetReactorSource();
+	void Reset();
+	bool Start();
+	void Stop();
+	void SetType(SERVER_TYPE type);
+	void SetDumpWriter(CDumpWriter *dumpWriter);
+	unsigned int GetReceivedData();
+	unsigned int GetMaxPacketNo();
+	unsigned int GetPacketNo();
+	const unsigned char* GetPacket(unsigned int packetNo);
+	void ReleasePackets(unsigned int packetNo);
+	uint64_t GetPacketTime(unsigned int packetNo);
+	uint64_t GetSocketDrops();
+	void GetStreamStats(ADT_STREAM_STATS *stats);
+};
+
+class CLnxRingServer : public CAPDServer
+{
+	friend class CLnxFactory;
+private:
+	CLnxRingServer();
+	CLnxRingServer(const CLnxRingServer&);
+	CLnxRingServer& operator=(const CLnxRingServer&);
+	CPacketRingServer *m_pServer;
+public:
+	~CLnxRingServer();
+	void SetListeningPort(UINT16 port_h);
+	void SetBuffer(unsigned char *buffer, ULONGLONG size);
+	void SetPacketSize(unsigned int packetsize);
+	void SetStreamSerial(uint32_t serial);
+	void SetStreamInterface(const char *ifname);
+	void SetStreamDestination(uint32_t addr_n, bool multicast);
+	void SetNotification(unsigned int requested_data, CEvent *event);
+	void SetSignalFrequency(unsigned int frequency);
+	void SetSignalLatency(unsigned int latency);
+	void SetBatchSize(unsigned int batchSize);
+	void SetGro(bool enable);
+	void SetReceiveBuffer(int size, uint64_t dataRate);
+	int GetReceiveBufferSize();
+	void SetReceiveQueue(unsigned int queue);
+	void SetBusyPoll(bool enable, int cpu, int busyPollTime, unsigned int spinBudget);
+	void GetBusyPollStats(uint64_t *hits, uint64_t *spins, uint64_t *sleeps);
+	void SetThreadConfig(const ADT_THREAD_CONFIG &config);
+	CReactorSource* GetReactorSource();
+	void Reset();
+	bool Start();
+	void Stop();
+	void SetType(SERVER_TYPE type);
+	void SetDumpWriter(CDumpWriter *dumpWriter);
+	unsigned int GetReceivedData();
+	unsigned int GetMaxPacketNo();
+	unsigned int GetPacketNo();
+	const unsigned char* GetPacket(unsigned int packetNo);
+	void ReleasePackets(unsigned int packetNo);
+	uint64_t GetPacketTime(unsigned int packetNo);
+	uint64_t GetSocketDrops();
+	void GetStreamStats(ADT_STREAM_STATS *stats);
+};
+
+class CLnxXskServer : public CAPDServer
+{
+	friend class CLnxFactory;
+private:
+	CLnxXskServer();
+	CLnxXskServer(const CLnxXskServer&);
+	CLnxXskServer& operator=(const CLnxXskServer&);
+	CXskServer *m_pServer;
+public:
+	~CLnxXskServer();
+	void SetListeningPort(UINT16 port_h);
+	void SetBuffer(unsigned char *buffer, ULONGLONG size);
+	void SetPacketSize(unsigned int packetsize);
+	void SetStreamSerial(uint32_t serial);
+	void SetStreamInterface(const char *ifname);
+	void SetStreamDestination(uint32_t addr_n, bool multicast);
 	void SetNotification(unsigned int requested_data, CEvent *event);
 	void SetSignalFrequency(unsigned int frequency);
+	void SetSignalLatency(unsigned int latency);
+	void SetBatchSize(unsigned int batchSize);
+	void SetGro(bool enable);
+	void SetReceiveBuffer(int size, uint64_t dataRate);
+	int GetReceiveBufferSize();
+	void SetReceiveQueue(unsigned int queue);
+	void SetBusyPoll(bool enable, int cpu, int busyPollTime, unsigned int spinBudget);
+	void GetBusyPollStats(uint64_t *hits, uint64_t *spins, uint64_t *sleeps);
+	void SetThreadConfig(const ADT_THREAD_CONFIG &config);
+	CReactorSource* GetReactorSource();
 	void Reset();
 	bool Start();
 	void Stop();
 	void SetType(SERVER_TYPE type);
-	void SetDumpFile(FILE *dumpFile);
+	void SetDumpWriter(CDumpWriter *dumpWriter);
 	unsigned int GetReceivedData();
 	unsigned int GetMaxPacketNo();
 	unsigned int GetPacketNo();
+	const unsigned char* GetPacket(unsigned int packetNo);
+	void ReleasePackets(unsigned int packetNo);
+	uint64_t GetPacketTime(unsigned int packetNo);
+	uint64_t GetSocketDrops();
+	void GetStreamStats(ADT_STREAM_STATS *stats);
 };
 
 class CLnxNPMAllocator : public CNPMAllocator
 {
 	friend class CLnxFactory;
 private:
-	CLnxNPMAllocator(ULONGLONG requestedSize) throw(CNPMemoryException);
+	CLnxNPMAllocator(ULONGLONG requestedSize, int numaNode) throw(CNPMemoryException);
 
 	class CMemDesc
 	{
@@ -147,6 +287,8 @@ private:
 	ULONGLONG m_BufferSize;
 
 	static void ErrorLog(char *message);
+	static void* MapHugePages(ULONGLONG size, ULONGLONG *mappedSize, const char **pageName);
+	static void SetPreferredNode(void *addr, ULONGLONG size, int numaNode);
 
 	static ULONGLONG m_LockedSoFar;
 
@@ -160,10 +302,10 @@ class CLnxFactory : public  CAPDFactory
 public:
 	CAPDServer* GetServer();
 	CAPDClient* GetClient();
-	CEvent* GetEvent();
+	CEvent* GetEvent(EVENT_KIND kind);
 	CWaitForEvents* GetWaitForEvents();
 	CClientContext* GetClientContext();
-	CNPMAllocator* GetNPMemory(ULONGLONG requestedSize);
+	CNPMAllocator* GetNPMemory(ULONGLONG requestedSize, int numaNode = -1);
 };
 
 #endif  /* __LNXCLASSES_H__ */
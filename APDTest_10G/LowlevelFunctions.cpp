@@ -12,7 +12,7 @@ bool WritePDI(CAPDClient *client, unsigned char address, UINT32 subaddress, unsi
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -61,7 +61,7 @@ bool ReadPDI(CAPDClient *client, unsigned char address, UINT32 subaddress, unsig
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -100,7 +100,7 @@ bool ReadCC(CAPDClient *client, UINT16 acktype, unsigned char *buffer, UINT32 ip
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -130,7 +130,7 @@ bool ReadFlashPage(CAPDClient *client, UINT16 PgAddress, unsigned char *buffer,
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -161,7 +161,7 @@ bool StartFUP(CAPDClient *client, unsigned char * date, unsigned char *buffer, U
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -194,7 +194,7 @@ bool SetupTS(CAPDClient *client, unsigned char channel, int packetSize, UINT16 p
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -222,7 +222,7 @@ bool SetupAllTS(CAPDClient *client, int packetsize_1, int packetsize_2, int pack
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -262,7 +262,7 @@ bool ShutupTS(CAPDClient *client, unsigned char channel)
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -291,7 +291,7 @@ bool ShutupAllTS(CAPDClient *client)
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -325,7 +325,7 @@ bool SetIP(CAPDClient *client, UINT32 ip_h)
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -361,7 +361,7 @@ bool CCControl(CAPDClient *client, int opcode, int length, unsigned char *buffer
 
 	CAPDFactory *factory = CAPDFactory::GetAPDFactory();
 	CClientContext *clientContext = factory->GetClientContext();
-	CEvent *event = factory->GetEvent();
+	CEvent *event = factory->GetEvent(CAPDFactory::EK_FUTEX);
 	clientContext->pEvent = event;
 	CWaitForEvents *wait = factory->GetWaitForEvents();
 	wait->Add(event);
@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+#include "PacketRingServer.h"
+#include "CamServer.h"
+#include "LnxClasses.h"
+
+
+CPacketRingServer::CPacketRingServer() : UDPBase(), Thread(),
+	m_port_n(0),
+	m_type(0),
+	m_PacketSize(0),
+	m_RequestedData(0),
+	m_SignalEvent(NULL),
+	m_Length(0),
+	m_DataReceived(0),
+	m_UserData(0),
+	m_MaxPacketNo(0),
+	m_PacketCounter(),
+	m_SignalFrequency(1),
+	m_PacketSocket(-1),
+	m_Ring(NULL),
+	m_RingSize(0),
+	m_BlockNum(0),
+	m_Packets(NULL),
+	m_BlockEnd(NULL),
+	m_ReleaseLock(),
+	m_CompletedBlocks(0),
+	m_ReleasedBlocks(0),
+	m_ConsumedPackets(0),
+	m_DumpWriter(NULL),
+	m_StreamSerial(0),
+	m_DestinationAddr(inet_addr(DEF_MULTICAST_GROUP)),
+	m_Multicast(true),
+	m_Interfacename()
+{
+}
+
+
+CPacketRingServer::~CPacketRingServer()
+{
+	Stop();
+	CloseRing();
+
+	delete m_DumpWriter;
+}
+
+
+/*
+ * The ring holds at least the primary buffer. The packet table must be larger than the number of stream
+ * packets fitting into the ring, so a table entry is never reused while its packet is still in the ring.
+ */
+void CPacketRingServer::UpdateGeometry()
+{
+	m_BlockNum = std::max((uint64_t)RING_MIN_BLOCKS, (m_Length + RING_BLOCK_SIZE - 1) / RING_BLOCK_SIZE);
+	m_MaxPacketNo = (m_PacketSize > 0) ? m_BlockNum * (RING_BLOCK_SIZE / m_PacketSize) + 1 : 0;
+}
+
+
+unsigned int CPacketRingServer::Handler(void)
+{
+	try
+	{
+		/*
+		 * The previous ring is kept until now, the data processor may read it after the server stopped.
+		 */
+		CloseRing();
+
+		int ifindex = 0;
+		if (m_Interfacename[0] != '\0')
+		{
+			ifindex = if_nametoindex(m_Interfacename);
+			if (ifindex == 0)
+			{
+				m_ErrorCode = errno;
+				fprintf(stderr, "Cannot get ifindex of %s: %s\n", m_Interfacename, strerror(m_ErrorCode));
+				return -1;
+			}
+		}
+
+		if (OpenRing(ifindex) == false)
+		{
+			CloseRing();
+			return -1;
+		}
+
+		if (ClaimDestination(ifindex) == false)
+			return -1;
+
+		socketRAII sockraii(m_Socket);
+
+		CLnxEvent networkEvent(m_PacketSocket);
+
+		CLnxWaitForEvents waitObjects;
+		waitObjects.Add(&networkEvent);
+		waitObjects.Add(m_ExitSignal);
+
+		m_ErrorCode = 0;
+
+		InitDone();
+
+		bool quit = false;
+		bool pending = false;
+		while (!quit)
+		{
+			if (IsBlockReady())
+			{
+				OnBlock(GetBlock(m_CompletedBlocks % m_BlockNum));
+				pending = false;
+
+				if (m_ExitSignal->IsSignaled())
+					quit = true;
+				continue;
+			}
+
+			/*
+			 * The socket stays readable while the data processor holds blocks, so after a wakeup without
+			 * a new block the receiver sleeps instead of polling again.
+			 */
+			if (pending)
+			{
+				if (m_ExitSignal->Wait(RING_BLOCK_TIMEOUT))
+					quit = true;
+				pending = false;
+				continue;
+			}
+
+			int index = -1;
+			if (waitObjects.WaitAny(-1, &index) != CWaitForEvents::WR_OK)
+			{
+				fprintf(stderr, "WaitAny is not WR_OK!\n");
+			}
+
+			switch (index)
+			{
+				case 0:
+					pending = true;
+					break;
+				case 1:
+					// Close request
+					quit = true;
+					break;
+				default:
+					break;
+			}
+		}
+		m_ExitSignal->Reset();
+
+		struct tpacket_stats_v3 stats;
+		socklen_t size = sizeof(stats);
+		if (getsockopt(m_PacketSocket, SOL_PACKET, PACKET_STATISTICS, &stats, &size) == 0 && stats.tp_drops)
+			fprintf(stderr, "Packet ring dropped %u packets\n", stats.tp_drops);
+	}
+	catch (...)
+	{
+	}
+
+	return 0;
+}
+
+
+bool CPacketRingServer::OpenRing(int ifindex)
+{
+	/*
+	 * Protocol 0: nothing is received until the filter and the ring are set up and the socket is bound.
+	 */
+	m_PacketSocket = socket(AF_PACKET, SOCK_DGRAM, 0);
+	if (m_PacketSocket == -1)
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot create packet socket: %s\n", strerror(m_ErrorCode));
+		if (m_ErrorCode == EPERM)
+			fprintf(stderr, "The packet ring needs CAP_NET_RAW, run as root or use the socket backend\n");
+		return false;
+	}
+
+	fcntl(m_PacketSocket, F_SETFD, FD_CLOEXEC);
+
+	int version = TPACKET_V3;
+	if (setsockopt(m_PacketSocket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)))
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot set TPACKET_V3: %s\n", strerror(m_ErrorCode));
+		return false;
+	}
+
+	if (AttachFilter() == false)
+		return false;
+
+	struct tpacket_req3 req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = m_BlockNum;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = m_BlockNum * (RING_BLOCK_SIZE / RING_FRAME_SIZE);
+	req.tp_retire_blk_tov = RING_BLOCK_TIMEOUT;
+	if (setsockopt(m_PacketSocket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)))
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot set up a packet ring of %u blocks: %s\n", m_BlockNum, strerror(m_ErrorCode));
+		return false;
+	}
+
+	m_RingSize = (uint64_t)m_BlockNum * RING_BLOCK_SIZE;
+	void *ring = mmap(NULL, m_RingSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_PacketSocket, 0);
+	if (ring == MAP_FAILED)
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot mmap() the packet ring: %s\n", strerror(m_ErrorCode));
+		return false;
+	}
+	m_Ring = static_cast<unsigned char*>(ring);
+
+	m_Packets = new const unsigned char*[m_MaxPacketNo]();
+	m_BlockEnd = new unsigned int[m_BlockNum]();
+	m_CompletedBlocks = 0;
+	m_ReleasedBlocks = 0;
+	m_ConsumedPackets = 0;
+
+	struct sockaddr_ll sockAddr;
+	memset(&sockAddr, 0, sizeof(sockAddr));
+	sockAddr.sll_family = AF_PACKET;
+	sockAddr.sll_protocol = htons(ETH_P_IP);
+	sockAddr.sll_ifindex = ifindex;
+	if (bind(m_PacketSocket, reinterpret_cast<const sockaddr*>(&sockAddr), sizeof(sockAddr)))
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot bind packet socket to %s: %s\n", ifindex ? m_Interfacename : "all interfaces", strerror(m_ErrorCode));
+		return false;
+	}
+
+	return true;
+}
+
+
+void CPacketRingServer::CloseRing()
+{
+	if (m_Ring)
+	{
+		if (munmap(m_Ring, m_RingSize))
+			fprintf(stderr, "Cannot munmap() the packet ring: %s\n", strerror(errno));
+		m_Ring = NULL;
+	}
+
+	if (m_PacketSocket != -1)
+	{
+		close(m_PacketSocket);
+		m_PacketSocket = -1;
+	}
+
+	delete[] m_Packets;
+	m_Packets = NULL;
+	delete[] m_BlockEnd;
+	m_BlockEnd = NULL;
+}
+
+
+/*
+ * Only the unfragmented UDP datagrams of this stream enter the ring, the rest of the traffic on the interface
+ * would waste ring space. The socket is SOCK_DGRAM, the offsets are relative to the IP header.
+ */
+bool CPacketRingServer::AttachFilter()
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),                          // IP protocol
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 8),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),                          // Fragment offset
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 6, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16),                         // Destination address
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(m_DestinationAddr), 0, 4),
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),                         // IP header length
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),                          // UDP destination port
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohs(m_port_n), 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0x40000),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+
+	struct sock_fprog program;
+	program.len = sizeof(code) / sizeof(code[0]);
+	program.filter = code;
+
+	if (setsockopt(m_PacketSocket, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)))
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot attach the packet filter: %s\n", strerror(m_ErrorCode));
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * The packet socket only copies the datagrams, a plain UDP socket stands in for the stream in the IP stack.
+ * Multicast: it joins the group. Unicast: it holds the port, otherwise the stack would answer every datagram
+ * with an ICMP port unreachable. It is never read, its copies are dropped by the smallest socket buffer.
+ */
+bool CPacketRingServer::ClaimDestination(int ifindex)
+{
+	if (CreateSocket() == false)
+		return false;
+
+	if (m_Multicast)
+	{
+		struct ip_mreqn mult;
+		mult.imr_multiaddr.s_addr = m_DestinationAddr;
+		mult.imr_address.s_addr = INADDR_ANY;
+		mult.imr_ifindex = ifindex;
+		if (setsockopt(m_Socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mult, sizeof(mult)) < 0)
+		{
+			m_ErrorCode = errno;
+			fprintf(stderr, "Socket multicast-group setting error %s.\n", strerror(m_ErrorCode));
+			close(m_Socket);
+			m_Socket = -1;
+			return false;
+		}
+	}
+	else
+	{
+		int size = 0;
+		setsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+		struct sockaddr_in sockAddr;
+		memset(&sockAddr, 0, sizeof(sockAddr));
+		sockAddr.sin_family = AF_INET;
+		sockAddr.sin_port = m_port_n;
+		sockAddr.sin_addr.s_addr = m_DestinationAddr;
+		if (bind(m_Socket, reinterpret_cast<const sockaddr*>(&sockAddr), sizeof(sockAddr)))
+		{
+			m_ErrorCode = errno;
+			fprintf(stderr, "Cannot bind to port %d of the stream destination: %s\n", ntohs(m_port_n), strerror(m_ErrorCode));
+			close(m_Socket);
+			m_Socket = -1;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * The next block can be processed if the kernel handed it over and the data processor released
+ * its previous contents.
+ */
+bool CPacketRingServer::IsBlockReady()
+{
+	if (m_CompletedBlocks - __atomic_load_n(&m_ReleasedBlocks, __ATOMIC_ACQUIRE) >= m_BlockNum)
+		return false;
+
+	struct tpacket_block_desc *block = GetBlock(m_CompletedBlocks % m_BlockNum);
+	return (__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) != 0;
+}
+
+
+/*
+ * Walks the frames of a retired block and enters the stream packets into the packet table.
+ * The counters are published once per block and the data processor is signaled at most once.
+ */
+void CPacketRingServer::OnBlock(struct tpacket_block_desc *block)
+{
+	unsigned int packetCounter = m_PacketCounter.Load();
+	uint64_t dataReceived = m_DataReceived;
+	uint64_t userData = m_UserData;
+	bool signal = false;
+
+	const unsigned char *frame = reinterpret_cast<const unsigned char*>(block) + block->hdr.bh1.offset_to_first_pkt;
+	for (unsigned int i = 0; i < block->hdr.bh1.num_pkts; ++i)
+	{
+		const struct tpacket3_hdr *header = reinterpret_cast<const struct tpacket3_hdr*>(frame);
+
+		unsigned int length = 0;
+		const unsigned char *packet = GetStreamPacket(header, &length);
+		if (packet)
+		{
+			m_Packets[packetCounter % m_MaxPacketNo] = packet;
+			if (CountPacket(packet, length, packetCounter, dataReceived, userData))
+				signal = true;
+		}
+
+		frame += header->tp_next_offset;
+	}
+
+	m_DataReceived = dataReceived;
+	m_UserData = userData;
+	m_PacketCounter.Publish(packetCounter);
+
+	{
+		MutexGuard guard(m_ReleaseLock);
+		m_BlockEnd[m_CompletedBlocks % m_BlockNum] = packetCounter;
+		++m_CompletedBlocks;
+		// Blocks without unprocessed packets go back to the kernel right away
+		ReleaseBlocks();
+	}
+
+	if (signal && m_SignalEvent)
+		m_SignalEvent->Set();
+}
+
+
+/*
+ * Returns the UDP payload of a frame if it is a complete packet of this stream, NULL otherwise.
+ */
+const unsigned char* CPacketRingServer::GetStreamPacket(const struct tpacket3_hdr *frame, unsigned int *length) const
+{
+	const unsigned char *data = reinterpret_cast<const unsigned char*>(frame) + frame->tp_net;
+	unsigned int snaplen = frame->tp_snaplen;
+
+	if (snaplen < sizeof(struct iphdr))
+		return NULL;
+
+	const struct iphdr *ip = reinterpret_cast<const struct iphdr*>(data);
+	unsigned int ipHeaderLength = ip->ihl * 4;
+	if (ip->protocol != IPPROTO_UDP || ip->daddr != m_DestinationAddr || snaplen < ipHeaderLength + sizeof(struct udphdr))
+		return NULL;
+
+	const struct udphdr *udp = reinterpret_cast<const struct udphdr*>(data + ipHeaderLength);
+	if (udp->dest != m_port_n)
+		return NULL;
+
+	unsigned int payloadLength = ntohs(udp->len) - sizeof(struct udphdr);
+	if (payloadLength != m_PacketSize || snaplen < ipHeaderLength + sizeof(struct udphdr) + payloadLength)
+		return NULL;
+
+	*length = payloadLength;
+	return data + ipHeaderLength + sizeof(struct udphdr);
+}
+
+
+/*
+ * Same accounting as CCamServer::CountPacket(), but the packet stays in the ring.
+ */
+bool CPacketRingServer::CountPacket(const unsigned char *pBuffer, int bytes_received, unsigned int &packetCounter, uint64_t &dataReceived, uint64_t &userData)
+{
+	if (m_DumpWriter)
+		m_DumpWriter->Write(pBuffer, bytes_received);
+
+	return CountStreamPacket(pBuffer, bytes_received, m_StreamSerial, m_type, m_RequestedData, m_SignalFrequency,
+		packetCounter, dataReceived, userData);
+}
+
+
+void CPacketRingServer::ReleasePackets(unsigned int packetNo)
+{
+	MutexGuard guard(m_ReleaseLock);
+	m_ConsumedPackets = packetNo;
+	ReleaseBlocks();
+}
+
+
+/*
+ * Hands the completed blocks back to the kernel in ring order, as long as all of their packets are consumed.
+ * m_ReleaseLock must be held.
+ */
+void CPacketRingServer::ReleaseBlocks()
+{
+	while (m_ReleasedBlocks != m_CompletedBlocks)
+	{
+		unsigned int block = m_ReleasedBlocks % m_BlockNum;
+		if ((int)(m_BlockEnd[block] - m_ConsumedPackets) > 0)
+			break;
+
+		__atomic_store_n(&GetBlock(block)->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		__atomic_store_n(&m_ReleasedBlocks, m_ReleasedBlocks + 1, __ATOMIC_RELEASE);
+	}
+}
+
+
+void CPacketRingServer::OnStop()
+{
+	// Writes out the rest of the dump, the drop count stays until the next dump
+	if (m_DumpWriter)
+		m_DumpWriter->Close();
+
+	if (m_SignalEvent)
+		m_SignalEvent->Set();
+}
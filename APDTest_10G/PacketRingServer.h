@@ -0,0 +1,171 @@
+#pragma once
+#ifndef __PACKETRINGSERVER_H__
+
+#define __PACKETRINGSERVER_H__
+
+#include <net/if.h>
+#include <linux/if_packet.h>
+
+#include "InterfaceDefs.h"
+#include "SysLnxClasses.h"
+#include "DumpWriter.h"
+
+#define RING_BLOCK_SIZE     (4 * 1024 * 1024) // Size of one block of the TPACKET_V3 ring
+#define RING_FRAME_SIZE     (16 * 1024)       // Nominal frame size, a jumbo frame must fit
+#define RING_MIN_BLOCKS     8
+#define RING_BLOCK_TIMEOUT  2                 // ms, the kernel retires a partially filled block after this
+
+/*
+ * Stream server receiving through an AF_PACKET TPACKET_V3 memory mapped ring.
+ *
+ * The kernel fills whole blocks of frames. The stream packets are not copied, the data processor reads them
+ * in place through GetPacket(). A block is handed back to the kernel when all of its packets are released
+ * by ReleasePackets(), so the ring can not be overwritten under the data processor.
+ */
+class CPacketRingServer : public UDPBase, public Thread
+{
+public:
+	CPacketRingServer();
+	~CPacketRingServer();
+
+	void SetListeningPort(int port_h) { m_port_n = htons(port_h); };
+
+	// The ring is sized after the primary buffer, the buffer itself is not used.
+	void SetBuffer(uint8_t * /*buffer*/, uint64_t length)
+	{
+		m_Length = length;
+		UpdateGeometry();
+	};
+
+	void SetPacketSize(int packetSize)
+	{
+		m_PacketSize = packetSize;
+		UpdateGeometry();
+	};
+
+	void SetStreamSerial(uint32_t serial)
+	{
+		m_StreamSerial = serial;
+	};
+
+	void SetNotification(uint64_t requestedData, CEvent *hEvent)
+	{
+		m_RequestedData = requestedData;
+		m_SignalEvent = hEvent;
+	};
+
+	void SetSignalFrequency(unsigned int frequency)
+	{
+		if (frequency > 0)
+		{
+			m_SignalFrequency = std::min(frequency, m_MaxPacketNo / 2);
+		}
+	};
+
+	void Reset()
+	{
+		m_DataReceived = 0;
+		m_UserData = 0;
+		m_PacketCounter.Publish(0);
+	};
+
+	void SetType(int type)
+	{
+		m_type = type;
+	};
+
+	// Takes over the writer, NULL: no dump
+	void SetDumpWriter(CDumpWriter *dumpWriter)
+	{
+		delete m_DumpWriter;
+		m_DumpWriter = dumpWriter;
+	};
+
+	uint64_t GetDumpDrops() const { return m_DumpWriter ? m_DumpWriter->GetDroppedPackets() : 0; };
+
+	void SetInterfacename(const char *ifname)
+	{
+		strncpy(m_Interfacename, ifname, IFNAMSIZ);
+		m_Interfacename[IFNAMSIZ] = '\0';
+	}
+
+	void SetDestination(uint32_t addr_n, bool multicast)
+	{
+		m_DestinationAddr = addr_n;
+		m_Multicast = multicast;
+	}
+
+	uint64_t GetReceivedData() { return m_DataReceived; };
+	uint64_t GetMaxPacketNo() { return m_MaxPacketNo; };
+	// The packets before it are in the ring, complete
+	uint64_t GetPacketNo() { return m_PacketCounter.Acquire(); };
+
+	const unsigned char* GetPacket(unsigned int packetNo) const
+	{
+		return m_Packets[packetNo % m_MaxPacketNo];
+	};
+
+	void ReleasePackets(unsigned int packetNo);
+
+private:
+	CPacketRingServer(const CPacketRingServer&);
+	CPacketRingServer& operator=(const CPacketRingServer&);
+
+	unsigned int Handler(void);
+	void OnStop();
+
+	void UpdateGeometry();
+	bool OpenRing(int ifindex);
+	void CloseRing();
+	bool AttachFilter();
+	bool ClaimDestination(int ifindex);
+
+	struct tpacket_block_desc* GetBlock(unsigned int block) const
+	{
+		return reinterpret_cast<struct tpacket_block_desc*>(m_Ring + (uint64_t)block * RING_BLOCK_SIZE);
+	};
+	bool IsBlockReady();
+	void OnBlock(struct tpacket_block_desc *block);
+	const unsigned char* GetStreamPacket(const struct tpacket3_hdr *frame, unsigned int *length) const;
+	bool CountPacket(const unsigned char *pBuffer, int bytes_received, unsigned int &packetCounter, uint64_t &dataReceived, uint64_t &userData);
+	void ReleaseBlocks();
+
+	int m_port_n;
+	int m_type; // 0_ one-shot, 1:cyclic
+	unsigned int m_PacketSize;
+	uint64_t m_RequestedData;
+	CEvent *m_SignalEvent;
+
+	uint64_t m_Length;
+	uint64_t m_DataReceived;
+	uint64_t m_UserData;
+	unsigned int m_MaxPacketNo;  // The size of the packet table, larger than the number of packets the ring can hold
+	PacketCursor m_PacketCounter;
+	unsigned int m_SignalFrequency;
+
+	int            m_PacketSocket;
+	unsigned char *m_Ring;
+	uint64_t       m_RingSize;
+	unsigned int   m_BlockNum;
+
+	const unsigned char **m_Packets; // Stream packets in the ring, indexed by packet number % m_MaxPacketNo
+	unsigned int *m_BlockEnd;        // Packet counter after the last packet of each block
+
+	/*
+	 * Blocks are counted from the start of the measurement.
+	 * m_CompletedBlocks are processed by the receiver, m_ReleasedBlocks are given back to the kernel.
+	 * Both sides release blocks, m_ReleaseLock serializes them.
+	 */
+	Mutex        m_ReleaseLock;
+	unsigned int m_CompletedBlocks;
+	unsigned int m_ReleasedBlocks;
+	unsigned int m_ConsumedPackets;
+
+	CDumpWriter *m_DumpWriter;
+	uint32_t m_StreamSerial;
+	uint32_t m_DestinationAddr;
+	bool     m_Multicast;
+	char     m_Interfacename[IFNAMSIZ + 1];
+};
+
+#endif  /* __PACKETRINGSERVER_H__ */
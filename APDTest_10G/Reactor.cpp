@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "Reactor.h"
+#include "LnxClasses.h"
+#include "DataEvaluation.h"
+
+
+/* ******************* CReactorThread ******************* */
+
+CReactorThread::CReactorThread() :
+	Thread(),
+	m_Epoll(-1),
+	m_StreamCount(0),
+	m_Lock(),
+	m_Entries()
+{
+}
+
+
+CReactorThread::~CReactorThread()
+{
+	Stop();
+
+	for (std::set<REACTOR_ENTRY*>::iterator it = m_Entries.begin(); it != m_Entries.end(); ++it)
+		delete *it;
+	m_Entries.clear();
+
+	if (m_Epoll != -1)
+		close(m_Epoll);
+}
+
+
+/*
+ * Creates the epoll set with the exit signal of the thread in it (registered with a NULL entry).
+ */
+bool CReactorThread::Create()
+{
+	m_Epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (m_Epoll == -1)
+	{
+		fprintf(stderr, "Cannot create epoll set: %s\n", strerror(errno));
+		return false;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, static_cast<CLnxEvent*>(m_ExitSignal)->readFd(), &event))
+	{
+		fprintf(stderr, "Cannot add exit signal to epoll set: %s\n", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+
+bool CReactorThread::AddSource(CReactorSource *source)
+{
+	REACTOR_ENTRY *entry = new REACTOR_ENTRY();
+	entry->source = source;
+	entry->decoder = NULL;
+	entry->timer = false;
+	entry->fd = source->OpenSource();
+	if (entry->fd == -1)
+	{
+		delete entry;
+		return false;
+	}
+
+	if (AddEntry(entry) == false)
+	{
+		source->CloseSource();
+		delete entry;
+		return false;
+	}
+
+	if (source->TimerSource() != -1)
+	{
+		REACTOR_ENTRY *timer = new REACTOR_ENTRY();
+		timer->source = source;
+		timer->decoder = NULL;
+		timer->timer = true;
+		timer->fd = source->TimerSource();
+		if (AddEntry(timer) == false)
+		{
+			delete timer;
+			RemoveSource(source);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+bool CReactorThread::AddDecoder(CDataEvaluation *decoder, CEvent *dataNotification)
+{
+	REACTOR_ENTRY *entry = new REACTOR_ENTRY();
+	entry->source = NULL;
+	entry->decoder = decoder;
+	entry->timer = false;
+	entry->fd = static_cast<CLnxEvent*>(dataNotification)->readFd();
+
+	decoder->BeginProcessing();
+
+	if (AddEntry(entry) == false)
+	{
+		decoder->EndProcessing();
+		delete entry;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Removes the socket and the timer of the source before closing them.
+ */
+bool CReactorThread::RemoveSource(CReactorSource *source)
+{
+	MutexGuard guard(m_Lock);
+
+	bool found = false;
+	for (std::set<REACTOR_ENTRY*>::iterator it = m_Entries.begin(); it != m_Entries.end();)
+	{
+		REACTOR_ENTRY *entry = *it++;
+		if (entry->source == source)
+		{
+			RemoveEntry(entry);
+			delete entry;
+			found = true;
+		}
+	}
+
+	if (found)
+		source->CloseSource();
+
+	return found;
+}
+
+
+bool CReactorThread::RemoveDecoder(CDataEvaluation *decoder)
+{
+	MutexGuard guard(m_Lock);
+
+	for (std::set<REACTOR_ENTRY*>::iterator it = m_Entries.begin(); it != m_Entries.end(); ++it)
+	{
+		REACTOR_ENTRY *entry = *it;
+		if (entry->decoder == decoder)
+		{
+			RemoveEntry(entry);
+			decoder->EndProcessing();
+			decoder->OnStop();
+			delete entry;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+bool CReactorThread::AddEntry(REACTOR_ENTRY *entry)
+{
+	MutexGuard guard(m_Lock);
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = entry;
+	if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, entry->fd, &event))
+	{
+		fprintf(stderr, "Cannot add descriptor %d to epoll set: %s\n", entry->fd, strerror(errno));
+		return false;
+	}
+
+	m_Entries.insert(entry);
+	if (entry->source && entry->timer == false)
+		++m_StreamCount;
+
+	return true;
+}
+
+
+/*
+ * m_Lock must be held. The entry is not deleted.
+ */
+void CReactorThread::RemoveEntry(REACTOR_ENTRY *entry)
+{
+	if (epoll_ctl(m_Epoll, EPOLL_CTL_DEL, entry->fd, NULL))
+		fprintf(stderr, "Cannot remove descriptor %d from epoll set: %s\n", entry->fd, strerror(errno));
+
+	m_Entries.erase(entry);
+	if (entry->source && entry->timer == false)
+		--m_StreamCount;
+}
+
+
+/*
+ * m_Lock must be held. The epoll set is level triggered: a socket not drained within the
+ * read budget is reported again by the next epoll_wait().
+ */
+void CReactorThread::Dispatch(REACTOR_ENTRY *entry)
+{
+	if (entry->timer)
+	{
+		entry->source->OnSourceTimer();
+		return;
+	}
+
+	if (entry->source)
+	{
+		for (int reads = 0; reads < REACTOR_READ_BUDGET; ++reads)
+		{
+			if (entry->source->ReadSource() <= 0)
+				break;
+		}
+		return;
+	}
+
+	if (entry->decoder->ReactorStep() == false)
+	{
+		CDataEvaluation *decoder = entry->decoder;
+		RemoveEntry(entry);
+		delete entry;
+		decoder->EndProcessing();
+		decoder->OnStop();
+	}
+}
+
+
+unsigned int CReactorThread::Handler(void)
+{
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	InitDone();
+
+	for (;;)
+	{
+		int n = epoll_wait(m_Epoll, events, REACTOR_MAX_EVENTS, -1);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "epoll_wait() %s\n", strerror(errno));
+			return -1;
+		}
+
+		MutexGuard guard(m_Lock);
+
+		for (int i = 0; i < n; ++i)
+		{
+			REACTOR_ENTRY *entry = static_cast<REACTOR_ENTRY*>(events[i].data.ptr);
+			if (entry == NULL)
+				return 0; // Exit signal
+
+			if (m_Entries.count(entry) == 0)
+				continue; // Removed since epoll_wait()
+
+			Dispatch(entry);
+		}
+	}
+
+	return 0;
+}
+
+
+/* ******************* CReactor ******************* */
+
+CReactor::CReactor() :
+	m_Lock(),
+	m_Threads()
+{
+}
+
+
+CReactor::~CReactor()
+{
+	Stop();
+}
+
+
+/*
+ * The threads are spread over the CPUs the process may run on, one thread per CPU.
+ */
+bool CReactor::Start(unsigned int threads)
+{
+	MutexGuard guard(m_Lock);
+
+	if (m_Threads.empty() == false)
+		return true;
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	if (sched_getaffinity(0, sizeof(cpuset), &cpuset))
+	{
+		fprintf(stderr, "Cannot get the CPUs of the process: %s\n", strerror(errno));
+		CPU_ZERO(&cpuset);
+	}
+
+	std::vector<int> cpus;
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if (CPU_ISSET(cpu, &cpuset))
+			cpus.push_back(cpu);
+	}
+
+	if (threads == 0)
+		threads = cpus.empty() ? 1 : cpus.size();
+
+	for (unsigned int i = 0; i < threads; ++i)
+	{
+		CReactorThread *thread = new CReactorThread();
+
+		ADT_THREAD_CONFIG config;
+		memset(&config, 0, sizeof(config));
+		config.cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+		config.numaNode = -1;
+		snprintf(config.name, sizeof(config.name), "apd-reactor%u", i % 10000);
+		thread->SetThreadConfig(config);
+
+		if (thread->Create() == false || thread->Start(true) == false)
+		{
+			fprintf(stderr, "Cannot start reactor thread %u\n", i);
+			delete thread;
+			break;
+		}
+
+		m_Threads.push_back(thread);
+	}
+
+	return m_Threads.empty() == false;
+}
+
+
+void CReactor::Stop()
+{
+	MutexGuard guard(m_Lock);
+
+	for (std::vector<CReactorThread*>::iterator it = m_Threads.begin(); it != m_Threads.end(); ++it)
+		delete *it;
+	m_Threads.clear();
+}
+
+
+bool CReactor::Add(CReactorSource *source, CDataEvaluation *decoder, CEvent *dataNotification)
+{
+	MutexGuard guard(m_Lock);
+
+	if (m_Threads.empty())
+		return false;
+
+	CReactorThread *thread = m_Threads[0];
+	for (std::vector<CReactorThread*>::iterator it = m_Threads.begin(); it != m_Threads.end(); ++it)
+	{
+		if ((*it)->GetStreamCount() < thread->GetStreamCount())
+			thread = *it;
+	}
+
+	/*
+	 * The decoder is registered first, so that it is there when the first packets are signaled
+	 */
+	if (thread->AddDecoder(decoder, dataNotification) == false)
+		return false;
+
+	if (thread->AddSource(source) == false)
+	{
+		thread->RemoveDecoder(decoder);
+		return false;
+	}
+
+	return true;
+}
+
+
+void CReactor::RemoveSource(CReactorSource *source)
+{
+	MutexGuard guard(m_Lock);
+
+	for (std::vector<CReactorThread*>::iterator it = m_Threads.begin(); it != m_Threads.end(); ++it)
+	{
+		if ((*it)->RemoveSource(source))
+			return;
+	}
+}
+
+
+void CReactor::RemoveDecoder(CDataEvaluation *decoder)
+{
+	MutexGuard guard(m_Lock);
+
+	for (std::vector<CReactorThread*>::iterator it = m_Threads.begin(); it != m_Threads.end(); ++it)
+	{
+		if ((*it)->RemoveDecoder(decoder))
+			return;
+	}
+}
+
+
+unsigned int CReactor::GetStreamCount()
+{
+	MutexGuard guard(m_Lock);
+
+	unsigned int streams = 0;
+	for (std::vector<CReactorThread*>::iterator it = m_Threads.begin(); it != m_Threads.end(); ++it)
+		streams += (*it)->GetStreamCount();
+
+	return streams;
+}
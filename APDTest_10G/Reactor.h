@@ -0,0 +1,106 @@
+#pragma once
+#ifndef __REACTOR_H__
+
+#define __REACTOR_H__
+
+#include <set>
+#include <vector>
+
+#include "InterfaceDefs.h"
+#include "SysLnxClasses.h"
+
+#define REACTOR_MAX_EVENTS  64 // Events taken by one epoll_wait()
+#define REACTOR_READ_BUDGET 64 // Reads of a ready socket before the other sockets get their turn
+
+class CDataEvaluation;
+
+/*
+ * A receiver that can be served by a reactor thread instead of its own thread.
+ */
+class CReactorSource
+{
+public:
+	virtual ~CReactorSource() {};
+
+	virtual int OpenSource() = 0;  // Sets up the non-blocking socket, returns its descriptor or -1
+	virtual int ReadSource() = 0;  // Reads what is available without blocking, returns the number of packets read
+	virtual void CloseSource() = 0;
+	virtual int TimerSource() { return -1; }; // After OpenSource(): a timer descriptor of the source, -1: none
+	virtual void OnSourceTimer() {};          // The timer descriptor is readable
+};
+
+/*
+ * One reactor thread: a single epoll set with the sockets and the data notifications of its streams.
+ * A stream is received and decoded on the same thread, the decoder runs when the receiver signals.
+ */
+class CReactorThread : public Thread
+{
+public:
+	CReactorThread();
+	~CReactorThread();
+
+	bool Create();
+	bool AddSource(CReactorSource *source);
+	bool AddDecoder(CDataEvaluation *decoder, CEvent *dataNotification);
+	bool RemoveSource(CReactorSource *source);
+	bool RemoveDecoder(CDataEvaluation *decoder);
+
+	unsigned int GetStreamCount() const { return m_StreamCount; };
+
+private:
+	CReactorThread(const CReactorThread&);
+	CReactorThread& operator=(const CReactorThread&);
+
+	struct REACTOR_ENTRY
+	{
+		int              fd;
+		CReactorSource  *source;
+		CDataEvaluation *decoder;
+		bool             timer;  // fd is the timer of source
+	};
+
+	unsigned int Handler(void);
+	bool AddEntry(REACTOR_ENTRY *entry);
+	void RemoveEntry(REACTOR_ENTRY *entry);
+	void Dispatch(REACTOR_ENTRY *entry);
+
+	int          m_Epoll;
+	unsigned int m_StreamCount;
+
+	/*
+	 * The entries registered in the epoll set. An event taken by epoll_wait() may belong to an entry
+	 * removed meanwhile, so every event is checked against this set under m_Lock before dispatching.
+	 */
+	Mutex                   m_Lock;
+	std::set<REACTOR_ENTRY*> m_Entries;
+};
+
+/*
+ * A fixed pool of reactor threads shared by all cameras. Streams go to the thread serving the fewest streams.
+ */
+class CReactor
+{
+public:
+	CReactor();
+	~CReactor();
+
+	bool Start(unsigned int threads); // threads = 0: one per CPU the process may run on
+	void Stop();
+
+	// Starts receiving and decoding a stream. The decoder must be set up as for CDataEvaluation::Start().
+	bool Add(CReactorSource *source, CDataEvaluation *decoder, CEvent *dataNotification);
+	void RemoveSource(CReactorSource *source);   // Closes the socket, the decoder gets the remaining packets
+	void RemoveDecoder(CDataEvaluation *decoder); // Finishes the decoder
+
+	unsigned int GetThreadCount() const { return m_Threads.size(); };
+	unsigned int GetStreamCount();
+
+private:
+	CReactor(const CReactor&);
+	CReactor& operator=(const CReactor&);
+
+	Mutex                        m_Lock;
+	std::vector<CReactorThread*> m_Threads;
+};
+
+#endif  /* __REACTOR_H__ */
@@ -1,6 +1,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sched.h>
 
 #include "LnxClasses.h"
 #include "SysLnxClasses.h"
@@ -94,10 +95,15 @@ fprintf(stderr, "Cannot create socket: %s\n", strerror(m_ErrorCode));
  */
 Thread::Thread() :
 	m_ExitSignal(new CLnxEvent()),
+	m_ConfigLock(),
+	m_Config(),
 	m_tid(-1),
+	m_Running(false),
 	m_ThreadStarted(NULL),
 	m_ThreadExited(NULL)
 {
+	m_Config.cpu = -1;
+	m_Config.numaNode = -1;
 }
 
 
@@ -115,8 +121,23 @@ void* Thread::start_handler(void *param)
 {
 	Thread *th = reinterpret_cast<Thread*>(param);
 
+	{
+		MutexGuard guard(th->m_ConfigLock);
+		th->m_Running = true;
+		th->ApplyThreadConfig(pthread_self());
+	}
+
 	unsigned int ret = th->Handler();
 	th->OnStop();
+
+	/*
+	 * SetThreadConfig() applies the config to m_tid only while m_Running is set under the lock,
+	 * so the thread cannot exit and be joined meanwhile.
+	 */
+	{
+		MutexGuard guard(th->m_ConfigLock);
+		th->m_Running = false;
+	}
 	th->m_ThreadExited->Set();
 
 	return reinterpret_cast<void*>(ret);
@@ -130,7 +151,12 @@ bool Thread::Start(bool wait)
 		m_ThreadStarted = new CLnxEvent();
 		m_ThreadExited = new CLnxEvent();
 
-		int status = pthread_create(&m_tid, NULL, Thread::start_handler, this);
+		int status;
+		{
+			// m_tid is stored before the thread can be seen running
+			MutexGuard guard(m_ConfigLock);
+			status = pthread_create(&m_tid, NULL, Thread::start_handler, this);
+		}
 		if (status == 0)
 		{
 			if (wait)
@@ -196,6 +222,97 @@ void Thread::Stop()
 }
 
 
+void Thread::SetThreadConfig(const ADT_THREAD_CONFIG &config)
+{
+	MutexGuard guard(m_ConfigLock);
+	m_Config = config;
+	m_Config.name[sizeof(m_Config.name) - 1] = '\0';
+
+	if (m_Running)
+		ApplyThreadConfig(m_tid);
+}
+
+
+/*
+ * Fills cpuset with the CPUs of a NUMA node. Returns false if the node does not exist.
+ */
+static bool GetNodeCpus(int node, cpu_set_t *cpuset)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return false;
+
+	// The list is like "0-7,16-23"
+	CPU_ZERO(cpuset);
+	int first = 0;
+	int last = 0;
+	int count = 0;
+	char separator = '\0';
+	while (fscanf(file, "%d", &first) == 1)
+	{
+		last = first;
+		if (fscanf(file, "%c", &separator) == 1 && separator == '-')
+		{
+			if (fscanf(file, "%d", &last) != 1 || fscanf(file, "%c", &separator) != 1)
+				separator = '\0';
+		}
+
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu, ++count)
+			CPU_SET(cpu, cpuset);
+
+		if (separator != ',')
+			break;
+	}
+	fclose(file);
+
+	return count > 0;
+}
+
+
+/*
+ * Failures are only reported, the thread runs anyway. m_ConfigLock must be held.
+ */
+void Thread::ApplyThreadConfig(pthread_t tid)
+{
+	const char *name = m_Config.name[0] ? m_Config.name : "thread";
+
+	if (m_Config.cpu >= 0 || m_Config.numaNode >= 0)
+	{
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		if (m_Config.cpu >= 0)
+			CPU_SET(m_Config.cpu, &cpuset);
+		else if (GetNodeCpus(m_Config.numaNode, &cpuset) == false)
+			fprintf(stderr, "Cannot get the CPUs of NUMA node %d for %s\n", m_Config.numaNode, name);
+
+		if (CPU_COUNT(&cpuset) > 0)
+		{
+			int res = pthread_setaffinity_np(tid, sizeof(cpuset), &cpuset);
+			if (res)
+				fprintf(stderr, "Cannot set the affinity of %s: %s\n", name, strerror(res));
+		}
+	}
+
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = m_Config.priority;
+	int res = pthread_setschedparam(tid, m_Config.priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param);
+	if (res)
+	{
+		if (m_Config.priority > 0)
+			fprintf(stderr, "Cannot set SCHED_FIFO priority %d for %s: %s\n", m_Config.priority, name, strerror(res));
+		else
+			fprintf(stderr, "Cannot set SCHED_OTHER for %s: %s\n", name, strerror(res));
+	}
+
+	if (m_Config.name[0])
+		pthread_setname_np(tid, m_Config.name);
+}
+
+
 void Thread::InitDone()
 {
 	m_ThreadStarted->Set();
@@ -7,6 +7,8 @@
 
 #include "InterfaceDefs.h"
 
+#define CACHE_LINE_SIZE 64 // Data written by different threads is kept this far apart
+
 class Mutex
 {
 public:
@@ -22,6 +24,27 @@ private:
 };
 
 
+// Packet count of a stream server, written by its receiver thread only. A reader that sees a count with Acquire()
+// also sees the packets before it in place (Publish() is a release store).
+class PacketCursor
+{
+public:
+	PacketCursor() : m_Count(0) {};
+
+	// Receiver thread: its own count, no ordering needed
+	unsigned int Load() const { return __atomic_load_n(&m_Count, __ATOMIC_RELAXED); };
+	void Publish(unsigned int count) { __atomic_store_n(&m_Count, count, __ATOMIC_RELEASE); };
+
+	// Other threads
+	unsigned int Acquire() const { return __atomic_load_n(&m_Count, __ATOMIC_ACQUIRE); };
+
+private:
+	unsigned int m_Count;
+	PacketCursor(const PacketCursor&);
+	PacketCursor& operator=(const PacketCursor&);
+};
+
+
 class MutexGuard
 {
 public:
@@ -69,6 +92,9 @@ public:
 	bool Start(bool wait = false);
 	void Stop();
 
+	// Affinity, scheduling and name of the thread. Applied at start, or at once if the thread runs.
+	void SetThreadConfig(const ADT_THREAD_CONFIG &config);
+
 protected:
 	CEvent *m_ExitSignal;
 
@@ -80,7 +106,12 @@ protected:
 private:
 	Thread(const Thread &);
 	Thread& operator=(const Thread &);
+	void ApplyThreadConfig(pthread_t tid);
+
+	Mutex              m_ConfigLock;
+	ADT_THREAD_CONFIG  m_Config;
 	pthread_t  m_tid;
+	bool       m_Running;  // The thread is alive and joinable, guarded by m_ConfigLock
 	CEvent    *m_ThreadStarted;
 	CEvent    *m_ThreadExited;
 };
@@ -50,6 +50,11 @@ enum ADT_TRIGGER_MODE {TRM_EXTERNAL, TRM_INTERNAL};
 enum ADT_TRIGGER_EDGE {TRE_NONE, TRE_RISING, TRE_FALLING, TRE_BOTH};
 
 enum ADT_STATE { AS_STANDBY, AS_ARMED, AS_MEASURE, AS_ERROR };
+enum ADT_RECEIVE_BACKEND { RB_SOCKET, RB_PACKET_RING, RB_XDP };
+enum ADT_STREAM_TRANSPORT { STT_MULTICAST, STT_UNICAST };
+enum ADT_RECEIVE_MODE { RM_POLL, RM_BUSY_POLL };
+enum ADT_THREAD_ROLE { THR_RECEIVER, THR_DECODER, THR_COMMAND };
+enum ADT_BUFFER_LAYOUT { BL_CHANNELS, BL_INTERLEAVED };
 
 typedef union _LARGE_INTEGER
 {
@@ -195,6 +200,40 @@ typedef struct ApdCam10G_t_
 	ADC_t      ADC[APD_MAX_ADC_NUM];
 } ApdCam10G_t;
 
+// Placement of an acquisition thread
+typedef struct ADT_THREAD_CONFIG_
+{
+	int  cpu;      // CPU to run on, < 0: any (see numaNode)
+	int  numaNode; // NUMA node to run on if cpu < 0, < 0: any
+	int  priority; // SCHED_FIFO priority (1..99), 0: SCHED_OTHER
+	char name[16]; // Thread name, empty: unnamed
+} ADT_THREAD_CONFIG;
+
+// Receive loop statistics of a stream server in busy poll mode
+typedef struct ADT_BUSY_POLL_STATS_
+{
+	uint64_t hits;   // Reads returning data
+	uint64_t spins;  // Empty reads while spinning
+	uint64_t sleeps; // Spin budget exhausted, waited in poll()
+} ADT_BUSY_POLL_STATS;
+
+// Receive statistics of a stream. Packets lost on the wire: lostPackets - socketDrops.
+typedef struct ADT_STREAM_STATS_
+{
+	uint64_t packets;         // Packets accepted by the receiver
+	uint64_t lostPackets;     // Packets missing from the packet counter sequence, found by the decoder
+	uint64_t latePackets;     // Packets dropped by the decoder, arrived after the reorder window passed them
+	uint64_t socketDrops;     // Packets dropped by the kernel, socket buffer full (SO_RXQ_OVFL)
+	uint64_t decoderOverruns; // Packets dropped (or overwritten) because the primary buffer was full of packets the decoder did not finish
+	uint64_t maxBacklog;      // Most received packets waiting for the decoder
+	uint64_t lastArrival;     // Kernel arrival time of the last packet, ns since the epoch (SO_TIMESTAMPNS)
+	uint64_t minGap;          // Packet inter-arrival times, ns (with UDP_GRO: of the coalesced datagrams)
+	uint64_t maxGap;
+	uint64_t meanGap;
+	uint64_t jitter;          // Smoothed inter-arrival jitter (RFC 3550), ns
+	uint64_t dumpDrops;       // Packets left out of the stream dump, the disk fell behind
+	uint64_t continuityError; // Nonzero: the decoder stopped, the stream could not be followed (stream number changed, too many packets lost)
+} ADT_STREAM_STATS;
 
 #ifdef __cplusplus
 }
@@ -1,15 +1,44 @@
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
 
 #include "UDPServer.h"
 #include "LnxClasses.h"
 
 
+#define BUSY_POLL_EXIT_CHECK 4096 // Loops between two checks of the exit signal in busy poll mode
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+
 CUDPServer::CUDPServer(void) : UDPBase(), Thread(),
-	m_port_n(0)
+	m_port_n(0),
+	m_ActualRcvBufferSize(0),
+	m_Gro(false),
+	m_GroActive(false),
+	m_BusyPoll(false),
+	m_BusyPollCpu(-1),
+	m_BusyPollTime(0),
+	m_SpinBudget(1),
+	m_Hits(0),
+	m_Spins(0),
+	m_Sleeps(0),
+	m_TimerFd(-1),
+	m_TimerDeadline(0)
 {
 }
 
@@ -22,8 +51,6 @@ CUDPServer::~CUDPServer(void)
 
 unsigned int CUDPServer::Handler(void)
 {
-	sockaddr_in sockAddr;
-
 	try
 	{
 		if (CreateSocket() == false)
@@ -33,105 +60,41 @@ unsigned int CUDPServer::Handler(void)
 
 		socketRAII sockraii(m_Socket);
 
-		int rcvBufferSize = GetRcvBufferSize();
-		if (rcvBufferSize != 0)
+		if (SetupSocket() == false)
 		{
-			socklen_t size = sizeof(rcvBufferSize);
-			int actualRcvBufferSize = 0;
-			if (getsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF, &actualRcvBufferSize, &size) == 0)
-			{
-				/*
-				 * The Linux kernel doubles the RCVBUFSIZE value to allow space for bookkeeping overhead and
-				 * returns this doubled value.
-				 */
-				actualRcvBufferSize /= 2;
-			}
-			else
-				fprintf(stderr, "Cannot getsockopt(): %s\n", strerror(errno));
-
-			if (actualRcvBufferSize < rcvBufferSize)
-			{
-fprintf(stderr, "(%u) SO_RCVBUF is %d should be %d\n", size, actualRcvBufferSize, rcvBufferSize);
-				fprintf(stderr, "Setting SO_RCVBUF to %d\n", rcvBufferSize);
-				if (setsockopt(m_Socket,  SOL_SOCKET, SO_RCVBUFFORCE, &rcvBufferSize, size))
-				{
-fprintf(stderr, "Cannot set SO_RCVBUFFORCE: %s\n", strerror(errno));
-					if (setsockopt(m_Socket,  SOL_SOCKET, SO_RCVBUF, &rcvBufferSize, size))
-					{
-						m_ErrorCode = errno;
-						fprintf(stderr, "Cannot set SO_RCVBUF: %s\n", strerror(m_ErrorCode));
-						return -1;
-					}
-				}
-				actualRcvBufferSize = 0;
-				size = sizeof(actualRcvBufferSize);
-				getsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF, &actualRcvBufferSize, &size);
-				actualRcvBufferSize /= 2;
-				if (actualRcvBufferSize < rcvBufferSize)
-				{
-					m_ErrorCode = EPERM;
-					fprintf(stderr, "\nCannot set Receiver Buffer Size to %d bytes!\nPossible workarounds:\n - Run as root\n - Increase /proc/sys/net/core/rmem_max\n\n", rcvBufferSize);
-					return -1;
-				}
-			}
-		}
-
-		sockAddr.sin_family = AF_INET;
-		sockAddr.sin_port = m_port_n;
-		sockAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-		// Binds listening socket to the addres and port.
-		if (bind(m_Socket, reinterpret_cast<const sockaddr*>(&sockAddr), sizeof(sockAddr)))
-		{
-			m_ErrorCode = errno;
-			fprintf(stderr, "Cannot bind to INADDR_ANY:%d : %s", m_port_n, strerror(m_ErrorCode));
 			return -1;
 		}
 
-		int ifindex = 0;
-		if (GetInterfacename()[0] != '\0')
-		{
-			struct ifreq ifr;
-			const char *ifname = GetInterfacename();
-
-			strncpy(ifr.ifr_name, ifname, IFNAMSIZ);
-			if (ioctl(m_Socket, SIOCGIFINDEX, &ifr))
-				fprintf(stderr, "Cannot get ifindex: %s\n", strerror(errno));
-			else
-				ifindex = ifr.ifr_ifindex;
-
-#if 0
-			if (setsockopt(m_Socket, SOL_SOCKET, SO_BINDTODEVICE, ifname, strlen(ifname)) < 0)
-				fprintf(stderr, "Cannot bind to device %s: %s\n", ifname, strerror(errno));
-#endif
-		}
+		if (NeedsTimer() && CreateTimer() == false)
+			return -1;
 
-#ifndef NEVER
-		if (GetMulticastAddr())
-		{
-			struct ip_mreqn mult;
-			mult.imr_multiaddr.s_addr = GetMulticastAddr();
-			mult.imr_address.s_addr = INADDR_ANY;
-			mult.imr_address.s_addr = inet_addr("10.123.13.200");
-			mult.imr_ifindex = ifindex;
-			if (setsockopt(m_Socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mult, sizeof(mult)) < 0)
-			{
-				m_ErrorCode = errno;
-				fprintf(stderr, "Socket multicast-group setting error %s.\n", strerror(errno));
-				return -1;
-			}
-		}
-#endif
 		CLnxEvent networkEvent(m_Socket);
+		CLnxEvent timerEvent(m_TimerFd);
 
 		CLnxWaitForEvents waitObjects;
 		waitObjects.Add(&networkEvent);
 		waitObjects.Add(m_ExitSignal);
+		if (m_TimerFd != -1)
+			waitObjects.Add(&timerEvent);
+
+		if (m_BusyPoll && SetupBusyPoll() == false)
+		{
+			CloseTimer();
+			return -1;
+		}
 
 		m_ErrorCode = 0;
 
 		InitDone();
 
+		if (m_BusyPoll)
+		{
+			BusyPoll(waitObjects);
+			m_ExitSignal->Reset();
+			CloseTimer();
+			return 0;
+		}
+
 		bool quit = false;
 		while (!quit)
 		{
@@ -153,11 +116,17 @@ fprintf(stderr, "Cannot set SO_RCVBUFFORCE: %s\n", strerror(errno));
 					quit = true;
 					m_ExitSignal->Reset();
 
+					break;
+				case 2:
+					Expire();
+
 					break;
 				default:
 					break;
 			}
 		}
+
+		CloseTimer();
 	}
 	catch (...)
 	{
@@ -167,14 +136,382 @@ fprintf(stderr, "Cannot set SO_RCVBUFFORCE: %s\n", strerror(errno));
 }
 
 
+/*
+ * Sizes the receive buffer, binds the socket to the stream port and joins the multicast group.
+ */
+bool CUDPServer::SetupSocket()
+{
+	sockaddr_in sockAddr;
+
+	int rcvBufferSize = GetRcvBufferSize();
+	if (rcvBufferSize != 0)
+	{
+		socklen_t size = sizeof(rcvBufferSize);
+		int actualRcvBufferSize = 0;
+		if (getsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF, &actualRcvBufferSize, &size) == 0)
+		{
+			/*
+			 * The Linux kernel doubles the RCVBUFSIZE value to allow space for bookkeeping overhead and
+			 * returns this doubled value.
+			 */
+			actualRcvBufferSize /= 2;
+		}
+		else
+			fprintf(stderr, "Cannot getsockopt(): %s\n", strerror(errno));
+
+		if (actualRcvBufferSize < rcvBufferSize)
+		{
+			/*
+			 * SO_RCVBUFFORCE needs CAP_NET_ADMIN, SO_RCVBUF is capped at rmem_max. Whatever we get,
+			 * the stream runs: a small buffer only risks losses when the receiver stalls.
+			 */
+			if (setsockopt(m_Socket,  SOL_SOCKET, SO_RCVBUFFORCE, &rcvBufferSize, size) &&
+				setsockopt(m_Socket,  SOL_SOCKET, SO_RCVBUF, &rcvBufferSize, size))
+			{
+				fprintf(stderr, "Cannot set SO_RCVBUF: %s\n", strerror(errno));
+			}
+			actualRcvBufferSize = 0;
+			size = sizeof(actualRcvBufferSize);
+			getsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF, &actualRcvBufferSize, &size);
+			actualRcvBufferSize /= 2;
+		}
+
+		m_ActualRcvBufferSize = actualRcvBufferSize;
+
+		uint64_t dataRate = GetDataRate();
+		unsigned int headroom = dataRate ? (unsigned int)((uint64_t)actualRcvBufferSize * 1000 / dataRate) : 0;
+		if (actualRcvBufferSize < rcvBufferSize)
+		{
+			fprintf(stderr, "\nWarning, receive buffer of port %d is %d bytes instead of %d!\n", ntohs(m_port_n), actualRcvBufferSize, rcvBufferSize);
+			if (dataRate)
+				fprintf(stderr, "Packets are lost if the receiver stalls for more than %u ms (%u ms requested).\n",
+					headroom, (unsigned int)((uint64_t)rcvBufferSize * 1000 / dataRate));
+			fprintf(stderr, "Possible workarounds:\n - Run as root\n - Increase /proc/sys/net/core/rmem_max\n\n");
+		}
+		else if (dataRate)
+			printf("Receive buffer of port %d: %d bytes, %u ms stall headroom\n", ntohs(m_port_n), actualRcvBufferSize, headroom);
+	}
+
+	sockAddr.sin_family = AF_INET;
+	sockAddr.sin_port = m_port_n;
+	sockAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	// Binds listening socket to the addres and port.
+	if (bind(m_Socket, reinterpret_cast<const sockaddr*>(&sockAddr), sizeof(sockAddr)))
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot bind to INADDR_ANY:%d : %s", m_port_n, strerror(m_ErrorCode));
+		return false;
+	}
+
+	int ifindex = 0;
+	if (GetInterfacename()[0] != '\0')
+	{
+		struct ifreq ifr;
+		const char *ifname = GetInterfacename();
+
+		strncpy(ifr.ifr_name, ifname, IFNAMSIZ);
+		if (ioctl(m_Socket, SIOCGIFINDEX, &ifr))
+			fprintf(stderr, "Cannot get ifindex: %s\n", strerror(errno));
+		else
+			ifindex = ifr.ifr_ifindex;
+
+#if 0
+		if (setsockopt(m_Socket, SOL_SOCKET, SO_BINDTODEVICE, ifname, strlen(ifname)) < 0)
+			fprintf(stderr, "Cannot bind to device %s: %s\n", ifname, strerror(errno));
+#endif
+	}
+
+#ifndef NEVER
+	if (GetMulticastAddr())
+	{
+		struct ip_mreqn mult;
+		mult.imr_multiaddr.s_addr = GetMulticastAddr();
+		mult.imr_address.s_addr = INADDR_ANY; // The stream interface, or the route of the group without one
+		mult.imr_ifindex = ifindex;
+		if (setsockopt(m_Socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mult, sizeof(mult)) < 0)
+		{
+			m_ErrorCode = errno;
+			fprintf(stderr, "Socket multicast-group setting error %s.\n", strerror(errno));
+			return false;
+		}
+	}
+#endif
+
+	/*
+	 * Kernel arrival time and socket drop count with every packet. Only the statistics suffer without them.
+	 */
+	int on = 1;
+	if (setsockopt(m_Socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)))
+		fprintf(stderr, "Cannot set SO_TIMESTAMPNS: %s\n", strerror(errno));
+	if (setsockopt(m_Socket, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)))
+		fprintf(stderr, "Cannot set SO_RXQ_OVFL: %s\n", strerror(errno));
+
+	/*
+	 * Without UDP_GRO (kernels before 5.0) the datagrams are received one by one.
+	 */
+	m_GroActive = false;
+	if (m_Gro)
+	{
+		if (setsockopt(m_Socket, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)))
+			fprintf(stderr, "Cannot set UDP_GRO: %s\n", strerror(errno));
+		else
+			m_GroActive = true;
+	}
+
+	return true;
+}
+
+
+/*
+ * Creates the socket for a reactor thread. The reactor waits in epoll_wait(), the socket is read without blocking.
+ */
+int CUDPServer::OpenSource()
+{
+	if (CreateSocket() == false)
+		return -1;
+
+	m_ErrorCode = 0;
+
+	int flags = fcntl(m_Socket, F_GETFL);
+	if (SetupSocket() == false || flags == -1 || fcntl(m_Socket, F_SETFL, flags | O_NONBLOCK) == -1)
+	{
+		if (m_ErrorCode == 0)
+			m_ErrorCode = errno;
+		fprintf(stderr, "Cannot set up the socket for the reactor: %s\n", strerror(m_ErrorCode));
+		close(m_Socket);
+		m_Socket = -1;
+		return -1;
+	}
+
+	if (NeedsTimer() && CreateTimer() == false)
+	{
+		close(m_Socket);
+		m_Socket = -1;
+		return -1;
+	}
+
+	return m_Socket;
+}
+
+
+int CUDPServer::ReadSource()
+{
+	return OnRead();
+}
+
+
+void CUDPServer::CloseSource()
+{
+	if (m_Socket != -1)
+	{
+		close(m_Socket);
+		m_Socket = -1;
+	}
+
+	CloseTimer();
+	OnStop();
+}
+
+
+void CUDPServer::OnSourceTimer()
+{
+	Expire();
+}
+
+
+/*
+ * Makes the socket non-blocking, sets SO_BUSY_POLL and pins the thread. Only a non-blocking socket is fatal,
+ * without the others the loop still works, just slower.
+ */
+bool CUDPServer::SetupBusyPoll()
+{
+	int flags = fcntl(m_Socket, F_GETFL);
+	if (flags == -1 || fcntl(m_Socket, F_SETFL, flags | O_NONBLOCK) == -1)
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot make the socket non-blocking: %s\n", strerror(m_ErrorCode));
+		return false;
+	}
+
+	if (m_BusyPollTime > 0 && setsockopt(m_Socket, SOL_SOCKET, SO_BUSY_POLL, &m_BusyPollTime, sizeof(m_BusyPollTime)))
+		fprintf(stderr, "Cannot set SO_BUSY_POLL to %d us: %s\n", m_BusyPollTime, strerror(errno));
+
+	if (m_BusyPollCpu >= 0)
+	{
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(m_BusyPollCpu, &cpuset);
+		int res = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+		if (res)
+			fprintf(stderr, "Cannot pin the receiver to CPU %d: %s\n", m_BusyPollCpu, strerror(res));
+	}
+
+	m_Hits = 0;
+	m_Spins = 0;
+	m_Sleeps = 0;
+
+	return true;
+}
+
+
+/*
+ * Reads the socket until m_SpinBudget reads in a row come back empty, then waits in poll().
+ */
+void CUDPServer::BusyPoll(CWaitForEvents &waitObjects)
+{
+	unsigned int idle = 0;
+	unsigned int loops = 0;
+
+	for (;;)
+	{
+		if (++loops % BUSY_POLL_EXIT_CHECK == 0 && m_ExitSignal->IsSignaled())
+			break;
+
+		if (OnRead() > 0)
+		{
+			++m_Hits;
+			idle = 0;
+			continue;
+		}
+
+		++m_Spins;
+
+		// The timer descriptor is only polled when sleeping, while spinning its deadline is checked here
+		if (m_TimerDeadline && MonotonicTime() >= m_TimerDeadline)
+			Expire();
+
+		if (++idle < m_SpinBudget)
+			continue;
+
+		++m_Sleeps;
+		idle = 0;
+
+		int index = -1;
+		if (waitObjects.WaitAny(-1, &index) != CWaitForEvents::WR_OK)
+		{
+			fprintf(stderr, "WaitAny is not WR_OK!\n");
+		}
+
+		if (index == 1)
+			break;
+		if (index == 2)
+			Expire();
+	}
+}
+
+
+bool CUDPServer::CreateTimer()
+{
+	m_TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (m_TimerFd == -1)
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot create the signal timer: %s\n", strerror(m_ErrorCode));
+		return false;
+	}
+
+	m_TimerDeadline = 0;
+	return true;
+}
+
+
+void CUDPServer::CloseTimer()
+{
+	if (m_TimerFd != -1)
+	{
+		close(m_TimerFd);
+		m_TimerFd = -1;
+	}
+	m_TimerDeadline = 0;
+}
+
+
+uint64_t CUDPServer::MonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+void CUDPServer::ArmTimer(uint64_t deadline)
+{
+	if (m_TimerFd == -1 || (m_TimerDeadline && m_TimerDeadline <= deadline))
+		return;
+
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = deadline / 1000000000ULL;
+	spec.it_value.tv_nsec = deadline % 1000000000ULL;
+	if (timerfd_settime(m_TimerFd, TFD_TIMER_ABSTIME, &spec, NULL))
+	{
+		fprintf(stderr, "Cannot arm the signal timer: %s\n", strerror(errno));
+		return;
+	}
+
+	m_TimerDeadline = deadline;
+}
+
+
+/*
+ * The timer fired (or its deadline passed while spinning). The expiration count is cleared before OnTimer()
+ * can arm it again.
+ */
+void CUDPServer::Expire()
+{
+	uint64_t expirations;
+	if (read(m_TimerFd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "Cannot read the signal timer: %s\n", strerror(errno));
+
+	m_TimerDeadline = 0;
+	OnTimer();
+}
+
+
 int CUDPServer::ReadData(unsigned char *buffer, int length, sockaddr *from, socklen_t *fromlen)
 {
 	int bytes_received = recvfrom(m_Socket, buffer, length, 0, (struct sockaddr *)from, fromlen);
 	if (bytes_received == -1)
 	{
 		m_ErrorCode = errno;
-		fprintf(stderr, "!!!---recvfrom() %s\n", strerror(errno));
+		if (m_ErrorCode != EAGAIN && m_ErrorCode != EWOULDBLOCK)
+			fprintf(stderr, "!!!---recvfrom() %s\n", strerror(errno));
+	}
+
+	return bytes_received;
+}
+
+
+/*
+ * Receives one datagram with its control messages (arrival time, drop count).
+ */
+int CUDPServer::ReadMessage(struct msghdr *message, int flags)
+{
+	int bytes_received = recvmsg(m_Socket, message, flags);
+	if (bytes_received == -1)
+	{
+		m_ErrorCode = errno;
+		if (m_ErrorCode != EAGAIN && m_ErrorCode != EWOULDBLOCK)
+			fprintf(stderr, "!!!---recvmsg() %s\n", strerror(errno));
 	}
 
 	return bytes_received;
 }
+
+
+/*
+ * Receives up to vlen datagrams without blocking. Returns the number of datagrams received.
+ */
+int CUDPServer::ReadBatch(struct mmsghdr *messages, unsigned int vlen)
+{
+	int received = recvmmsg(m_Socket, messages, vlen, MSG_DONTWAIT, NULL);
+	if (received == -1)
+	{
+		m_ErrorCode = errno;
+		if (m_ErrorCode != EAGAIN && m_ErrorCode != EWOULDBLOCK)
+			fprintf(stderr, "!!!---recvmmsg() %s\n", strerror(errno));
+	}
+
+	return received;
+}
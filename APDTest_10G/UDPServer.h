@@ -5,24 +5,91 @@
 
 #include "InterfaceDefs.h"
 #include "SysLnxClasses.h"
+#include "Reactor.h"
 
-class CUDPServer : public UDPBase, public Thread
+class CUDPServer : public UDPBase, public Thread, public CReactorSource
 {
 public:
 	CUDPServer(void);
 	virtual ~CUDPServer(void);
 	void SetListeningPort(int port_h) { m_port_n = htons(port_h); };
 
+	/*
+	 * In busy poll mode the thread reads the non-blocking socket in a loop (with SO_BUSY_POLL) and sleeps
+	 * in poll() only after spinBudget empty reads. cpu < 0 leaves the thread unpinned.
+	 */
+	void SetBusyPoll(bool enable, int cpu, int busyPollTime, unsigned int spinBudget)
+	{
+		m_BusyPoll = enable;
+		m_BusyPollCpu = cpu;
+		m_BusyPollTime = busyPollTime;
+		m_SpinBudget = std::max(spinBudget, 1U);
+	};
+
+	void GetBusyPollStats(uint64_t *hits, uint64_t *spins, uint64_t *sleeps) const
+	{
+		*hits = m_Hits;
+		*spins = m_Spins;
+		*sleeps = m_Sleeps;
+	};
+
+	// UDP_GRO: the kernel may coalesce consecutive datagrams of the stream into one receive
+	void SetGro(bool enable) { m_Gro = enable; };
+	bool IsGroActive() const { return m_GroActive; };
+
+	// SO_RCVBUF of the socket as granted by the kernel (without the kernel's bookkeeping share)
+	int GetActualRcvBufferSize() const { return m_ActualRcvBufferSize; };
+
+	// Reactor mode: the socket is served by a reactor thread instead of Handler()
+	int OpenSource();
+	int ReadSource();
+	void CloseSource();
+	int TimerSource() { return m_TimerFd; };
+	void OnSourceTimer();
+
 private:
 	unsigned int Handler(void);
+	bool SetupSocket();
+	bool SetupBusyPoll();
+	void BusyPoll(CWaitForEvents &waitObjects);
+	bool CreateTimer();
+	void CloseTimer();
+	void Expire();
+
 	int m_port_n;
+	int m_ActualRcvBufferSize;
+	bool m_Gro;
+	bool m_GroActive; // UDP_GRO is set on the socket
+
+	bool         m_BusyPoll;
+	int          m_BusyPollCpu;
+	int          m_BusyPollTime;
+	unsigned int m_SpinBudget;
+	uint64_t     m_Hits;
+	uint64_t     m_Spins;
+	uint64_t     m_Sleeps;
+
+	int      m_TimerFd;       // timerfd, only if NeedsTimer()
+	uint64_t m_TimerDeadline; // CLOCK_MONOTONIC ns the timer is armed for, 0: not armed
 
 protected:
 	int ReadData(unsigned char *buffer, int length, sockaddr *from, socklen_t *fromlen);
-	virtual void OnRead() = 0;
+	int ReadMessage(struct msghdr *message, int flags = 0);
+	int ReadBatch(struct mmsghdr *messages, unsigned int vlen);
+	virtual int OnRead() = 0; // Returns the number of packets read
 	virtual int GetRcvBufferSize() const = 0;
+	virtual uint64_t GetDataRate() const = 0; // Expected bytes per second, 0 if unknown
 	virtual uint32_t GetMulticastAddr() const = 0;
 	virtual const char* GetInterfacename() const = 0;
+
+	/*
+	 * A one-shot timer served by the receive loop together with the socket, OnTimer() runs on the receiver thread.
+	 * ArmTimer() keeps an earlier deadline already armed.
+	 */
+	static uint64_t MonotonicTime(); // ns
+	void ArmTimer(uint64_t deadline);
+	virtual bool NeedsTimer() const = 0;
+	virtual void OnTimer() = 0;
 };
 
 #endif  /* __UDPSERVER_H__ */
@@ -0,0 +1,854 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+
+#include "XskServer.h"
+#include "CamServer.h"
+#include "LnxClasses.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define XSK_COMPLETION_RING_SIZE 64 // Not used for receiving, but the UMEM needs one
+#define BPF_LOG_SIZE             (64 * 1024)
+
+
+static int BpfSyscall(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+static struct bpf_insn BpfInsn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+	struct bpf_insn insn;
+	insn.code = code;
+	insn.dst_reg = dst;
+	insn.src_reg = src;
+	insn.off = off;
+	insn.imm = imm;
+	return insn;
+}
+
+
+/*
+ * The XDP program of an interface, shared by the stream servers receiving on it.
+ *
+ * The program redirects an unfragmented UDP/IPv4 datagram to the AF_XDP socket of its receive queue,
+ * if its destination port is the port of the stream served on that queue. Everything else is passed
+ * to the network stack.
+ */
+class CXdpProgram
+{
+public:
+	static CXdpProgram* Acquire(int ifindex);
+	static void Release(CXdpProgram *program);
+
+	bool IsDriverMode() const { return m_DriverMode; };
+	bool AddQueue(unsigned int queue, uint16_t port_n, int xskSocket);
+	void RemoveQueue(unsigned int queue);
+
+private:
+	CXdpProgram(int ifindex);
+	~CXdpProgram();
+	CXdpProgram(const CXdpProgram&);
+	CXdpProgram& operator=(const CXdpProgram&);
+
+	bool Load();
+	bool Attach();
+	int CreateMap(enum bpf_map_type type);
+	bool UpdateMap(int map, uint32_t key, uint32_t value);
+
+	int  m_Ifindex;
+	int  m_RefCount;
+	int  m_PortMap;  // queue -> stream port (network order)
+	int  m_XskMap;   // queue -> AF_XDP socket
+	int  m_Program;
+	int  m_Link;
+	bool m_DriverMode;
+
+	static Mutex s_Lock;
+	static std::map<int, CXdpProgram*> s_Programs;
+};
+
+Mutex CXdpProgram::s_Lock;
+std::map<int, CXdpProgram*> CXdpProgram::s_Programs;
+
+
+CXdpProgram::CXdpProgram(int ifindex) :
+	m_Ifindex(ifindex),
+	m_RefCount(0),
+	m_PortMap(-1),
+	m_XskMap(-1),
+	m_Program(-1),
+	m_Link(-1),
+	m_DriverMode(false)
+{
+}
+
+
+CXdpProgram::~CXdpProgram()
+{
+	// Closing the link detaches the program
+	if (m_Link != -1)
+		close(m_Link);
+	if (m_Program != -1)
+		close(m_Program);
+	if (m_XskMap != -1)
+		close(m_XskMap);
+	if (m_PortMap != -1)
+		close(m_PortMap);
+}
+
+
+CXdpProgram* CXdpProgram::Acquire(int ifindex)
+{
+	MutexGuard guard(s_Lock);
+
+	std::map<int, CXdpProgram*>::iterator it = s_Programs.find(ifindex);
+	if (it != s_Programs.end())
+	{
+		++it->second->m_RefCount;
+		return it->second;
+	}
+
+	CXdpProgram *program = new CXdpProgram(ifindex);
+	if (program->Load() == false || program->Attach() == false)
+	{
+		delete program;
+		return NULL;
+	}
+
+	program->m_RefCount = 1;
+	s_Programs[ifindex] = program;
+
+	return program;
+}
+
+
+void CXdpProgram::Release(CXdpProgram *program)
+{
+	if (program == NULL)
+		return;
+
+	MutexGuard guard(s_Lock);
+
+	if (--program->m_RefCount == 0)
+	{
+		s_Programs.erase(program->m_Ifindex);
+		delete program;
+	}
+}
+
+
+int CXdpProgram::CreateMap(enum bpf_map_type type)
+{
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = type;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = XSK_MAX_QUEUES;
+
+	int map = BpfSyscall(BPF_MAP_CREATE, &attr);
+	if (map == -1)
+		fprintf(stderr, "Cannot create BPF map: %s\n", strerror(errno));
+
+	return map;
+}
+
+
+bool CXdpProgram::UpdateMap(int map, uint32_t key, uint32_t value)
+{
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map;
+	attr.key = (uint64_t)(unsigned long)&key;
+	attr.value = (uint64_t)(unsigned long)&value;
+	attr.flags = BPF_ANY;
+
+	return BpfSyscall(BPF_MAP_UPDATE_ELEM, &attr) == 0;
+}
+
+
+bool CXdpProgram::Load()
+{
+	m_PortMap = CreateMap(BPF_MAP_TYPE_ARRAY);
+	m_XskMap = CreateMap(BPF_MAP_TYPE_XSKMAP);
+	if (m_PortMap == -1 || m_XskMap == -1)
+		return false;
+
+	/*
+	 * r6: context, r7: receive queue, r8: destination port
+	 */
+	const int16_t PASS = 32;
+	struct bpf_insn program[] = {
+		/*  0 */ BpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+		/*  1 */ BpfInsn(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, data), 0),
+		/*  2 */ BpfInsn(BPF_LDX | BPF_MEM | BPF_W, 3, 6, offsetof(struct xdp_md, data_end), 0),
+		/*  3 */ BpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+		/*  4 */ BpfInsn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, ETH_HLEN + sizeof(struct iphdr) + sizeof(struct udphdr)),
+		/*  5 */ BpfInsn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, PASS - 6, 0),
+		// Ethertype
+		/*  6 */ BpfInsn(BPF_LDX | BPF_MEM | BPF_H, 4, 2, 12, 0),
+		/*  7 */ BpfInsn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, PASS - 8, htons(ETH_P_IP)),
+		// IPv4 without options
+		/*  8 */ BpfInsn(BPF_LDX | BPF_MEM | BPF_B, 4, 2, ETH_HLEN, 0),
+		/*  9 */ BpfInsn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, PASS - 10, 0x45),
+		/* 10 */ BpfInsn(BPF_LDX | BPF_MEM | BPF_B, 4, 2, ETH_HLEN + offsetof(struct iphdr, protocol), 0),
+		/* 11 */ BpfInsn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, PASS - 12, IPPROTO_UDP),
+		// Not a fragment
+		/* 12 */ BpfInsn(BPF_LDX | BPF_MEM | BPF_H, 4, 2, ETH_HLEN + offsetof(struct iphdr, frag_off), 0),
+		/* 13 */ BpfInsn(BPF_ALU64 | BPF_AND | BPF_K, 4, 0, 0, htons(IP_MF | IP_OFFMASK)),
+		/* 14 */ BpfInsn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, PASS - 15, 0),
+		/* 15 */ BpfInsn(BPF_LDX | BPF_MEM | BPF_H, 8, 2, ETH_HLEN + sizeof(struct iphdr) + offsetof(struct udphdr, dest), 0),
+		// Port of the stream on this queue
+		/* 16 */ BpfInsn(BPF_LDX | BPF_MEM | BPF_W, 7, 6, offsetof(struct xdp_md, rx_queue_index), 0),
+		/* 17 */ BpfInsn(BPF_STX | BPF_MEM | BPF_W, 10, 7, -4, 0),
+		/* 18 */ BpfInsn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, m_PortMap),
+		/* 19 */ BpfInsn(0, 0, 0, 0, 0),
+		/* 20 */ BpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0),
+		/* 21 */ BpfInsn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -4),
+		/* 22 */ BpfInsn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+		/* 23 */ BpfInsn(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, PASS - 24, 0),
+		/* 24 */ BpfInsn(BPF_LDX | BPF_MEM | BPF_W, 1, 0, 0, 0),
+		/* 25 */ BpfInsn(BPF_JMP | BPF_JNE | BPF_X, 1, 8, PASS - 26, 0),
+		// Redirect, pass if the queue has no socket
+		/* 26 */ BpfInsn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, m_XskMap),
+		/* 27 */ BpfInsn(0, 0, 0, 0, 0),
+		/* 28 */ BpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 7, 0, 0),
+		/* 29 */ BpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+		/* 30 */ BpfInsn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		/* 31 */ BpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		/* 32 */ BpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+		/* 33 */ BpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+
+	static char log[BPF_LOG_SIZE];
+	log[0] = '\0';
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uint64_t)(unsigned long)program;
+	attr.insn_cnt = sizeof(program) / sizeof(program[0]);
+	attr.license = (uint64_t)(unsigned long)"Dual BSD/GPL";
+	attr.log_buf = (uint64_t)(unsigned long)log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+
+	m_Program = BpfSyscall(BPF_PROG_LOAD, &attr);
+	if (m_Program == -1)
+	{
+		fprintf(stderr, "Cannot load the XDP program: %s\n%s\n", strerror(errno), log);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Attaches the program in driver mode, if the driver does not support XDP in generic (SKB) mode.
+ */
+bool CXdpProgram::Attach()
+{
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = m_Program;
+	attr.link_create.target_ifindex = m_Ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+
+	attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+	m_Link = BpfSyscall(BPF_LINK_CREATE, &attr);
+	if (m_Link != -1)
+	{
+		m_DriverMode = true;
+		return true;
+	}
+
+	int driverError = errno;
+	attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+	m_Link = BpfSyscall(BPF_LINK_CREATE, &attr);
+	if (m_Link != -1)
+	{
+		fprintf(stderr, "XDP driver mode is not available (%s), using generic mode\n", strerror(driverError));
+		return true;
+	}
+
+	fprintf(stderr, "Cannot attach the XDP program: %s\n", strerror(errno));
+	return false;
+}
+
+
+bool CXdpProgram::AddQueue(unsigned int queue, uint16_t port_n, int xskSocket)
+{
+	if (queue >= XSK_MAX_QUEUES)
+	{
+		fprintf(stderr, "Receive queue %u is out of range (max: %d)\n", queue, XSK_MAX_QUEUES - 1);
+		return false;
+	}
+
+	MutexGuard guard(s_Lock);
+
+	if (UpdateMap(m_XskMap, queue, xskSocket) == false || UpdateMap(m_PortMap, queue, port_n) == false)
+	{
+		fprintf(stderr, "Cannot add receive queue %u to the XDP program: %s\n", queue, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+
+void CXdpProgram::RemoveQueue(unsigned int queue)
+{
+	MutexGuard guard(s_Lock);
+
+	UpdateMap(m_PortMap, queue, 0);
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = m_XskMap;
+	attr.key = (uint64_t)(unsigned long)&queue;
+	BpfSyscall(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+
+
+/*
+ * CXskServer
+ */
+CXskServer::CXskServer() : UDPBase(), Thread(),
+	m_port_n(0),
+	m_type(0),
+	m_PacketSize(0),
+	m_RequestedData(0),
+	m_SignalEvent(NULL),
+	m_Length(0),
+	m_DataReceived(0),
+	m_UserData(0),
+	m_MaxPacketNo(0),
+	m_PacketCounter(),
+	m_SignalFrequency(1),
+	m_Queue(0),
+	m_XskSocket(-1),
+	m_Umem(NULL),
+	m_UmemSize(0),
+	m_ChunkSize(0),
+	m_FrameNum(0),
+	m_FillRing(),
+	m_RxRing(),
+	m_Packets(NULL),
+	m_RecycleLock(),
+	m_FrameAddr(NULL),
+	m_FrameEnd(NULL),
+	m_ReceivedFrames(0),
+	m_RecycledFrames(0),
+	m_ConsumedPackets(0),
+	m_DumpWriter(NULL),
+	m_StreamSerial(0),
+	m_MulticastAddr(inet_addr(DEF_MULTICAST_GROUP)),
+	m_Interfacename()
+{
+}
+
+
+CXskServer::~CXskServer()
+{
+	Stop();
+	CloseSocket();
+	FreeUmem();
+
+	delete m_DumpWriter;
+}
+
+
+/*
+ * One stream packet per UMEM frame. The packet table must be larger than the number of frames,
+ * so a table entry is never reused while its packet is still in a frame.
+ */
+void CXskServer::UpdateGeometry()
+{
+	unsigned int packets = (m_PacketSize > 0) ? (unsigned int)std::min(m_Length / m_PacketSize, (uint64_t)XSK_MAX_FRAMES) : 0;
+
+	m_FrameNum = XSK_MIN_FRAMES;
+	while (m_FrameNum < packets)
+		m_FrameNum *= 2;
+
+	m_MaxPacketNo = (m_PacketSize > 0) ? m_FrameNum + 1 : 0;
+}
+
+
+unsigned int CXskServer::Handler(void)
+{
+	try
+	{
+		/*
+		 * The previous UMEM is kept until now, the data processor may read it after the server stopped.
+		 */
+		FreeUmem();
+
+		int ifindex = if_nametoindex(m_Interfacename);
+		if (ifindex == 0)
+		{
+			m_ErrorCode = errno;
+			fprintf(stderr, "AF_XDP needs a stream interface, cannot get ifindex of '%s': %s\n", m_Interfacename, strerror(m_ErrorCode));
+			return -1;
+		}
+
+		if (AllocateUmem() == false)
+			return -1;
+
+		CXdpProgram *program = CXdpProgram::Acquire(ifindex);
+		if (program == NULL)
+			return -1;
+
+		/*
+		 * Zero copy needs the program in the driver, the generic path always copies into the UMEM.
+		 */
+		if (OpenSocket(ifindex, program->IsDriverMode()) == false || program->AddQueue(m_Queue, m_port_n, m_XskSocket) == false)
+		{
+			CloseSocket();
+			CXdpProgram::Release(program);
+			return -1;
+		}
+
+		if (JoinMulticastGroup(ifindex) == false)
+		{
+			program->RemoveQueue(m_Queue);
+			CloseSocket();
+			CXdpProgram::Release(program);
+			return -1;
+		}
+
+		{
+			socketRAII sockraii(m_Socket);
+
+			CLnxEvent networkEvent(m_XskSocket);
+
+			CLnxWaitForEvents waitObjects;
+			waitObjects.Add(&networkEvent);
+			waitObjects.Add(m_ExitSignal);
+
+			m_ErrorCode = 0;
+
+			InitDone();
+
+			bool quit = false;
+			while (!quit)
+			{
+				if (OnRead())
+				{
+					if (m_ExitSignal->IsSignaled())
+						quit = true;
+					continue;
+				}
+
+				int index = -1;
+				if (waitObjects.WaitAny(-1, &index) != CWaitForEvents::WR_OK)
+				{
+					fprintf(stderr, "WaitAny is not WR_OK!\n");
+				}
+
+				if (index == 1)
+				{
+					// Close request
+					quit = true;
+				}
+			}
+			m_ExitSignal->Reset();
+		}
+
+		struct xdp_statistics stats;
+		socklen_t size = sizeof(stats);
+		if (getsockopt(m_XskSocket, SOL_XDP, XDP_STATISTICS, &stats, &size) == 0 &&
+		    (stats.rx_dropped || stats.rx_ring_full || stats.rx_fill_ring_empty_descs))
+		{
+			fprintf(stderr, "AF_XDP queue %u dropped: %llu, rx ring full: %llu, fill ring empty: %llu\n", m_Queue,
+			        (unsigned long long)stats.rx_dropped, (unsigned long long)stats.rx_ring_full,
+			        (unsigned long long)stats.rx_fill_ring_empty_descs);
+		}
+
+		program->RemoveQueue(m_Queue);
+		CloseSocket();
+		CXdpProgram::Release(program);
+	}
+	catch (...)
+	{
+	}
+
+	return 0;
+}
+
+
+bool CXskServer::AllocateUmem()
+{
+	/*
+	 * The kernel puts the frame at XDP_PACKET_HEADROOM in the chunk. Chunks larger than a page need
+	 * huge pages (and a kernel supporting them).
+	 */
+	unsigned int frameSize = XDP_PACKET_HEADROOM + ETH_HLEN + sizeof(struct iphdr) + sizeof(struct udphdr) + m_PacketSize;
+	m_ChunkSize = (frameSize <= XSK_SMALL_CHUNK) ? XSK_SMALL_CHUNK : XSK_JUMBO_CHUNK;
+	if (frameSize > m_ChunkSize)
+	{
+		fprintf(stderr, "Packet size %u is too large for AF_XDP\n", m_PacketSize);
+		return false;
+	}
+
+	m_UmemSize = (uint64_t)m_FrameNum * m_ChunkSize;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	if (m_ChunkSize > XSK_SMALL_CHUNK)
+		flags |= MAP_HUGETLB;
+
+	void *umem = mmap(NULL, m_UmemSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (umem == MAP_FAILED)
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot allocate %" PRIu64 " bytes of UMEM: %s\n", m_UmemSize, strerror(m_ErrorCode));
+		if (flags & MAP_HUGETLB)
+			fprintf(stderr, "Jumbo packets need huge pages, see /proc/sys/vm/nr_hugepages\n");
+		return false;
+	}
+	m_Umem = static_cast<unsigned char*>(umem);
+
+	m_Packets = new const unsigned char*[m_MaxPacketNo]();
+	m_FrameAddr = new uint64_t[m_FrameNum];
+	m_FrameEnd = new unsigned int[m_FrameNum];
+	m_ReceivedFrames = 0;
+	m_RecycledFrames = 0;
+	m_ConsumedPackets = 0;
+
+	return true;
+}
+
+
+void CXskServer::FreeUmem()
+{
+	if (m_Umem)
+	{
+		if (munmap(m_Umem, m_UmemSize))
+			fprintf(stderr, "Cannot munmap() the UMEM: %s\n", strerror(errno));
+		m_Umem = NULL;
+	}
+
+	delete[] m_Packets;
+	m_Packets = NULL;
+	delete[] m_FrameAddr;
+	m_FrameAddr = NULL;
+	delete[] m_FrameEnd;
+	m_FrameEnd = NULL;
+}
+
+
+bool CXskServer::MapRing(XSK_RING *ring, int size, uint64_t pgoff, const struct xdp_ring_offset &offsets, size_t descSize)
+{
+	ring->mapSize = offsets.desc + size * descSize;
+	void *map = mmap(NULL, ring->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_XskSocket, pgoff);
+	if (map == MAP_FAILED)
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot mmap() AF_XDP ring: %s\n", strerror(m_ErrorCode));
+		return false;
+	}
+
+	unsigned char *base = static_cast<unsigned char*>(map);
+	ring->map = map;
+	ring->producer = reinterpret_cast<uint32_t*>(base + offsets.producer);
+	ring->consumer = reinterpret_cast<uint32_t*>(base + offsets.consumer);
+	ring->flags = reinterpret_cast<uint32_t*>(base + offsets.flags);
+	ring->descs = base + offsets.desc;
+	ring->mask = size - 1;
+
+	return true;
+}
+
+
+bool CXskServer::OpenSocket(int ifindex, bool zeroCopy)
+{
+	m_XskSocket = socket(AF_XDP, SOCK_RAW, 0);
+	if (m_XskSocket == -1)
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot create AF_XDP socket: %s\n", strerror(m_ErrorCode));
+		return false;
+	}
+
+	fcntl(m_XskSocket, F_SETFD, FD_CLOEXEC);
+
+	struct xdp_umem_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uint64_t)(unsigned long)m_Umem;
+	reg.len = m_UmemSize;
+	reg.chunk_size = m_ChunkSize;
+	if (setsockopt(m_XskSocket, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)))
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot register UMEM of %u byte frames: %s\n", m_ChunkSize, strerror(m_ErrorCode));
+		return false;
+	}
+
+	int ringSize = m_FrameNum;
+	int completionRingSize = XSK_COMPLETION_RING_SIZE;
+	if (setsockopt(m_XskSocket, SOL_XDP, XDP_UMEM_FILL_RING, &ringSize, sizeof(ringSize)) ||
+	    setsockopt(m_XskSocket, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completionRingSize, sizeof(completionRingSize)) ||
+	    setsockopt(m_XskSocket, SOL_XDP, XDP_RX_RING, &ringSize, sizeof(ringSize)))
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot set AF_XDP ring size %d: %s\n", ringSize, strerror(m_ErrorCode));
+		return false;
+	}
+
+	struct xdp_mmap_offsets offsets;
+	socklen_t size = sizeof(offsets);
+	if (getsockopt(m_XskSocket, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &size))
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot get AF_XDP ring offsets: %s\n", strerror(m_ErrorCode));
+		return false;
+	}
+
+	if (MapRing(&m_FillRing, ringSize, XDP_UMEM_PGOFF_FILL_RING, offsets.fr, sizeof(uint64_t)) == false ||
+	    MapRing(&m_RxRing, ringSize, XDP_PGOFF_RX_RING, offsets.rx, sizeof(struct xdp_desc)) == false)
+		return false;
+
+	/*
+	 * Every frame goes to the kernel
+	 */
+	uint64_t *fill = static_cast<uint64_t*>(m_FillRing.descs);
+	for (unsigned int i = 0; i < m_FrameNum; ++i)
+		fill[i] = (uint64_t)i * m_ChunkSize;
+	__atomic_store_n(m_FillRing.producer, m_FrameNum, __ATOMIC_RELEASE);
+
+	struct sockaddr_xdp sockAddr;
+	memset(&sockAddr, 0, sizeof(sockAddr));
+	sockAddr.sxdp_family = AF_XDP;
+	sockAddr.sxdp_ifindex = ifindex;
+	sockAddr.sxdp_queue_id = m_Queue;
+
+	if (zeroCopy)
+	{
+		sockAddr.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+		if (bind(m_XskSocket, reinterpret_cast<const sockaddr*>(&sockAddr), sizeof(sockAddr)) == 0)
+			return true;
+
+		fprintf(stderr, "AF_XDP zero copy is not available on %s queue %u (%s), using copy mode\n", m_Interfacename, m_Queue, strerror(errno));
+	}
+
+	sockAddr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+	if (bind(m_XskSocket, reinterpret_cast<const sockaddr*>(&sockAddr), sizeof(sockAddr)))
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Cannot bind AF_XDP socket to %s queue %u: %s\n", m_Interfacename, m_Queue, strerror(m_ErrorCode));
+		return false;
+	}
+
+	return true;
+}
+
+
+void CXskServer::CloseSocket()
+{
+	MutexGuard guard(m_RecycleLock);
+
+	XSK_RING *rings[] = { &m_FillRing, &m_RxRing };
+	for (unsigned int i = 0; i < sizeof(rings) / sizeof(rings[0]); ++i)
+	{
+		if (rings[i]->map)
+			munmap(rings[i]->map, rings[i]->mapSize);
+		memset(rings[i], 0, sizeof(*rings[i]));
+	}
+
+	if (m_XskSocket != -1)
+	{
+		close(m_XskSocket);
+		m_XskSocket = -1;
+	}
+}
+
+
+bool CXskServer::JoinMulticastGroup(int ifindex)
+{
+	if (CreateSocket() == false)
+		return false;
+
+	if (m_MulticastAddr == 0)
+		return true;
+
+	struct ip_mreqn mult;
+	mult.imr_multiaddr.s_addr = m_MulticastAddr;
+	mult.imr_address.s_addr = INADDR_ANY;
+	mult.imr_ifindex = ifindex;
+	if (setsockopt(m_Socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mult, sizeof(mult)) < 0)
+	{
+		m_ErrorCode = errno;
+		fprintf(stderr, "Socket multicast-group setting error %s.\n", strerror(m_ErrorCode));
+		close(m_Socket);
+		m_Socket = -1;
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Takes the received frames from the rx ring and enters the stream packets into the packet table.
+ * The counters are published once per call and the data processor is signaled at most once.
+ * Returns false if there was nothing to receive.
+ */
+bool CXskServer::OnRead()
+{
+	uint32_t consumer = *m_RxRing.consumer;
+	uint32_t available = __atomic_load_n(m_RxRing.producer, __ATOMIC_ACQUIRE) - consumer;
+	if (available == 0)
+		return false;
+
+	unsigned int packetCounter = m_PacketCounter.Load();
+	uint64_t dataReceived = m_DataReceived;
+	uint64_t userData = m_UserData;
+	bool signal = false;
+
+	const struct xdp_desc *descs = static_cast<const struct xdp_desc*>(m_RxRing.descs);
+	unsigned int receivedFrames = m_ReceivedFrames;
+	for (uint32_t i = 0; i < available; ++i)
+	{
+		const struct xdp_desc &desc = descs[(consumer + i) & m_RxRing.mask];
+
+		const unsigned char *packet = GetStreamPacket(m_Umem + desc.addr, desc.len);
+		if (packet)
+		{
+			m_Packets[packetCounter % m_MaxPacketNo] = packet;
+			if (CountPacket(packet, m_PacketSize, packetCounter, dataReceived, userData))
+				signal = true;
+		}
+
+		unsigned int frame = receivedFrames % m_FrameNum;
+		m_FrameAddr[frame] = desc.addr & ~(uint64_t)(m_ChunkSize - 1);
+		m_FrameEnd[frame] = packetCounter;
+		++receivedFrames;
+	}
+	__atomic_store_n(m_RxRing.consumer, consumer + available, __ATOMIC_RELEASE);
+
+	m_DataReceived = dataReceived;
+	m_UserData = userData;
+	m_PacketCounter.Publish(packetCounter);
+
+	{
+		MutexGuard guard(m_RecycleLock);
+		m_ReceivedFrames = receivedFrames;
+		// Frames without unprocessed packets go back to the kernel right away
+		RefillFrames();
+	}
+
+	if (signal && m_SignalEvent)
+		m_SignalEvent->Set();
+
+	return true;
+}
+
+
+/*
+ * Returns the UDP payload of a frame if it is a complete packet of this stream, NULL otherwise.
+ */
+const unsigned char* CXskServer::GetStreamPacket(const unsigned char *frame, unsigned int length) const
+{
+	if (length < ETH_HLEN + sizeof(struct iphdr) + sizeof(struct udphdr))
+		return NULL;
+
+	const struct iphdr *ip = reinterpret_cast<const struct iphdr*>(frame + ETH_HLEN);
+	unsigned int ipHeaderLength = ip->ihl * 4;
+	if (ip->protocol != IPPROTO_UDP || length < ETH_HLEN + ipHeaderLength + sizeof(struct udphdr))
+		return NULL;
+
+	const struct udphdr *udp = reinterpret_cast<const struct udphdr*>(frame + ETH_HLEN + ipHeaderLength);
+	if (udp->dest != m_port_n)
+		return NULL;
+
+	unsigned int payloadLength = ntohs(udp->len) - sizeof(struct udphdr);
+	if (payloadLength != m_PacketSize || length < ETH_HLEN + ipHeaderLength + sizeof(struct udphdr) + payloadLength)
+		return NULL;
+
+	return frame + ETH_HLEN + ipHeaderLength + sizeof(struct udphdr);
+}
+
+
+/*
+ * Same accounting as CCamServer::CountPacket(), but the packet stays in the UMEM.
+ */
+bool CXskServer::CountPacket(const unsigned char *pBuffer, int bytes_received, unsigned int &packetCounter, uint64_t &dataReceived, uint64_t &userData)
+{
+	if (m_DumpWriter)
+		m_DumpWriter->Write(pBuffer, bytes_received);
+
+	return CountStreamPacket(pBuffer, bytes_received, m_StreamSerial, m_type, m_RequestedData, m_SignalFrequency,
+		packetCounter, dataReceived, userData);
+}
+
+
+void CXskServer::ReleasePackets(unsigned int packetNo)
+{
+	MutexGuard guard(m_RecycleLock);
+	m_ConsumedPackets = packetNo;
+	RefillFrames();
+}
+
+
+/*
+ * Puts the frames of the consumed packets on the fill ring, in the order they were received.
+ * m_RecycleLock must be held.
+ */
+void CXskServer::RefillFrames()
+{
+	if (m_FillRing.map == NULL)
+		return;
+
+	uint64_t *fill = static_cast<uint64_t*>(m_FillRing.descs);
+	uint32_t producer = *m_FillRing.producer;
+	uint32_t start = producer;
+
+	while (m_RecycledFrames != m_ReceivedFrames)
+	{
+		unsigned int frame = m_RecycledFrames % m_FrameNum;
+		if ((int)(m_FrameEnd[frame] - m_ConsumedPackets) > 0)
+			break;
+
+		fill[producer & m_FillRing.mask] = m_FrameAddr[frame];
+		++producer;
+		++m_RecycledFrames;
+	}
+
+	if (producer == start)
+		return;
+
+	__atomic_store_n(m_FillRing.producer, producer, __ATOMIC_RELEASE);
+
+	/*
+	 * The driver may sleep while the fill ring is empty
+	 */
+	if (__atomic_load_n(m_FillRing.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)
+		recvfrom(m_XskSocket, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+}
+
+
+void CXskServer::OnStop()
+{
+	// Writes out the rest of the dump, the drop count stays until the next dump
+	if (m_DumpWriter)
+		m_DumpWriter->Close();
+
+	if (m_SignalEvent)
+		m_SignalEvent->Set();
+}
@@ -0,0 +1,197 @@
+#pragma once
+#ifndef __XSKSERVER_H__
+
+#define __XSKSERVER_H__
+
+#include <net/if.h>
+#include <linux/if_xdp.h>
+
+#include "InterfaceDefs.h"
+#include "SysLnxClasses.h"
+#include "DumpWriter.h"
+
+#define XSK_MIN_FRAMES      4096
+#define XSK_MAX_FRAMES      (256 * 1024)
+#define XSK_SMALL_CHUNK     4096        // Frame size of a page backed UMEM
+#define XSK_JUMBO_CHUNK     (16 * 1024) // Frame size for jumbo packets, needs a huge page backed UMEM
+#define XSK_MAX_QUEUES      64          // Receive queues per interface the XDP program can serve
+
+/*
+ * Producer/consumer ring shared with the kernel (fill or rx ring of an AF_XDP socket)
+ */
+struct XSK_RING
+{
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void     *descs;
+	uint32_t  mask;
+	void     *map;
+	uint64_t  mapSize;
+};
+
+/*
+ * Stream server receiving through an AF_XDP socket.
+ *
+ * An XDP program on the interface redirects the datagrams of the stream port from the receive queue of the stream
+ * into the socket, they never enter the UDP stack. The packets stay in the UMEM frames and the data processor
+ * reads them in place through GetPacket(). A frame is given back to the kernel (fill ring) when its packet
+ * is released by ReleasePackets().
+ *
+ * The receive queue must get the packets of the stream port, e.g. by an ntuple rule of the NIC.
+ * The program is attached in driver mode if possible, otherwise in generic (SKB) mode.
+ */
+class CXskServer : public UDPBase, public Thread
+{
+public:
+	CXskServer();
+	~CXskServer();
+
+	void SetListeningPort(int port_h) { m_port_n = htons(port_h); };
+
+	// The UMEM is sized after the primary buffer, the buffer itself is not used.
+	void SetBuffer(uint8_t * /*buffer*/, uint64_t length)
+	{
+		m_Length = length;
+		UpdateGeometry();
+	};
+
+	void SetPacketSize(int packetSize)
+	{
+		m_PacketSize = packetSize;
+		UpdateGeometry();
+	};
+
+	void SetStreamSerial(uint32_t serial)
+	{
+		m_StreamSerial = serial;
+	};
+
+	void SetNotification(uint64_t requestedData, CEvent *hEvent)
+	{
+		m_RequestedData = requestedData;
+		m_SignalEvent = hEvent;
+	};
+
+	void SetSignalFrequency(unsigned int frequency)
+	{
+		if (frequency > 0)
+		{
+			m_SignalFrequency = std::min(frequency, m_MaxPacketNo / 2);
+		}
+	};
+
+	void SetQueue(unsigned int queue)
+	{
+		m_Queue = queue;
+	};
+
+	void Reset()
+	{
+		m_DataReceived = 0;
+		m_UserData = 0;
+		m_PacketCounter.Publish(0);
+	};
+
+	void SetType(int type)
+	{
+		m_type = type;
+	};
+
+	// Takes over the writer, NULL: no dump
+	void SetDumpWriter(CDumpWriter *dumpWriter)
+	{
+		delete m_DumpWriter;
+		m_DumpWriter = dumpWriter;
+	};
+
+	uint64_t GetDumpDrops() const { return m_DumpWriter ? m_DumpWriter->GetDroppedPackets() : 0; };
+
+	void SetInterfacename(const char *ifname)
+	{
+		strncpy(m_Interfacename, ifname, IFNAMSIZ);
+		m_Interfacename[IFNAMSIZ] = '\0';
+	}
+
+	// The XDP program goes by the port, only a multicast destination needs anything, the group is joined
+	void SetDestination(uint32_t addr_n, bool multicast)
+	{
+		m_MulticastAddr = multicast ? addr_n : 0;
+	}
+
+	uint64_t GetReceivedData() { return m_DataReceived; };
+	uint64_t GetMaxPacketNo() { return m_MaxPacketNo; };
+	// The packets before it are in the UMEM, complete
+	uint64_t GetPacketNo() { return m_PacketCounter.Acquire(); };
+
+	const unsigned char* GetPacket(unsigned int packetNo) const
+	{
+		return m_Packets[packetNo % m_MaxPacketNo];
+	};
+
+	void ReleasePackets(unsigned int packetNo);
+
+private:
+	CXskServer(const CXskServer&);
+	CXskServer& operator=(const CXskServer&);
+
+	unsigned int Handler(void);
+	void OnStop();
+
+	void UpdateGeometry();
+	bool AllocateUmem();
+	void FreeUmem();
+	bool OpenSocket(int ifindex, bool zeroCopy);
+	void CloseSocket();
+	bool MapRing(XSK_RING *ring, int size, uint64_t pgoff, const struct xdp_ring_offset &offsets, size_t descSize);
+	bool JoinMulticastGroup(int ifindex);
+
+	bool OnRead();
+	const unsigned char* GetStreamPacket(const unsigned char *frame, unsigned int length) const;
+	bool CountPacket(const unsigned char *pBuffer, int bytes_received, unsigned int &packetCounter, uint64_t &dataReceived, uint64_t &userData);
+	void RefillFrames();
+
+	int m_port_n;
+	int m_type; // 0_ one-shot, 1:cyclic
+	unsigned int m_PacketSize;
+	uint64_t m_RequestedData;
+	CEvent *m_SignalEvent;
+
+	uint64_t m_Length;
+	uint64_t m_DataReceived;
+	uint64_t m_UserData;
+	unsigned int m_MaxPacketNo;  // The size of the packet table, larger than the number of UMEM frames
+	PacketCursor m_PacketCounter;
+	unsigned int m_SignalFrequency;
+
+	unsigned int   m_Queue;
+	int            m_XskSocket;
+	unsigned char *m_Umem;
+	uint64_t       m_UmemSize;
+	unsigned int   m_ChunkSize;
+	unsigned int   m_FrameNum;
+	XSK_RING       m_FillRing;
+	XSK_RING       m_RxRing;
+
+	const unsigned char **m_Packets; // Stream packets in the UMEM, indexed by packet number % m_MaxPacketNo
+
+	/*
+	 * Frames are counted from the start of the measurement in the order they were received.
+	 * m_FrameEnd is the packet counter after the packet of the frame: the frame can be reused
+	 * when the data processor consumed that many packets. The receiver and the data processor
+	 * both recycle frames, m_RecycleLock serializes them (the fill ring has a single producer).
+	 */
+	Mutex         m_RecycleLock;
+	uint64_t     *m_FrameAddr;
+	unsigned int *m_FrameEnd;
+	unsigned int  m_ReceivedFrames;
+	unsigned int  m_RecycledFrames;
+	unsigned int  m_ConsumedPackets;
+
+	CDumpWriter *m_DumpWriter;
+	uint32_t m_StreamSerial;
+	uint32_t m_MulticastAddr; // 0: unicast stream
+	char     m_Interfacename[IFNAMSIZ + 1];
+};
+
+#endif  /* __XSKSERVER_H__ */
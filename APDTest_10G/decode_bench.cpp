@@ -0,0 +1,314 @@
+/*
+ * Decoder throughput: decodes a buffer of synthetic stream packets in place, as the packets lie in the primary
+ * buffer, and with every payload copied to a staging buffer first (the extra pass of the former work buffer).
+ * Then in place with each unpack kernel the CPU supports, and with the best one writing the channel buffers
+ * with streaming stores, and on a decode pool of THREADS helpers, BENCH_NOTIFY packets a batch as the
+ * primary buffer notifications come. All results must be the same. Last with the best kernel in calibrated mode,
+ * checked against the scalar samples calibrated one by one, into an interleaved user buffer checked against the
+ * channel buffers, and decimated by BENCH_DECIMATION into a second ring as well, checked against the averages
+ * of the full-rate ring.
+ *
+ * decode_bench [BITS [CHANNEL_MASK [PACKETSIZE [ROUNDS [THREADS]]]]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+
+#include "DataEvaluation.h"
+#include "GECCommands.h"
+#include "LnxClasses.h"
+
+#define BENCH_PACKETS 8192
+#define BENCH_NOTIFY 64
+#define BENCH_DECIMATION 100
+#define BENCH_PACKETSIZE (1119 * CC_OCTET_SIZE + sizeof(CC_STREAMHEADER)) // The default of APDCAM_ARM at 9000 byte MTU
+
+class CBenchEvaluation : public CDataEvaluation
+{
+public:
+	void Decode(const unsigned char *packets, unsigned int count, unsigned int packetSize, unsigned char *staging)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			const unsigned char *pPacket = packets + (uint64_t)i * packetSize;
+			const unsigned char *pFrame = pPacket + sizeof(CC_STREAMHEADER);
+			if (staging)
+			{
+				memcpy(staging, pFrame, m_ADCPacketSize);
+				pFrame = staging;
+			}
+			if (m_DecodePool && i % BENCH_NOTIFY == 0)
+			{
+				DecodeQueued();
+				m_Parallel = true;
+				m_QueuedSamples = m_SampleCount;
+			}
+			ProcessFrame(reinterpret_cast<const CC_STREAMHEADER*>(pPacket), pFrame, i);
+		}
+		DecodeQueued();
+	}
+};
+
+
+/*
+ * Offsets and gains of the calibrated run: large enough to saturate, some gains negative.
+ */
+static void GetBenchCalibration(INT16 *offsets, double *gains)
+{
+	for (int i = 0; i < CHANNEL_NUM; ++i)
+	{
+		offsets[i] = (INT16)((i * 397) % 1000 - 500);
+		gains[i] = (i % 5 == 4) ? -1.25 - i * 0.01 : 0.75 + i * 0.05;
+	}
+}
+
+
+/*
+ * The value the decoder stores in calibrated mode, with the gain rounded to CALIB_GAIN_BITS as SetCalibration() does.
+ */
+static INT16 CalibrateValue(INT16 value, INT16 offset, double gain)
+{
+	int32_t fixedGain = (int32_t)std::min(floor(gain * (1 << CALIB_GAIN_BITS) + 0.5), 32767.0);
+	int32_t diff = std::min(std::max((int32_t)value - offset, -32768), 32767);
+	int32_t calibrated = (diff * fixedGain + (1 << (CALIB_GAIN_BITS - 1))) >> CALIB_GAIN_BITS;
+	return (INT16)std::min(std::max(calibrated, -32768), 32767);
+}
+
+
+/*
+ * The first samples (all of them once the ring wrapped) of the active channels, channel-major rings of ringSamples.
+ */
+static bool CheckCalibrated(const unsigned char *raw, const unsigned char *calibrated, uint32_t channelMask, uint64_t ringSamples, uint64_t samples)
+{
+	INT16 offsets[CHANNEL_NUM];
+	double gains[CHANNEL_NUM];
+	GetBenchCalibration(offsets, gains);
+
+	const INT16 *rawData = reinterpret_cast<const INT16*>(raw);
+	const INT16 *calibratedData = reinterpret_cast<const INT16*>(calibrated);
+	uint64_t count = std::min(samples, ringSamples);
+	int active = 0;
+	for (int channel = 0; channel < CHANNEL_NUM; ++channel)
+	{
+		if ((channelMask & (1U << channel)) == 0)
+			continue;
+
+		const INT16 *rawChannel = rawData + active * ringSamples;
+		const INT16 *calibratedChannel = calibratedData + active * ringSamples;
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			if (calibratedChannel[i] != CalibrateValue(rawChannel[i], offsets[channel], gains[channel]))
+				return false;
+		}
+		++active;
+	}
+	return true;
+}
+
+
+/*
+ * The interleaved ring against the channel-major one, over the samples written so far.
+ */
+static bool CheckInterleaved(const unsigned char *channels, const unsigned char *interleaved, uint32_t channelMask, uint64_t ringSamples, uint64_t samples)
+{
+	const INT16 *channelData = reinterpret_cast<const INT16*>(channels);
+	const INT16 *interleavedData = reinterpret_cast<const INT16*>(interleaved);
+	unsigned int stride = __builtin_popcount(channelMask);
+	uint64_t count = std::min(samples, ringSamples);
+	for (unsigned int active = 0; active < stride; ++active)
+	{
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			if (interleavedData[i * stride + active] != channelData[active * ringSamples + i])
+				return false;
+		}
+	}
+	return true;
+}
+
+
+/*
+ * The decimated ring against the boxcar means of the full-rate ring, rounded half away from 0, for the windows
+ * both rings still hold.
+ */
+static bool CheckDecimated(const unsigned char *channels, const unsigned char *decimated, uint32_t channelMask, uint64_t ringSamples,
+	uint64_t decimatedRingSamples, unsigned int factor, uint64_t samples, uint64_t windows)
+{
+	if (windows != samples / factor)
+		return false;
+
+	const INT16 *channelData = reinterpret_cast<const INT16*>(channels);
+	const INT16 *decimatedData = reinterpret_cast<const INT16*>(decimated);
+	unsigned int active = __builtin_popcount(channelMask);
+	uint64_t first = (windows > decimatedRingSamples) ? windows - decimatedRingSamples : 0;
+	if (samples > ringSamples)
+		first = std::max(first, (samples - ringSamples + factor - 1) / factor);
+
+	for (uint64_t window = first; window < windows; ++window)
+	{
+		for (unsigned int channel = 0; channel < active; ++channel)
+		{
+			int64_t sum = 0;
+			for (uint64_t i = window * factor; i < (window + 1) * factor; ++i)
+				sum += channelData[channel * ringSamples + i % ringSamples];
+
+			const int64_t f = factor;
+			INT16 mean = (INT16)(sum >= 0 ? (sum + f / 2) / f : -((f / 2 - sum) / f));
+			if (decimatedData[channel * decimatedRingSamples + window % decimatedRingSamples] != mean)
+				return false;
+		}
+	}
+	return true;
+}
+
+
+static double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Decodes the packets rounds times, returns the payload bytes per second.
+ */
+static double Run(unsigned int bits, uint32_t channelMask, unsigned int packetSize, unsigned int rounds,
+	const unsigned char *packets, unsigned char *userBuffer, uint64_t userBufferSize, bool copy, UNPACK_ISA isa, bool stream = false, bool calibrated = false, CDecodePool *pool = NULL, bool interleaved = false, unsigned int decimation = 0,
+	unsigned char *decimated = NULL, uint64_t decimationSize = 0, uint64_t *samples = NULL, uint64_t *windows = NULL)
+{
+	static unsigned char workBuffer[4096];
+	unsigned int payload = packetSize - sizeof(CC_STREAMHEADER);
+	unsigned char *staging = copy ? new unsigned char[payload] : NULL;
+
+	CBenchEvaluation eval;
+	eval.SetParams(bits, channelMask, payload);
+	eval.SetUnpackIsa(isa);
+	eval.SetStreamStores(stream);
+	eval.SetCalibratedMode(calibrated);
+	if (calibrated)
+	{
+		INT16 offsets[CHANNEL_NUM];
+		double gains[CHANNEL_NUM];
+		GetBenchCalibration(offsets, gains);
+		eval.SetCalibration(offsets, gains);
+	}
+	eval.SetDecodePool(pool);
+	eval.SetBuffers(workBuffer, userBuffer, userBufferSize, interleaved);
+	eval.SetDecimation(decimation, decimated, decimationSize);
+	eval.DisableTrigger();
+	eval.SetStopAt(0);
+	eval.BeginProcessing();
+
+	double begin = Now();
+	for (unsigned int round = 0; round < rounds; ++round)
+		eval.Decode(packets, BENCH_PACKETS, packetSize, staging);
+	double seconds = Now() - begin;
+
+	if (samples)
+		*samples = eval.GetSampleCount();
+	if (windows)
+		*windows = eval.GetDecimatedCount();
+	delete[] staging;
+	return (double)payload * BENCH_PACKETS * rounds / seconds;
+}
+
+
+int main(int argc, char *argv[])
+{
+	unsigned int bits = (argc > 1) ? strtoul(argv[1], NULL, 0) : 14;
+	uint32_t channelMask = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0xFFFFFFFF;
+	unsigned int packetSize = (argc > 3) ? strtoul(argv[3], NULL, 0) : BENCH_PACKETSIZE;
+	unsigned int rounds = (argc > 4) ? strtoul(argv[4], NULL, 0) : 20;
+	unsigned int threads = (argc > 5) ? strtoul(argv[5], NULL, 0) : 2;
+
+	if (bits != 8 && bits != 12 && bits != 14)
+	{
+		fprintf(stderr, "Bits must be 8, 12 or 14\n");
+		return 1;
+	}
+	if (packetSize <= sizeof(CC_STREAMHEADER) || rounds == 0)
+	{
+		fprintf(stderr, "Wrong packet size or rounds\n");
+		return 1;
+	}
+
+	unsigned char *packets = new unsigned char[(uint64_t)packetSize * BENCH_PACKETS];
+	srand(1);
+	for (uint64_t i = 0; i < (uint64_t)packetSize * BENCH_PACKETS; ++i)
+		packets[i] = rand();
+
+	// Large enough for the samples of one round, so that both runs end at the same place of the ring
+	uint64_t userBufferSize = ((uint64_t)packetSize * BENCH_PACKETS / 2 + 4096) & ~4095ULL;
+	unsigned char *inPlace = new unsigned char[CHANNEL_NUM * userBufferSize]();
+	unsigned char *copied = new unsigned char[CHANNEL_NUM * userBufferSize]();
+
+	double copyRate = Run(bits, channelMask, packetSize, rounds, packets, copied, userBufferSize, true, UI_SCALAR);
+	uint64_t samples = 0;
+	double inPlaceRate = Run(bits, channelMask, packetSize, rounds, packets, inPlace, userBufferSize, false, UI_SCALAR,
+		false, false, NULL, false, 0, NULL, 0, &samples);
+
+	printf("bits %u, channel mask 0x%08X, packet size %u, %u packets x %u rounds\n", bits, channelMask, packetSize, BENCH_PACKETS, rounds);
+	printf("copy + decode:   %8.1f MB/s\n", copyRate / 1e6);
+	printf("decode in place: %8.1f MB/s (%+.1f%%)\n", inPlaceRate / 1e6, (inPlaceRate / copyRate - 1) * 100);
+
+	bool same = memcmp(inPlace, copied, CHANNEL_NUM * userBufferSize) == 0;
+
+	for (int isa = UI_SCALAR + 1; isa <= GetUnpackIsa(); ++isa)
+	{
+		memset(copied, 0, CHANNEL_NUM * userBufferSize);
+		double rate = Run(bits, channelMask, packetSize, rounds, packets, copied, userBufferSize, false, (UNPACK_ISA)isa);
+		printf("%-15s  %8.1f MB/s (%+.1f%%)\n", GetUnpackIsaName((UNPACK_ISA)isa), rate / 1e6, (rate / inPlaceRate - 1) * 100);
+		same = same && memcmp(inPlace, copied, CHANNEL_NUM * userBufferSize) == 0;
+	}
+
+	memset(copied, 0, CHANNEL_NUM * userBufferSize);
+	double streamRate = Run(bits, channelMask, packetSize, rounds, packets, copied, userBufferSize, false, GetUnpackIsa(), true);
+	printf("%-6s streaming  %8.1f MB/s (%+.1f%%)\n", GetUnpackIsaName(GetUnpackIsa()), streamRate / 1e6, (streamRate / inPlaceRate - 1) * 100);
+	same = same && memcmp(inPlace, copied, CHANNEL_NUM * userBufferSize) == 0;
+
+	CAPDFactory::SetAPDFactory(new CLnxFactory());
+	CDecodePool pool;
+	if (!pool.SetThreads(threads))
+		return 1;
+	memset(copied, 0, CHANNEL_NUM * userBufferSize);
+	double poolRate = Run(bits, channelMask, packetSize, rounds, packets, copied, userBufferSize, false, GetUnpackIsa(), false, false, &pool);
+	printf("%-6s %u helpers  %8.1f MB/s (%+.1f%%)\n", GetUnpackIsaName(GetUnpackIsa()), threads, poolRate / 1e6, (poolRate / inPlaceRate - 1) * 100);
+	same = same && memcmp(inPlace, copied, CHANNEL_NUM * userBufferSize) == 0;
+
+	printf("samples %s\n", same ? "identical" : "DIFFER");
+
+	double calibratedRate = Run(bits, channelMask, packetSize, rounds, packets, copied, userBufferSize, false, GetUnpackIsa(), false, true);
+	printf("%-6s calibrated %8.1f MB/s (%+.1f%%)\n", GetUnpackIsaName(GetUnpackIsa()), calibratedRate / 1e6, (calibratedRate / inPlaceRate - 1) * 100);
+	bool calibratedSame = CheckCalibrated(inPlace, copied, channelMask, userBufferSize / sizeof(INT16), samples);
+	printf("calibrated samples %s\n", calibratedSame ? "identical" : "DIFFER");
+	same = same && calibratedSame;
+
+	double interleavedRate = Run(bits, channelMask, packetSize, rounds, packets, copied, userBufferSize, false, GetUnpackIsa(), false, false, NULL, true);
+	printf("%-6s interleaved%8.1f MB/s (%+.1f%%)\n", GetUnpackIsaName(GetUnpackIsa()), interleavedRate / 1e6, (interleavedRate / inPlaceRate - 1) * 100);
+	bool interleavedSame = CheckInterleaved(inPlace, copied, channelMask, userBufferSize / sizeof(INT16), samples);
+	printf("interleaved samples %s\n", interleavedSame ? "identical" : "DIFFER");
+	same = same && interleavedSame;
+
+	// Bytes per channel, whole samples so that every channel ring starts on a sample
+	uint64_t decimationSize = userBufferSize / BENCH_DECIMATION / sizeof(INT16) * sizeof(INT16);
+	unsigned char *decimated = new unsigned char[CHANNEL_NUM * decimationSize]();
+	uint64_t windows = 0;
+	double decimatedRate = Run(bits, channelMask, packetSize, rounds, packets, copied, userBufferSize, false, GetUnpackIsa(), false, false, NULL, false,
+		BENCH_DECIMATION, decimated, decimationSize, &samples, &windows);
+	printf("%-6s decimated  %8.1f MB/s (%+.1f%%)\n", GetUnpackIsaName(GetUnpackIsa()), decimatedRate / 1e6, (decimatedRate / inPlaceRate - 1) * 100);
+	bool decimatedSame = CheckDecimated(copied, decimated, channelMask, userBufferSize / sizeof(INT16), decimationSize / sizeof(INT16),
+		BENCH_DECIMATION, samples, windows);
+	printf("decimated samples %s\n", decimatedSame ? "identical" : "DIFFER");
+	same = same && decimatedSame;
+
+	delete[] decimated;
+
+	delete[] copied;
+	delete[] inPlace;
+	delete[] packets;
+	return same ? 0 : 1;
+}